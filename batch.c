@@ -0,0 +1,510 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include "lrparser.h"
+
+#define BLOCK_RECORDS 65536    // Records read per parallel block
+#define TASK_RECORDS 256       // Records per stealable task
+
+// Function prototypes from other modules
+int parse_flat(Grammar* grammar, Table* table, const char* input, int input_len,
+               Stack* stack, FlatTree* tree, int* error_pos);
+int recognize(Grammar* grammar, Table* table, const char* input, int input_len,
+              StateStack* stack, int* error_pos);
+int diagnose(Grammar* grammar, Table* table, const char* input, int input_len,
+             StateStack* stack, ErrorList* errors);
+int outbuf_write(OutBuf* out, const char* data, size_t len);
+int flat_tree_write(FlatTree* tree, const Grammar* grammar, int format, OutBuf* out);
+int escape_terminal(char* out, int c);
+
+Stack* create_stack(int initial_capacity);
+void free_stack(Stack* stack);
+StateStack* create_state_stack(int initial_capacity);
+void free_state_stack(StateStack* stack);
+
+FlatTree* create_flat_tree(int capacity);
+void free_flat_tree(FlatTree* tree);
+
+ParserStats* create_stats(int num_states, int num_rules);
+void free_stats(ParserStats* stats);
+void merge_stats(ParserStats* dst, ParserStats* src);
+
+// Buffered reader for delimiter-separated records of any length
+typedef struct {
+    FILE* fp;
+    char* buf;
+    size_t cap;
+    size_t start;       // First unread byte
+    size_t end;         // One past the last buffered byte
+    int eof;
+} RecordReader;
+
+// Read the next record; returns 0 when the input is exhausted.
+// The returned pointer stays valid until the next call.
+static int read_record(RecordReader* reader, char delim, char** record, size_t* len) {
+    size_t scan = reader->start;
+
+    while (1) {
+        char* hit = memchr(reader->buf + scan, delim, reader->end - scan);
+        if (hit) {
+            *record = reader->buf + reader->start;
+            *len = hit - *record;
+            reader->start = hit - reader->buf + 1;
+            return 1;
+        }
+
+        if (reader->eof) {
+            // Last record without a trailing delimiter
+            if (reader->start == reader->end) return 0;
+            *record = reader->buf + reader->start;
+            *len = reader->end - reader->start;
+            reader->start = reader->end;
+            return 1;
+        }
+
+        // Move the partial record to the front, grow if it fills the buffer
+        size_t pending = reader->end - reader->start;
+        memmove(reader->buf, reader->buf + reader->start, pending);
+        scan = pending;
+        reader->start = 0;
+        reader->end = pending;
+        if (reader->end == reader->cap) {
+            reader->cap *= 2;
+            reader->buf = (char*)realloc(reader->buf, reader->cap);
+        }
+
+        size_t got = fread(reader->buf + reader->end, 1, reader->cap - reader->end, reader->fp);
+        if (got == 0) reader->eof = 1;
+        reader->end += got;
+    }
+}
+
+// Parse one record: flat post-order tree, or recognize-only without one.
+// With an error list, rejected records are rescanned with error recovery
+// (records without a tree need only that one pass). Records longer than
+// INT_MAX are refused with LR_ERR_ARG, as lr_parse does.
+static int parse_record(Grammar* grammar, Table* table, const char* input, size_t len, int tree_format,
+                        Stack* stack, StateStack* states, FlatTree* tree, ErrorList* errors,
+                        ParseResult* result) {
+    int status;
+    int error_pos = -1;
+    result->tree = NULL;
+    if (errors) errors->count = 0;
+    if (len > INT_MAX) {
+        status = LR_ERR_ARG;
+        result->error_pos = -1;
+    } else if (tree_format) {
+        status = parse_flat(grammar, table, input, len, stack, tree, &error_pos);
+        result->error_pos = error_pos;
+        if (status == 0 && errors) {
+            diagnose(grammar, table, input, len, states, errors);
+        }
+    } else if (errors) {
+        status = diagnose(grammar, table, input, len, states, errors);
+        result->error_pos = errors->count > 0 ? errors->items[0].pos : -1;
+    } else {
+        status = recognize(grammar, table, input, len, states, &error_pos);
+        result->error_pos = error_pos;
+    }
+    if (status < 0) fprintf(stderr, "Error: %s\n", lr_strerror(status));
+    result->accepted = (status == 1);
+    return status;
+}
+
+// Append "<pos>:<expected terminals>" for each error, space-separated
+static void format_errors(OutBuf* out, ErrorList* errors) {
+    char line[4 * NT_BASE + 32];
+    for (int i = 0; i < errors->count; i++) {
+        ParseError* error = &errors->items[i];
+        int n = snprintf(line, sizeof(line), "%s%d:", i > 0 ? " " : "", error->pos);
+        for (int c = 0; c < NT_BASE; c++) {
+            if (TERMSET_HAS(error->expected, c)) n += escape_terminal(line + n, c);
+        }
+        outbuf_write(out, line, n);
+    }
+}
+
+// Append one result record: "<n>\tACCEPT[\t<tree>]" or "<n>\tREJECT\t<pos>",
+// followed by "\t<errors>" when all errors are collected. The tree is
+// written in 'tree_format' (a single-line format).
+static void format_result(OutBuf* out, long index, int status, ParseResult* result, FlatTree* tree,
+                          int tree_format, Grammar* grammar, ErrorList* errors) {
+    char line[64];
+    int n;
+    if (status == 1) {
+        n = snprintf(line, sizeof(line), "%ld\tACCEPT", index);
+        outbuf_write(out, line, n);
+        if (tree && tree->count > 0) {
+            outbuf_write(out, "\t", 1);
+            flat_tree_write(tree, grammar, tree_format, out);
+        }
+        outbuf_write(out, "\n", 1);
+    } else {
+        n = snprintf(line, sizeof(line), "%ld\tREJECT\t%ld", index, result->error_pos);
+        outbuf_write(out, line, n);
+        if (errors) {
+            outbuf_write(out, "\t", 1);
+            format_errors(out, errors);
+        }
+        outbuf_write(out, "\n", 1);
+    }
+}
+
+// Report batch throughput on stderr
+static void report_throughput(long count, long rejected, struct timespec* t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+    fprintf(stderr, "Batch: %ld inputs (%ld accepted, %ld rejected) in %.3f s, %.0f inputs/sec\n",
+            count, count - rejected, rejected, seconds,
+            seconds > 0 ? count / seconds : 0.0);
+}
+
+// Parse every record of 'in' against one loaded grammar/table.
+// Writes one result line per record and returns the number of rejected records.
+long run_batch(Grammar* grammar, Table* table, FILE* in, char delim, int tree_format,
+               int all_errors) {
+    RecordReader reader = { in, (char*)malloc(1 << 16), 1 << 16, 0, 0, 0 };
+    Stack* stack = create_stack(100);
+    StateStack* states = create_state_stack(100);
+    FlatTree* tree = create_flat_tree(1024);
+    OutBuf out = { NULL, 0, 0 };
+    ErrorList errors = { NULL, 0, 0 };
+    ParseResult result;
+
+    long count = 0;
+    long rejected = 0;
+    char* record;
+    size_t len;
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (read_record(&reader, delim, &record, &len)) {
+        // Tolerate CRLF line endings
+        if (delim == '\n' && len > 0 && record[len - 1] == '\r') len--;
+
+        STAT_TIME_BEGIN(parse_start);
+        int status = parse_record(grammar, table, record, len, tree_format,
+                                  stack, states, tree, all_errors ? &errors : NULL, &result);
+        STAT_TIME_END(parse_start, PHASE_PARSE);
+        if (status != 1) rejected++;
+        STAT_TIME_BEGIN(output_start);
+        format_result(&out, count, status, &result, tree_format ? tree : NULL, tree_format,
+                      grammar, all_errors ? &errors : NULL);
+        STAT_TIME_END(output_start, PHASE_OUTPUT);
+
+        if (out.len >= (1 << 16)) {
+            fwrite(out.data, 1, out.len, stdout);
+            out.len = 0;
+        }
+
+        count++;
+    }
+    fwrite(out.data, 1, out.len, stdout);
+    fflush(stdout);
+
+    report_throughput(count, rejected, &t0);
+
+    free(out.data);
+    free(errors.items);
+    free_flat_tree(tree);
+    free_state_stack(states);
+    free_stack(stack);
+    free(reader.buf);
+    return rejected;
+}
+
+// A contiguous range of records, rendered into its own output buffer
+typedef struct {
+    int first;
+    int count;
+    long rejected;
+    OutBuf out;
+} BatchTask;
+
+// Per-worker deque of task indices: the owner pops from the tail,
+// idle workers steal from the head
+typedef struct {
+    pthread_mutex_t lock;
+    int* tasks;
+    int head;
+    int tail;
+    int generation;     // Block the tasks belong to
+} TaskDeque;
+
+typedef struct BatchPool BatchPool;
+
+typedef struct {
+    BatchPool* pool;
+    int id;
+    pthread_t thread;
+    TaskDeque deque;
+    Stack* stack;       // Private parser stack
+    StateStack* states; // Private recognizer stack
+    FlatTree* tree;     // Private flat tree buffer
+    ErrorList errors;   // Private error list
+    ParserStats* stats; // Private counters, merged after the run (NULL = off)
+} Worker;
+
+// Shared state of the parallel batch driver
+struct BatchPool {
+    Grammar* grammar;   // Read-only once loaded
+    Table* table;       // Read-only once loaded
+    int tree_format;
+    int all_errors;
+
+    Worker* workers;
+    int num_workers;
+
+    // Current block of records
+    char* data;
+    size_t* offsets;
+    size_t* lengths;
+    long base_index;
+    BatchTask* tasks;
+    int num_tasks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    int generation;     // Bumped for every new block
+    int remaining;      // Tasks of the current block not yet finished
+    int shutdown;
+};
+
+// Take the next task of block 'generation': own tail first, then steal
+// from the other heads. A worker still finishing a block must not take
+// tasks of the next one, whose count is not its own.
+static int take_task(Worker* worker, int generation) {
+    BatchPool* pool = worker->pool;
+    TaskDeque* own = &worker->deque;
+
+    pthread_mutex_lock(&own->lock);
+    if (own->generation == generation && own->tail > own->head) {
+        int task = own->tasks[--own->tail];
+        pthread_mutex_unlock(&own->lock);
+        return task;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; i < pool->num_workers; i++) {
+        TaskDeque* victim = &pool->workers[(worker->id + i) % pool->num_workers].deque;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->generation == generation && victim->tail > victim->head) {
+            int task = victim->tasks[victim->head++];
+            pthread_mutex_unlock(&victim->lock);
+            return task;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return -1;
+}
+
+// Parse all records of one task into its output buffer
+static void run_task(Worker* worker, BatchTask* task) {
+    BatchPool* pool = worker->pool;
+    ParseResult result;
+    ErrorList* errors = pool->all_errors ? &worker->errors : NULL;
+
+    task->out.len = 0;
+    task->rejected = 0;
+    for (int i = task->first; i < task->first + task->count; i++) {
+        STAT_TIME_BEGIN(parse_start);
+        int status = parse_record(pool->grammar, pool->table, pool->data + pool->offsets[i],
+                                  pool->lengths[i], pool->tree_format, worker->stack,
+                                  worker->states, worker->tree, errors, &result);
+        STAT_TIME_END(parse_start, PHASE_PARSE);
+        if (status != 1) task->rejected++;
+        STAT_TIME_BEGIN(output_start);
+        format_result(&task->out, pool->base_index + i, status, &result,
+                      pool->tree_format ? worker->tree : NULL, pool->tree_format, pool->grammar,
+                      errors);
+        STAT_TIME_END(output_start, PHASE_OUTPUT);
+    }
+}
+
+// Worker thread: process each published block until shutdown
+static void* worker_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    BatchPool* pool = worker->pool;
+    int seen = 0;
+#ifndef LR_NO_STATS
+    lr_stats = worker->stats;
+#endif
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        int task;
+        while ((task = take_task(worker, seen)) >= 0) {
+            run_task(worker, &pool->tasks[task]);
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->remaining == 0) {
+                pthread_cond_signal(&pool->work_done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Parallel version of run_batch with 'num_threads' workers sharing the
+// read-only grammar and table. Records are processed in blocks; output
+// is written in input order after each block.
+long run_batch_parallel(Grammar* grammar, Table* table, FILE* in, char delim,
+                        int tree_format, int all_errors, int num_threads) {
+    RecordReader reader = { in, (char*)malloc(1 << 16), 1 << 16, 0, 0, 0 };
+    int max_tasks = (BLOCK_RECORDS + TASK_RECORDS - 1) / TASK_RECORDS;
+
+    BatchPool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.grammar = grammar;
+    pool.table = table;
+    pool.tree_format = tree_format;
+    pool.all_errors = all_errors;
+    pool.num_workers = num_threads;
+    pool.workers = (Worker*)calloc(num_threads, sizeof(Worker));
+    pool.offsets = (size_t*)malloc(BLOCK_RECORDS * sizeof(size_t));
+    pool.lengths = (size_t*)malloc(BLOCK_RECORDS * sizeof(size_t));
+    pool.tasks = (BatchTask*)calloc(max_tasks, sizeof(BatchTask));
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work_ready, NULL);
+    pthread_cond_init(&pool.work_done, NULL);
+
+    size_t data_cap = 1 << 16;
+    pool.data = (char*)malloc(data_cap);
+
+    for (int w = 0; w < num_threads; w++) {
+        Worker* worker = &pool.workers[w];
+        worker->pool = &pool;
+        worker->id = w;
+        worker->stack = create_stack(100);
+        worker->states = create_state_stack(100);
+        worker->tree = create_flat_tree(1024);
+#ifndef LR_NO_STATS
+        if (lr_stats) worker->stats = create_stats(lr_stats->num_states, lr_stats->num_rules);
+#endif
+        worker->deque.tasks = (int*)malloc(max_tasks * sizeof(int));
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        pthread_create(&worker->thread, NULL, worker_main, worker);
+    }
+
+    long count = 0;
+    long rejected = 0;
+    char* record;
+    size_t len;
+    int more = 1;
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (more) {
+        // Copy the next block of records out of the reader
+        int n = 0;
+        size_t used = 0;
+        while (n < BLOCK_RECORDS && (more = read_record(&reader, delim, &record, &len))) {
+            if (delim == '\n' && len > 0 && record[len - 1] == '\r') len--;
+            if (used + len > data_cap) {
+                while (used + len > data_cap) data_cap *= 2;
+                pool.data = (char*)realloc(pool.data, data_cap);
+            }
+            memcpy(pool.data + used, record, len);
+            pool.offsets[n] = used;
+            pool.lengths[n] = len;
+            used += len;
+            n++;
+        }
+        if (n == 0) break;
+
+        // Split into tasks; each worker starts with a contiguous share
+        pool.base_index = count;
+        pool.num_tasks = (n + TASK_RECORDS - 1) / TASK_RECORDS;
+        for (int t = 0; t < pool.num_tasks; t++) {
+            pool.tasks[t].first = t * TASK_RECORDS;
+            pool.tasks[t].count = (t == pool.num_tasks - 1) ? n - t * TASK_RECORDS : TASK_RECORDS;
+        }
+
+        // Publish the block under the pool lock: 'remaining' is set before
+        // any of its tasks can be taken and finished
+        pthread_mutex_lock(&pool.lock);
+        pool.remaining = pool.num_tasks;
+        pool.generation++;
+        for (int w = 0; w < num_threads; w++) {
+            TaskDeque* deque = &pool.workers[w].deque;
+            int lo = (int)((long)pool.num_tasks * w / num_threads);
+            int hi = (int)((long)pool.num_tasks * (w + 1) / num_threads);
+            pthread_mutex_lock(&deque->lock);
+            deque->head = 0;
+            deque->tail = 0;
+            deque->generation = pool.generation;
+            // Stored in reverse so the owner pops its tasks in input order
+            for (int t = hi - 1; t >= lo; t--) {
+                deque->tasks[deque->tail++] = t;
+            }
+            pthread_mutex_unlock(&deque->lock);
+        }
+
+        // Wait until every task is done
+        pthread_cond_broadcast(&pool.work_ready);
+        while (pool.remaining > 0) {
+            pthread_cond_wait(&pool.work_done, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        // Emit results in input order
+        for (int t = 0; t < pool.num_tasks; t++) {
+            fwrite(pool.tasks[t].out.data, 1, pool.tasks[t].out.len, stdout);
+            rejected += pool.tasks[t].rejected;
+        }
+        count += n;
+    }
+    fflush(stdout);
+
+    report_throughput(count, rejected, &t0);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.shutdown = 1;
+    pthread_cond_broadcast(&pool.work_ready);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int w = 0; w < num_threads; w++) {
+        Worker* worker = &pool.workers[w];
+        pthread_join(worker->thread, NULL);
+#ifndef LR_NO_STATS
+        if (worker->stats) {
+            merge_stats(lr_stats, worker->stats);
+            free_stats(worker->stats);
+        }
+#endif
+        pthread_mutex_destroy(&worker->deque.lock);
+        free(worker->deque.tasks);
+        free(worker->errors.items);
+        free_flat_tree(worker->tree);
+        free_state_stack(worker->states);
+        free_stack(worker->stack);
+    }
+    for (int t = 0; t < max_tasks; t++) {
+        free(pool.tasks[t].out.data);
+    }
+    pthread_cond_destroy(&pool.work_done);
+    pthread_cond_destroy(&pool.work_ready);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.tasks);
+    free(pool.lengths);
+    free(pool.offsets);
+    free(pool.data);
+    free(pool.workers);
+    free(reader.buf);
+    return rejected;
+}
@@ -0,0 +1,462 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "structs.h"
+
+// Benchmark driver: times each stage of the pipeline on scaled inputs and
+// prints one JSON object per measurement (JSON lines) on stdout.
+//
+// Allocations are counted by wrapping malloc/calloc/realloc at link time
+// (-Wl,--wrap=...), so only calls made by the parser objects are counted.
+
+// Function prototypes from other modules
+int load_grammar_table(const char* filename, Grammar* grammar, Table* table);
+int compress_table(Table* table);
+void free_table(Table* table);
+void free_grammar(Grammar* grammar);
+int parse_input(Grammar* grammar, Table* table, const char* input, int input_len,
+                int trace, Stack* stack, NodeArena* arena, ParseResult* result);
+
+Node* create_node(int symbol);
+void add_child(Node* parent, Node* child);
+void print_tree(Node* root, const Grammar* grammar);
+void free_tree(Node* node);
+
+NodeArena* create_arena(size_t slab_size);
+void reset_arena(NodeArena* arena);
+void free_arena(NodeArena* arena);
+
+int recognize(Grammar* grammar, Table* table, const char* input, int input_len,
+              StateStack* stack, int* error_pos);
+int parse_flat(Grammar* grammar, Table* table, const char* input, int input_len,
+               Stack* stack, FlatTree* tree, int* error_pos);
+FlatTree* create_flat_tree(int capacity);
+void free_flat_tree(FlatTree* tree);
+int parse_actions(Grammar* grammar, Table* table, const char* input, int input_len,
+                  ValueStack* stack, SemanticActions* actions, SemValue* value, int* error_pos);
+ValueStack* create_value_stack(int initial_capacity);
+void free_value_stack(ValueStack* stack);
+
+Stack* create_stack(int initial_capacity);
+void free_stack(Stack* stack);
+StateStack* create_state_stack(int initial_capacity);
+void free_state_stack(StateStack* stack);
+
+ParserStats* create_stats(int num_states, int num_rules);
+void free_stats(ParserStats* stats);
+
+int generate_table(Grammar* grammar, Table* table, int report);
+void prepare_table(Grammar* grammar, Table* table);
+GlrParser* create_glr(Grammar* grammar, Table* table);
+void free_glr(GlrParser* glr);
+int parse_glr(GlrParser* glr, const char* input, int input_len, NodeArena* arena, GlrResult* result);
+
+// Direct-coded parsers generated by lr_parser -C (see the Makefile)
+int test3_gen_recognize(Grammar* grammar, const char* input, int input_len,
+                        StateStack* stack, int* error_pos);
+int test3_gen_parse(Grammar* grammar, const char* input, int input_len,
+                    Stack* stack, NodeArena* arena, ParseResult* result);
+int test6_gen_recognize(Grammar* grammar, const char* input, int input_len,
+                        StateStack* stack, int* error_pos);
+int test6_gen_parse(Grammar* grammar, const char* input, int input_len,
+                    Stack* stack, NodeArena* arena, ParseResult* result);
+
+typedef struct {
+    const char* grammar;
+    int (*recognize)(Grammar*, const char*, int, StateStack*, int*);
+    int (*parse)(Grammar*, const char*, int, Stack*, NodeArena*, ParseResult*);
+} GenParser;
+
+static const GenParser gen_parsers[] = {
+    { "test3", test3_gen_recognize, test3_gen_parse },
+    { "test6", test6_gen_recognize, test6_gen_parse },
+};
+
+// Allocation counters (link-time wrappers)
+static long alloc_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    alloc_count++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+#define TOKENS_PER_STAGE 2000000L   // Work per measurement, divided over repetitions
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Emit one measurement as a JSON line
+static void report(const char* stage, const char* grammar, const char* layout,
+                   long tokens, long reps, double elapsed_ns, long allocs) {
+    double units = tokens > 0 ? (double)tokens * reps : (double)reps;
+    printf("{\"stage\":\"%s\",\"grammar\":\"%s\",\"layout\":\"%s\",\"tokens\":%ld,"
+           "\"reps\":%ld,\"%s\":%.2f,\"allocs_per_%s\":%.4f,\"peak_rss_kb\":%ld}\n",
+           stage, grammar, layout, tokens, reps,
+           tokens > 0 ? "ns_per_token" : "ns_per_op", elapsed_ns / units,
+           tokens > 0 ? "token" : "op", allocs / units, peak_rss_kb());
+    fflush(stdout);
+}
+
+// Build a scaled input of about 'n' units for the given sample grammar
+static char* make_input(const char* grammar, int n, int* len) {
+    char* s = (char*)malloc(24 * (size_t)n + 2);
+    int k = 0;
+    if (strcmp(grammar, "test6") == 0) {
+        // Lexer grammar: identifiers and numbers separated by spaced operators
+        for (int i = 0; i < n; i++) {
+            if (i > 0) k += sprintf(s + k, (i % 2) ? "  +  " : " * ");
+            k += sprintf(s + k, (i % 3) ? "value_%d" : "%d", i);
+        }
+    } else if (strcmp(grammar, "test") == 0) {
+        // a^n b^n
+        for (int i = 0; i < n; i++) s[k++] = 'a';
+        for (int i = 0; i < n; i++) s[k++] = 'b';
+    } else if (strcmp(grammar, "test2") == 0) {
+        // n nested parentheses
+        for (int i = 0; i < n; i++) s[k++] = '(';
+        for (int i = 0; i < n; i++) s[k++] = ')';
+    } else if (strcmp(grammar, "test3") == 0 || strcmp(grammar, "test5") == 0) {
+        // a+a*a+a*... with n operands
+        for (int i = 0; i < n; i++) {
+            if (i > 0) s[k++] = (i % 2) ? '+' : '*';
+            s[k++] = 'a';
+        }
+    } else {
+        // c followed by alternating bc / ac
+        s[k++] = 'c';
+        for (int i = 1; i < n; i++) {
+            s[k++] = (i % 2) ? 'b' : 'a';
+            s[k++] = 'c';
+        }
+    }
+    s[k] = '\0';
+    *len = k;
+    return s;
+}
+
+// Semantic actions for the bench: each value counts the nodes below it
+static SemValue count_shift(int symbol, const char* text, int length, void* user) {
+    (void)symbol;
+    (void)text;
+    (void)length;
+    (void)user;
+    SemValue value = { 1 };
+    return value;
+}
+
+static SemValue count_reduce(int rule, SemValue* values, int count, void* user) {
+    (void)rule;
+    (void)user;
+    SemValue value = { 1 };
+    for (int i = 0; i < count; i++) value.num += values[i].num;
+    return value;
+}
+
+// Copy an arena tree onto the heap so free_tree can be measured
+static Node* heap_copy(Node* node) {
+    Node* copy = create_node(node->symbol);
+    for (int i = 0; i < node->num_children; i++) {
+        add_child(copy, heap_copy(node->children[i]));
+    }
+    return copy;
+}
+
+static void bench_load(const char* grammar_file) {
+    Grammar grammar;
+    Table table;
+    long reps = 2000;
+
+    long allocs = alloc_count;
+    double t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        load_grammar_table(grammar_file, &grammar, &table);
+        free_grammar(&grammar);
+        free_table(&table);
+    }
+    report("load", grammar_file, "dense", 0, reps, now_ns() - t0, alloc_count - allocs);
+}
+
+// Time every per-input stage on one prepared input
+static void bench_stages(Grammar* grammar, Table* table, const char* name, const char* layout,
+                         const char* input, int len, Stack* stack, NodeArena* arena) {
+    long reps = TOKENS_PER_STAGE / len > 0 ? TOKENS_PER_STAGE / len : 1;
+    ParseResult result;
+
+    // Parse with tree construction
+    long allocs = alloc_count;
+    double t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        parse_input(grammar, table, input, len, 0, stack, arena, &result);
+        reset_arena(arena);
+    }
+    report("parse_tree", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+
+    // Parse without building a tree
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        parse_input(grammar, table, input, len, 0, stack, NULL, &result);
+    }
+    report("parse_notree", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+
+    // Recognize-only: state stack, no nodes
+    StateStack* states = create_state_stack(100);
+    int error_pos;
+    recognize(grammar, table, input, len, states, &error_pos);
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        recognize(grammar, table, input, len, states, &error_pos);
+    }
+    report("recognize", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+
+#ifndef LR_NO_STATS
+    // Same with the engine counters on, to show their cost
+    lr_stats = create_stats(table->num_states, grammar->num_rules);
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        recognize(grammar, table, input, len, states, &error_pos);
+    }
+    report("recognize_stats", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+    free_stats(lr_stats);
+    lr_stats = NULL;
+#endif
+    free_state_stack(states);
+
+    // Parse into the flat post-order tree (buffer reused across runs)
+    FlatTree* flat = create_flat_tree(1024);
+    parse_flat(grammar, table, input, len, stack, flat, &error_pos);
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        parse_flat(grammar, table, input, len, stack, flat, &error_pos);
+    }
+    report("parse_flat", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+    free_flat_tree(flat);
+
+    // Semantic actions on the value stack instead of a tree
+    ValueStack* values = create_value_stack(100);
+    SemanticActions actions = { count_shift, count_reduce, NULL };
+    SemValue value;
+    parse_actions(grammar, table, input, len, values, &actions, &value, &error_pos);
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        parse_actions(grammar, table, input, len, values, &actions, &value, &error_pos);
+    }
+    report("parse_actions", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+    free_value_stack(values);
+
+    // GLR on the same deterministic table: one stack top, forest instead of a tree
+    GlrParser* glr = create_glr(grammar, table);
+    GlrResult forest;
+    parse_glr(glr, input, len, arena, &forest);
+    reset_arena(arena);
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        parse_glr(glr, input, len, arena, &forest);
+        reset_arena(arena);
+    }
+    report("glr", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+    free_glr(glr);
+
+    // Print the tree (stdout redirected to /dev/null)
+    parse_input(grammar, table, input, len, 0, stack, arena, &result);
+    long print_reps = reps > 20 ? 20 : reps;
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    dup2(devnull, STDOUT_FILENO);
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < print_reps; r++) {
+        print_tree(result.tree, grammar);
+    }
+    fflush(stdout);
+    double elapsed = now_ns() - t0;
+    long print_allocs = alloc_count - allocs;
+    dup2(saved, STDOUT_FILENO);
+    close(devnull);
+    close(saved);
+    report("print_tree", name, layout, len, print_reps, elapsed, print_allocs);
+
+    // Release: per-node free of a heap copy versus one arena reset
+    long free_reps = reps > 20 ? 20 : reps;
+    elapsed = 0;
+    allocs = 0;
+    for (long r = 0; r < free_reps; r++) {
+        Node* copy = heap_copy(result.tree);
+        long before = alloc_count;
+        t0 = now_ns();
+        free_tree(copy);
+        elapsed += now_ns() - t0;
+        allocs += alloc_count - before;
+    }
+    report("free_tree", name, layout, len, free_reps, elapsed, allocs);
+
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        reset_arena(arena);
+    }
+    report("arena_reset", name, layout, len, reps, now_ns() - t0, alloc_count - allocs);
+}
+
+// Time the generated parser of a grammar against the interpreter stages
+// above (same input, same stack and arena)
+static void bench_generated(Grammar* grammar, const char* name, const char* input, int len,
+                            Stack* stack, NodeArena* arena) {
+    const GenParser* gen = NULL;
+    for (size_t i = 0; i < sizeof(gen_parsers) / sizeof(gen_parsers[0]); i++) {
+        if (strcmp(gen_parsers[i].grammar, name) == 0) gen = &gen_parsers[i];
+    }
+    if (!gen) return;
+
+    long reps = TOKENS_PER_STAGE / len > 0 ? TOKENS_PER_STAGE / len : 1;
+    ParseResult result;
+    reset_arena(arena);
+    if (gen->parse(grammar, input, len, stack, arena, &result) != 1) {
+        fprintf(stderr, "bench: generated %s parser rejected its input\n", name);
+        return;
+    }
+
+    long allocs = alloc_count;
+    double t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        reset_arena(arena);
+        gen->parse(grammar, input, len, stack, arena, &result);
+    }
+    report("gen_parse_tree", name, "generated", len, reps, now_ns() - t0, alloc_count - allocs);
+
+    StateStack* states = create_state_stack(100);
+    int error_pos;
+    gen->recognize(grammar, input, len, states, &error_pos);
+    allocs = alloc_count;
+    t0 = now_ns();
+    for (long r = 0; r < reps; r++) {
+        gen->recognize(grammar, input, len, states, &error_pos);
+    }
+    report("gen_recognize", name, "generated", len, reps, now_ns() - t0, alloc_count - allocs);
+    free_state_stack(states);
+    reset_arena(arena);
+}
+
+static void bench_parse(const char* grammar_file, int compressed, int n) {
+    Grammar grammar;
+    Table table;
+    if (!load_grammar_table(grammar_file, &grammar, &table)) return;
+    if (compressed) compress_table(&table);
+
+    int len;
+    char* input = make_input(grammar_file, n, &len);
+    Stack* stack = create_stack(100);
+    NodeArena* arena = create_arena(64 * 1024);
+    ParseResult result;
+
+    // Warm-up run grows the stack and arena to their steady-state size
+    if (parse_input(&grammar, &table, input, len, 0, stack, arena, &result) == 1) {
+        reset_arena(arena);
+        bench_stages(&grammar, &table, grammar_file, compressed ? "compressed" : "dense",
+                     input, len, stack, arena);
+        if (!compressed) bench_generated(&grammar, grammar_file, input, len, stack, arena);
+    } else {
+        fprintf(stderr, "bench: %s rejected its generated input\n", grammar_file);
+    }
+
+    free_arena(arena);
+    free_stack(stack);
+    free(input);
+    free_grammar(&grammar);
+    free_table(&table);
+}
+
+// GLR on an ambiguous grammar: the table generated from test3's rules keeps
+// its shift/reduce conflicts, so every bracketing of a+a*a+... is explored
+// (the forest grows as n^3, the work as n^4 with 3-symbol rules)
+static void bench_ambiguous(const char* grammar_file) {
+    Grammar grammar;
+    Table table;
+    if (!load_grammar_table(grammar_file, &grammar, &table)) return;
+    free_table(&table);
+    if (generate_table(&grammar, &table, 0) < 0) {
+        free_grammar(&grammar);
+        return;
+    }
+    prepare_table(&grammar, &table);
+
+    int sizes[] = { 16, 32, 64 };
+    GlrParser* glr = create_glr(&grammar, &table);
+    NodeArena* arena = create_arena(64 * 1024);
+    GlrResult forest;
+    for (int s = 0; s < 3; s++) {
+        int len;
+        char* input = make_input(grammar_file, sizes[s], &len);
+        long reps = 20000 / len > 0 ? 20000 / len : 1;
+        parse_glr(glr, input, len, arena, &forest);
+        reset_arena(arena);
+        long allocs = alloc_count;
+        double t0 = now_ns();
+        for (long r = 0; r < reps; r++) {
+            parse_glr(glr, input, len, arena, &forest);
+            reset_arena(arena);
+        }
+        report("glr_ambiguous", grammar_file, "generated", len, reps, now_ns() - t0,
+               alloc_count - allocs);
+        free(input);
+    }
+    free_arena(arena);
+    free_glr(glr);
+    free_grammar(&grammar);
+    free_table(&table);
+}
+
+int main(int argc, char* argv[]) {
+    const char* grammars[] = { "test", "test2", "test3", "test4", "test5", "test6" };
+    int sizes[] = { 1000, 10000, 100000 };
+    int num_grammars = 6;
+
+    // Optional: restrict to the grammars named on the command line
+    if (argc > 1) {
+        num_grammars = 0;
+        for (int i = 1; i < argc && i <= 6; i++) {
+            grammars[num_grammars++] = argv[i];
+        }
+    }
+
+    for (int g = 0; g < num_grammars; g++) {
+        bench_load(grammars[g]);
+        for (int s = 0; s < 3; s++) {
+            bench_parse(grammars[g], 0, sizes[s]);
+            bench_parse(grammars[g], 1, sizes[s]);
+        }
+        if (strcmp(grammars[g], "test3") == 0) bench_ambiguous(grammars[g]);
+    }
+    return 0;
+}
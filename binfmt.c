@@ -0,0 +1,366 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "structs.h"
+
+// Function prototypes from other modules
+int outbuf_write(OutBuf* out, const char* data, size_t len);
+void set_symbol_names(Grammar* grammar, char* pool, int count);
+
+// Precompiled grammar/table file:
+//   BinHeader | rules | right-hand sides | names | table arrays
+// Every section starts on an 8-byte boundary and is used in place
+// after mmap (only the Rule array is rebuilt, from the BinRule entries).
+// The checksum covers everything after the header; it is only checked
+// with bin_verify set (-V), since hashing reads every page of the file.
+// Without it, every section and table entry is still bounds-checked, so a
+// damaged file is rejected instead of read out of bounds.
+#define BIN_MAGIC "LRTABLE"
+#define BIN_VERSION 3
+
+int bin_verify = 0;     // Check the checksum on load
+
+#define LAYOUT_DENSE 0
+#define LAYOUT_COMPRESSED 1
+
+// Rule as stored: its right-hand side is an offset in the symbols section
+typedef struct {
+    uint32_t lhs;
+    uint32_t rhs_len;
+    uint64_t rhs_start;
+} BinRule;
+
+typedef struct {
+    char magic[8];          // BIN_MAGIC, NUL-terminated
+    uint32_t version;       // BIN_VERSION
+    uint32_t header_size;   // sizeof(BinHeader), guards against layout drift
+    uint32_t rule_size;     // sizeof(BinRule)
+    uint32_t layout;        // LAYOUT_DENSE or LAYOUT_COMPRESSED
+    uint64_t file_size;     // Total file size in bytes
+    uint64_t checksum;      // Checksum of bytes [header_size, file_size)
+
+    int32_t axiom;
+    int32_t num_rules;
+    int32_t num_states;
+    int32_t num_classes;
+    int32_t packed_len;
+    int32_t num_symbols;    // Table columns; the names cover those after Z
+    uint64_t rhs_total;     // Symbols in the symbols section
+    uint64_t names_len;     // Bytes in the names section
+
+    // Section offsets from the start of the file (0 = absent)
+    uint64_t rules_off;
+    uint64_t symbols_off;
+    uint64_t names_off;
+    uint64_t data_off;
+    uint64_t classes_off;
+    uint64_t base_off;
+    uint64_t deflt_off;
+    uint64_t next_off;
+    uint64_t check_off;
+
+    uint64_t sync[TERMSET_WORDS];   // %sync terminal set
+} BinHeader;
+
+// 64-bit FNV-1a over 8-byte words (sections are padded to 8 bytes)
+static uint64_t checksum(const unsigned char* data, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Append a section to the image at the next 8-byte boundary
+static uint64_t put_section(OutBuf* image, const void* data, size_t len) {
+    static const char zeros[8] = {0};
+    if (image->len % 8) {
+        outbuf_write(image, zeros, 8 - image->len % 8);
+    }
+    uint64_t offset = image->len;
+    if (len > 0) {
+        outbuf_write(image, (const char*)data, len);
+    }
+    return offset;
+}
+
+// Write the loaded grammar and table (either layout) to a binary file
+int save_binary(const char* filename, Grammar* grammar, Table* table) {
+    if (grammar->lexer) {
+        fprintf(stderr, "Error: Binary tables do not store the lexer; load the grammar file instead\n");
+        return 0;
+    }
+    if (table->conflicts && table->conflicts->count > 0) {
+        fprintf(stderr, "Warning: Binary tables do not store the %d other actions of conflict cells\n",
+                table->conflicts->count);
+    }
+    BinHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BIN_MAGIC, sizeof(BIN_MAGIC));
+    header.version = BIN_VERSION;
+    header.header_size = sizeof(BinHeader);
+    header.rule_size = sizeof(BinRule);
+    header.axiom = grammar->axiom;
+    header.num_rules = grammar->num_rules;
+    header.num_states = table->num_states;
+    header.num_symbols = grammar->num_symbols;
+    memcpy(header.sync, grammar->sync, sizeof(header.sync));
+
+    OutBuf image = { NULL, 0, 0 };
+    outbuf_write(&image, (const char*)&header, sizeof(header));
+
+    // Rules, then all right-hand sides one after the other
+    BinRule* rules = (BinRule*)malloc((grammar->num_rules + 1) * sizeof(BinRule));
+    for (int r = 0; r < grammar->num_rules; r++) {
+        rules[r].lhs = grammar->rules[r].lhs;
+        rules[r].rhs_len = grammar->rules[r].rhs_len;
+        rules[r].rhs_start = header.rhs_total;
+        header.rhs_total += grammar->rules[r].rhs_len;
+    }
+    header.rules_off = put_section(&image, rules, grammar->num_rules * sizeof(BinRule));
+    free(rules);
+    header.symbols_off = put_section(&image, NULL, 0);
+    for (int r = 0; r < grammar->num_rules; r++) {
+        outbuf_write(&image, (const char*)grammar->rules[r].rhs,
+                     grammar->rules[r].rhs_len * sizeof(Symbol));
+    }
+
+    // Names after Z, NUL-terminated
+    header.names_off = put_section(&image, NULL, 0);
+    for (int s = NT_BASE + NT_LETTERS; s < grammar->num_symbols; s++) {
+        outbuf_write(&image, grammar->names[s], strlen(grammar->names[s]) + 1);
+    }
+    header.names_len = image.len - header.names_off;
+
+    if (table->data) {
+        header.layout = LAYOUT_DENSE;
+        header.data_off = put_section(&image, table->data,
+                                      (size_t)table->num_states * table->num_cols * sizeof(int));
+    } else {
+        header.layout = LAYOUT_COMPRESSED;
+        header.num_classes = table->num_classes;
+        header.packed_len = table->packed_len;
+        header.classes_off = put_section(&image, table->classes, table->num_cols * sizeof(int));
+        header.base_off = put_section(&image, table->base, table->num_states * sizeof(int));
+        header.deflt_off = put_section(&image, table->deflt, table->num_states * sizeof(int));
+        header.next_off = put_section(&image, table->next, table->packed_len * sizeof(int));
+        header.check_off = put_section(&image, table->check, table->packed_len * sizeof(int));
+    }
+    put_section(&image, NULL, 0);  // Pad the file to a multiple of 8
+
+    header.file_size = image.len;
+    header.checksum = checksum((unsigned char*)image.data + sizeof(header), image.len - sizeof(header));
+    memcpy(image.data, &header, sizeof(header));
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        free(image.data);
+        return 0;
+    }
+    int ok = fwrite(image.data, 1, image.len, fp) == image.len;
+    ok = (fclose(fp) == 0) && ok;
+    free(image.data);
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write %s\n", filename);
+    }
+    return ok;
+}
+
+// Check whether a file starts with the binary table magic
+int is_binary_table(const char* filename) {
+    char magic[8] = {0};
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    size_t got = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return got == sizeof(magic) && memcmp(magic, BIN_MAGIC, sizeof(BIN_MAGIC)) == 0;
+}
+
+// Check that a section lies inside the mapping
+static int section_ok(const BinHeader* header, uint64_t offset, uint64_t len) {
+    return offset % 8 == 0 && offset >= header->header_size &&
+           offset <= header->file_size && len <= header->file_size - offset;
+}
+
+// Check the grammar sections: rules inside the symbols section, symbols
+// inside the symbol table, and one NUL-terminated name per symbol after Z
+static int grammar_ok(const BinHeader* header, const unsigned char* base) {
+    const BinRule* rules = (const BinRule*)(base + header->rules_off);
+    for (int r = 0; r < header->num_rules; r++) {
+        if (rules[r].lhs < NT_BASE || rules[r].lhs >= (uint32_t)header->num_symbols ||
+            rules[r].rhs_len > MAX_RHS || rules[r].rhs_start > header->rhs_total ||
+            rules[r].rhs_len > header->rhs_total - rules[r].rhs_start) {
+            return 0;
+        }
+    }
+    const Symbol* symbols = (const Symbol*)(base + header->symbols_off);
+    for (uint64_t i = 0; i < header->rhs_total; i++) {
+        if (symbols[i] >= header->num_symbols) return 0;
+    }
+    const char* names = (const char*)(base + header->names_off);
+    int count = 0;
+    for (uint64_t i = 0; i < header->names_len; i++) {
+        if (names[i] == '\0') count++;
+    }
+    return count == header->num_symbols - (NT_BASE + NT_LETTERS) &&
+           (header->names_len == 0 || names[header->names_len - 1] == '\0');
+}
+
+// Whether a table cell holds an action the engines can follow: error,
+// accept, a state or a rule of the file
+static int action_ok(const BinHeader* header, int action) {
+    if (action > 0) return action < header->num_states;
+    return action == ACTION_ERROR || action == ACTION_ACCEPT || action >= -header->num_rules;
+}
+
+// Check the table entries once each: valid actions, classes below
+// num_classes and row displacements that keep every base + class lookup
+// inside next/check
+static int table_ok(const BinHeader* header, const unsigned char* base) {
+    if (header->layout == LAYOUT_DENSE) {
+        const int* data = (const int*)(base + header->data_off);
+        uint64_t cells = (uint64_t)header->num_states * header->num_symbols;
+        for (uint64_t i = 0; i < cells; i++) {
+            if (!action_ok(header, data[i])) return 0;
+        }
+        return 1;
+    }
+    const int* classes = (const int*)(base + header->classes_off);
+    for (int c = 0; c < header->num_symbols; c++) {
+        if (classes[c] < 0 || classes[c] >= header->num_classes) return 0;
+    }
+    const int* rows = (const int*)(base + header->base_off);
+    const int* deflt = (const int*)(base + header->deflt_off);
+    for (int s = 0; s < header->num_states; s++) {
+        if (rows[s] < 0 || rows[s] > header->packed_len - header->num_classes ||
+            !action_ok(header, deflt[s])) {
+            return 0;
+        }
+    }
+    const int* next = (const int*)(base + header->next_off);
+    for (int i = 0; i < header->packed_len; i++) {
+        if (!action_ok(header, next[i])) return 0;
+    }
+    return 1;
+}
+
+// Map a binary table file and point the grammar and table into it.
+// Nothing is copied but the rule array; the pages are shared by every
+// process mapping the file.
+int load_binary(const char* filename, Grammar* grammar, Table* table) {
+    memset(table, 0, sizeof(Table));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinHeader)) {
+        fprintf(stderr, "Error: %s is not a binary table\n", filename);
+        close(fd);
+        return 0;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map file %s\n", filename);
+        return 0;
+    }
+
+    const unsigned char* base = (const unsigned char*)map;
+    const BinHeader* header = (const BinHeader*)map;
+    const char* problem = NULL;
+
+    if (memcmp(header->magic, BIN_MAGIC, sizeof(BIN_MAGIC)) != 0) {
+        problem = "bad magic";
+    } else if (header->version != BIN_VERSION) {
+        problem = "unsupported version";
+    } else if (header->header_size != sizeof(BinHeader) || header->rule_size != sizeof(BinRule)) {
+        problem = "incompatible build";
+    } else if (header->file_size != size) {
+        problem = "truncated file";
+    } else if (bin_verify &&
+               header->checksum != checksum(base + sizeof(BinHeader), size - sizeof(BinHeader))) {
+        problem = "checksum mismatch";
+    } else if (header->num_rules < 0 || header->num_states < 0 ||
+               header->num_symbols < NT_BASE + NT_LETTERS || header->num_symbols > MAX_SYMBOLS ||
+               header->axiom < NT_BASE || header->axiom >= header->num_symbols ||
+               header->rhs_total > size / sizeof(Symbol) ||
+               !section_ok(header, header->rules_off, (uint64_t)header->num_rules * sizeof(BinRule)) ||
+               !section_ok(header, header->symbols_off, header->rhs_total * sizeof(Symbol)) ||
+               !section_ok(header, header->names_off, header->names_len) ||
+               !grammar_ok(header, base)) {
+        problem = "bad rules section";
+    } else if (header->num_states == 0) {
+        problem = "bad table section";
+    } else if (header->layout == LAYOUT_DENSE) {
+        if (!section_ok(header, header->data_off,
+                        (uint64_t)header->num_states * header->num_symbols * sizeof(int))) {
+            problem = "bad table section";
+        }
+    } else if (header->layout == LAYOUT_COMPRESSED) {
+        if (header->num_classes <= 0 || header->packed_len < 0 ||
+            !section_ok(header, header->classes_off, (uint64_t)header->num_symbols * sizeof(int)) ||
+            !section_ok(header, header->base_off, (uint64_t)header->num_states * sizeof(int)) ||
+            !section_ok(header, header->deflt_off, (uint64_t)header->num_states * sizeof(int)) ||
+            !section_ok(header, header->next_off, (uint64_t)header->packed_len * sizeof(int)) ||
+            !section_ok(header, header->check_off, (uint64_t)header->packed_len * sizeof(int))) {
+            problem = "bad table section";
+        }
+    } else {
+        problem = "unknown table layout";
+    }
+    if (!problem && !table_ok(header, base)) {
+        problem = "bad table entry";
+    }
+
+    if (problem) {
+        fprintf(stderr, "Error: %s: %s\n", filename, problem);
+        munmap(map, size);
+        return 0;
+    }
+
+    memset(grammar, 0, sizeof(Grammar));
+    grammar->axiom = (Symbol)header->axiom;
+    grammar->num_rules = header->num_rules;
+    grammar->rules = (Rule*)malloc((header->num_rules + 1) * sizeof(Rule));
+    const BinRule* rules = (const BinRule*)(base + header->rules_off);
+    Symbol* symbols = (Symbol*)(base + header->symbols_off);
+    for (int r = 0; r < header->num_rules; r++) {
+        grammar->rules[r].lhs = (Symbol)rules[r].lhs;
+        grammar->rules[r].rhs_len = (int)rules[r].rhs_len;
+        grammar->rules[r].rhs = symbols + rules[r].rhs_start;
+    }
+    set_symbol_names(grammar, (char*)(base + header->names_off),
+                     header->num_symbols - (NT_BASE + NT_LETTERS));
+    memcpy(grammar->sync, header->sync, sizeof(grammar->sync));
+
+    table->num_states = header->num_states;
+    table->num_cols = header->num_symbols;
+    if (header->layout == LAYOUT_DENSE) {
+        table->data = (int*)(base + header->data_off);
+    } else {
+        table->classes = (int*)(base + header->classes_off);
+        table->num_classes = header->num_classes;
+        table->base = (int*)(base + header->base_off);
+        table->deflt = (int*)(base + header->deflt_off);
+        table->next = (int*)(base + header->next_off);
+        table->check = (int*)(base + header->check_off);
+        table->packed_len = header->packed_len;
+    }
+    table->mapping = map;
+    table->mapping_len = size;
+    return 1;
+}
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE     // realpath
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Client for the parse daemon (lr_parser -d): one request per input record,
+// answers printed in the batch format "<index>\t<answer>". Each request
+// waits for its answer, so the round-trip times on stderr are latencies.
+
+// Write all of data[0..len); returns 0 on a socket error
+static int send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Buffered reader for answer lines
+typedef struct {
+    int fd;
+    char* buf;
+    size_t cap;
+    size_t start;       // First unread byte
+    size_t end;         // One past the last buffered byte
+} LineReader;
+
+// Read the next answer line (with its newline); NULL if the daemon hung up.
+// The line stays valid until the next call.
+static char* read_answer(LineReader* reader, size_t* len) {
+    for (;;) {
+        char* line = reader->buf + reader->start;
+        char* newline = memchr(line, '\n', reader->end - reader->start);
+        if (newline) {
+            *len = newline + 1 - line;
+            reader->start += *len;
+            return line;
+        }
+        if (reader->start > 0) {
+            memmove(reader->buf, line, reader->end - reader->start);
+            reader->end -= reader->start;
+            reader->start = 0;
+        }
+        if (reader->end == reader->cap) {
+            reader->cap *= 2;
+            reader->buf = (char*)realloc(reader->buf, reader->cap);
+        }
+        ssize_t n = read(reader->fd, reader->buf + reader->end, reader->cap - reader->end);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return NULL;
+        reader->end += n;
+    }
+}
+
+static double elapsed_us(struct timespec* t0, struct timespec* t1) {
+    return (t1->tv_sec - t0->tv_sec) * 1e6 + (t1->tv_nsec - t0->tv_nsec) / 1e3;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <socket> <grammar_file> [input_file] [-t] [-f FORMAT] [-0]\n", argv[0]);
+        fprintf(stderr, "  -t : Include the parse tree in the answers\n");
+        fprintf(stderr, "  -f : Tree format: compact (default) or json (implies -t)\n");
+        fprintf(stderr, "  -0 : Inputs are NUL-delimited instead of newline-delimited\n");
+        fprintf(stderr, "Inputs are read one per line from input_file (default stdin)\n");
+        return 1;
+    }
+    const char* socket_path = argv[1];
+    const char* input_file = NULL;
+    const char* format = "-";
+    int delim = '\n';
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            if (strcmp(format, "-") == 0) format = "compact";
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            format = argv[++i];
+            if (strcmp(format, "compact") != 0 && strcmp(format, "json") != 0) {
+                fprintf(stderr, "Error: Unknown tree format %s\n", format);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-0") == 0) {
+            delim = '\0';
+        } else if (input_file == NULL) {
+            input_file = argv[i];
+        }
+    }
+
+    // The daemon may run in another directory
+    char grammar_path[PATH_MAX];
+    if (!realpath(argv[2], grammar_path)) {
+        fprintf(stderr, "Error: Cannot find grammar file %s\n", argv[2]);
+        return 1;
+    }
+    FILE* in = stdin;
+    if (input_file && strcmp(input_file, "-") != 0) {
+        in = fopen(input_file, "rb");
+        if (!in) {
+            fprintf(stderr, "Error: Cannot open file %s\n", input_file);
+            return 1;
+        }
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: Cannot connect to %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    LineReader reader = { fd, (char*)malloc(1 << 16), 1 << 16, 0, 0 };
+    char* record = NULL;
+    size_t record_cap = 0;
+    ssize_t len;
+    long count = 0;
+    long failed = 0;
+    double total_us = 0;
+    double max_us = 0;
+    while ((len = getdelim(&record, &record_cap, delim, in)) >= 0) {
+        if (len > 0 && record[len - 1] == delim) len--;
+        // Tolerate CRLF line endings
+        if (delim == '\n' && len > 0 && record[len - 1] == '\r') len--;
+
+        char header[PATH_MAX + 64];
+        int header_len = snprintf(header, sizeof(header), "%s %ld %s\n", format, (long)len,
+                                  grammar_path);
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        size_t answer_len;
+        char* answer = NULL;
+        if (send_all(fd, header, header_len) && send_all(fd, record, len)) {
+            answer = read_answer(&reader, &answer_len);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (!answer) {
+            fprintf(stderr, "Error: The daemon closed the connection\n");
+            failed++;
+            break;
+        }
+
+        double us = elapsed_us(&t0, &t1);
+        total_us += us;
+        if (us > max_us) max_us = us;
+        if (strncmp(answer, "ACCEPT", 6) != 0) failed++;
+        printf("%ld\t", count);
+        fwrite(answer, 1, answer_len, stdout);
+        count++;
+    }
+    fflush(stdout);
+    fprintf(stderr, "Client: %ld requests, %.1f us mean, %.1f us max round trip\n",
+            count, count ? total_us / count : 0.0, max_us);
+
+    free(record);
+    free(reader.buf);
+    close(fd);
+    if (in != stdin) fclose(in);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,408 @@
+#include <ctype.h>
+#include "structs.h"
+
+// Direct-coded parser generator (lr_parser -C out.c).
+//
+// The table is compiled into C: every state becomes a label with a switch
+// over its valid terminals, every rule a label that pops a constant number
+// of states and jumps to the GOTO switch of its left-hand side. Shifts and
+// GOTOs jump straight to the label of the target state, so no table is
+// read at run time. The output needs only structs.h and the tree/stack
+// objects; lexer grammars still take the loaded Grammar for its lexer.
+
+// Function prototypes from other modules
+void write_symbol(FILE* out, const Grammar* grammar, int symbol, int lhs);
+
+#define LABEL_ACCEPT 1
+#define LABEL_REJECT 2
+#define LABEL_FAIL 4
+#define LABEL_NOMEM 8
+
+// What the parser code refers to, so only reachable code and used labels
+// are written (the generated file compiles cleanly with -Wall -Wextra)
+typedef struct {
+    char* states;       // State reachable [states]
+    char* rules;        // Rule reduced in a reachable state [rules]
+    char* lhs;          // GOTO switch needed for this non-terminal [NT_INDEX]
+    int collapse;       // GOTOs follow unit chains (recognizer)
+    int labels;         // LABEL_* referenced so far
+} GenPlan;
+
+// GOTO target of (state, lhs) in the plan's mode, 0 if none
+static int goto_target(Table* table, GenPlan* plan, int state, int lhs) {
+    int target = plan->collapse ? unit_goto(table, state, lhs) : table_action(table, state, lhs);
+    return target > 0 && target < table->num_states ? target : 0;
+}
+
+// Mark the states reachable from state 0 and the rules they reduce by
+static void plan_reachable(Grammar* grammar, Table* table, GenPlan* plan) {
+    plan->states[0] = 1;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int s = 0; s < table->num_states; s++) {
+            if (!plan->states[s]) continue;
+            for (int c = 0; c < NT_BASE; c++) {
+                int action = table->default_reduce[s];
+                if (action == ACTION_ERROR) action = table_action(table, s, c);
+                if (action > 0 && action < table->num_states && !plan->states[action]) {
+                    plan->states[action] = 1;
+                    changed = 1;
+                } else if (action < 0 && action != ACTION_ACCEPT && -action - 1 < grammar->num_rules &&
+                           !plan->rules[-action - 1]) {
+                    plan->rules[-action - 1] = 1;
+                    plan->lhs[NT_INDEX(grammar->rules[-action - 1].lhs)] = 1;
+                    changed = 1;
+                }
+            }
+            for (int a = 0; a < table->num_cols - NT_BASE; a++) {
+                if (!plan->lhs[a]) continue;
+                int target = goto_target(table, plan, s, NT_BASE + a);
+                if (target && !plan->states[target]) {
+                    plan->states[target] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+// Write a terminal as a case label: a character literal when printable
+static void write_case(FILE* out, int c) {
+    if (isprint(c) && c != '\'' && c != '\\') fprintf(out, "    case '%c':", c);
+    else fprintf(out, "    case %d:", c);
+}
+
+// Write a rule for a comment, in the grammar file notation
+static void write_rule_comment(FILE* out, Grammar* grammar, Rule* rule) {
+    write_symbol(out, grammar, rule->lhs, 1);
+    fprintf(out, " ->");
+    for (int i = 0; i < rule->rhs_len; i++) {
+        int c = rule->rhs[i];
+        if (IS_NONTERMINAL(c)) {
+            fputc(' ', out);
+            write_symbol(out, grammar, c, 0);
+        } else if (isgraph(c) && c != '\\') {
+            fprintf(out, " %c", c);
+        } else {
+            fprintf(out, " <%d>", c);
+        }
+    }
+    if (rule->rhs_len == 0) fprintf(out, " (empty)");
+    fputc('\n', out);
+}
+
+// Write the action of a terminal case (or of a default reduction)
+static void write_action(FILE* out, Grammar* grammar, Table* table, GenPlan* plan, int action) {
+    if (action > 0 && action < table->num_states) {
+        fprintf(out, " GEN_SHIFT(%d);\n", action);
+        plan->labels |= LABEL_NOMEM;
+    } else if (action == ACTION_ACCEPT) {
+        fprintf(out, " goto accept;\n");
+        plan->labels |= LABEL_ACCEPT;
+    } else if (action < 0 && -action - 1 < grammar->num_rules) {
+        fprintf(out, " goto r%d;\n", -action);
+    } else {
+        fprintf(out, " goto fail;\n");
+        plan->labels |= LABEL_FAIL;
+    }
+}
+
+// Write the state, rule and GOTO labels of one parser function
+static void write_body(FILE* out, Grammar* grammar, Table* table, GenPlan* plan) {
+    for (int s = 0; s < table->num_states; s++) {
+        if (!plan->states[s]) continue;
+        // State 0 is only entered at the start (no action targets it)
+        if (s == 0) fprintf(out, "    // s0: entry\n");
+        else fprintf(out, "s%d:\n", s);
+        int only = table->default_reduce[s];
+        if (only != ACTION_ERROR) {
+            // Default reduction: the lookahead is not needed
+            fprintf(out, "   ");
+            write_action(out, grammar, table, plan, only);
+            continue;
+        }
+
+        // Terminals with the same action share one case group
+        fprintf(out, "    GEN_LOOK();\n    switch (symbol) {\n");
+        int actions[NT_BASE];
+        char done[NT_BASE] = {0};
+        for (int c = 0; c < NT_BASE; c++) actions[c] = table_action(table, s, c);
+        for (int c = 0; c < NT_BASE; c++) {
+            int action = actions[c];
+            if (action == ACTION_ERROR || done[c]) continue;
+            for (int d = c; d < NT_BASE; d++) {
+                if (!done[d] && actions[d] == action) {
+                    if (d != c) fputc('\n', out);
+                    write_case(out, d);
+                    done[d] = 1;
+                }
+            }
+            write_action(out, grammar, table, plan, action);
+        }
+        fprintf(out, "    }\n    goto reject;\n");
+        plan->labels |= LABEL_REJECT;
+    }
+
+    for (int r = 0; r < grammar->num_rules; r++) {
+        if (!plan->rules[r]) continue;
+        Rule* rule = &grammar->rules[r];
+        fprintf(out, "r%d: // ", r + 1);
+        write_rule_comment(out, grammar, rule);
+        fprintf(out, "    GEN_REDUCE(%d, %d);\n", rule->rhs_len, rule->lhs);
+        if (!plan->collapse) plan->labels |= LABEL_NOMEM;
+        fprintf(out, "    goto g%d;\n", rule->lhs);
+    }
+
+    for (int a = 0; a < table->num_cols - NT_BASE; a++) {
+        if (!plan->lhs[a]) continue;
+        fprintf(out, "g%d: // GOTO on ", NT_BASE + a);
+        write_symbol(out, grammar, NT_BASE + a, 1);
+        fprintf(out, "\n    switch (GEN_TOP_STATE) {\n");
+        for (int s = 0; s < table->num_states; s++) {
+            if (!plan->states[s]) continue;
+            int target = goto_target(table, plan, s, NT_BASE + a);
+            if (!target) continue;
+            fprintf(out, "    case %d: GEN_GOTO(%d);\n", s, target);
+            plan->labels |= LABEL_NOMEM;
+        }
+        fprintf(out, "    }\n    goto fail;\n");
+        plan->labels |= LABEL_FAIL;
+    }
+}
+
+// Write one parser function: the recognizer (collapse = 1) or the tree builder
+static void write_function(FILE* out, Grammar* grammar, Table* table, const char* prefix, int collapse) {
+    GenPlan plan;
+    memset(&plan, 0, sizeof(plan));
+    plan.states = (char*)calloc(table->num_states > 0 ? table->num_states : 1, 1);
+    plan.rules = (char*)calloc(grammar->num_rules > 0 ? grammar->num_rules : 1, 1);
+    plan.lhs = (char*)calloc(table->num_cols - NT_BASE, 1);
+    plan.collapse = collapse;
+    plan_reachable(grammar, table, &plan);
+
+    if (collapse) {
+        fprintf(out,
+            "// Recognize input[0..input_len): 1 = accept, 0 = reject (*error_pos set),\n"
+            "// -1 = malformed table, -2 = out of memory. Unit-rule chains are\n"
+            "// collapsed as in recognize().\n"
+            "int %s_recognize(Grammar* grammar, const char* input, int input_len,\n"
+            "                 StateStack* stack, int* error_pos) {\n"
+            "    int* states = stack->states;\n"
+            "    int top = 0;\n"
+            "    int pos = 0;\n"
+            "    int start = 0;\n"
+            "    int end = 0;\n"
+            "    int symbol = GEN_STALE;\n"
+            "    (void)grammar;\n"
+            "    states[0] = 0;\n"
+            "    *error_pos = -1;\n"
+            "\n"
+            "#define GEN_PUSH(n) do { \\\n"
+            "        if (top + 1 >= stack->capacity) { \\\n"
+            "            int* grown = (int*)realloc(states, 2 * stack->capacity * sizeof(int)); \\\n"
+            "            if (!grown) goto nomem; \\\n"
+            "            stack->capacity *= 2; \\\n"
+            "            stack->states = states = grown; \\\n"
+            "        } \\\n"
+            "        states[++top] = (n); \\\n"
+            "    } while (0)\n"
+            "#define GEN_SHIFT(n) do { GEN_PUSH(n); pos = end; symbol = GEN_STALE; goto s##n; } while (0)\n"
+            "#define GEN_REDUCE(len, lhs) (top -= (len))\n"
+            "#define GEN_GOTO(n) do { GEN_PUSH(n); goto s##n; } while (0)\n"
+            "#define GEN_TOP_STATE states[top]\n\n",
+            prefix);
+    } else {
+        fprintf(out,
+            "// Parse input[0..input_len) into a tree allocated in 'arena', with the\n"
+            "// same result and tree as parse_input(). Returns 1 = accept, 0 = reject,\n"
+            "// -1 = malformed table, -2 = out of memory.\n"
+            "int %s_parse(Grammar* grammar, const char* input, int input_len,\n"
+            "             Stack* stack, NodeArena* arena, ParseResult* result) {\n"
+            "    StackElement* elems = stack->elements;\n"
+            "    int top = 0;\n"
+            "    int pos = 0;\n"
+            "    int start = 0;\n"
+            "    int end = 0;\n"
+            "    int symbol = GEN_STALE;\n"
+            "    Node* node;\n"
+            "    (void)grammar;\n"
+            "    elems[0].state = 0;\n"
+            "    elems[0].node = NULL;\n"
+            "    result->accepted = 0;\n"
+            "    result->error_pos = -1;\n"
+            "    result->tree = NULL;\n"
+            "\n"
+            "#define GEN_PUSH(n, item) do { \\\n"
+            "        if (top + 1 >= stack->capacity) { \\\n"
+            "            stack->top = top; \\\n"
+            "            if (!push(stack, (n), (item))) goto nomem; \\\n"
+            "            elems = stack->elements; \\\n"
+            "            top = stack->top; \\\n"
+            "        } else { \\\n"
+            "            elems[++top].state = (n); \\\n"
+            "            elems[top].node = (item); \\\n"
+            "        } \\\n"
+            "    } while (0)\n"
+            "#define GEN_SHIFT(n) do { \\\n"
+            "        node = arena_node(arena, symbol); \\\n"
+            "        if (!node) goto nomem; \\\n"
+            "        node->offset = start; \\\n"
+            "        node->length = end - start; \\\n"
+            "        GEN_PUSH(n, node); \\\n"
+            "        pos = end; \\\n"
+            "        symbol = GEN_STALE; \\\n"
+            "        goto s##n; \\\n"
+            "    } while (0)\n"
+            "#define GEN_REDUCE(len, lhs) do { \\\n"
+            "        node = arena_node(arena, (lhs)); \\\n"
+            "        if (!node) goto nomem; \\\n"
+            "        if ((len) > 0) { \\\n"
+            "            node->children = arena_children(arena, (len)); \\\n"
+            "            if (!node->children) goto nomem; \\\n"
+            "            for (int i = 0; i < (len); i++) node->children[i] = elems[top - (len) + 1 + i].node; \\\n"
+            "            node->num_children = (len); \\\n"
+            "            top -= (len); \\\n"
+            "        } \\\n"
+            "    } while (0)\n"
+            "#define GEN_GOTO(n) do { GEN_PUSH(n, node); goto s##n; } while (0)\n"
+            "#define GEN_TOP_STATE elems[top].state\n\n",
+            prefix);
+    }
+
+    write_body(out, grammar, table, &plan);
+
+    // Exits; only the referenced ones are written
+    fprintf(out, "\n");
+    if (collapse) {
+        if (plan.labels & LABEL_ACCEPT) fprintf(out, "accept:\n    stack->top = top;\n    return 1;\n");
+        if (plan.labels & LABEL_REJECT) fprintf(out, "reject:\n    stack->top = top;\n    *error_pos = start;\n    return 0;\n");
+        if (plan.labels & LABEL_FAIL) fprintf(out, "fail:\n    stack->top = top;\n    *error_pos = start;\n    return -1;\n");
+        if (plan.labels & LABEL_NOMEM) fprintf(out, "nomem:\n    stack->top = top;\n    *error_pos = start;\n    return -2;\n");
+    } else {
+        if (plan.labels & LABEL_ACCEPT) {
+            fprintf(out, "accept:\n    stack->top = top;\n    result->accepted = 1;\n"
+                         "    result->tree = elems[top].node;\n    return 1;\n");
+        }
+        if (plan.labels & LABEL_REJECT) fprintf(out, "reject:\n    stack->top = top;\n    result->error_pos = start;\n    return 0;\n");
+        if (plan.labels & LABEL_FAIL) fprintf(out, "fail:\n    stack->top = top;\n    result->error_pos = start;\n    return -1;\n");
+        if (plan.labels & LABEL_NOMEM) fprintf(out, "nomem:\n    stack->top = top;\n    result->error_pos = start;\n    return -2;\n");
+    }
+    fprintf(out, "\n#undef GEN_PUSH\n#undef GEN_SHIFT\n#undef GEN_REDUCE\n#undef GEN_GOTO\n#undef GEN_TOP_STATE\n}\n\n");
+
+    free(plan.states);
+    free(plan.rules);
+    free(plan.lhs);
+}
+
+// Write the generated parser source for 'grammar'/'table' with functions
+// named <prefix>_recognize and <prefix>_parse
+void write_parser_c(Grammar* grammar, Table* table, const char* source, const char* prefix, FILE* out) {
+    fprintf(out, "// Direct-coded LR parser generated by lr_parser -C from %s: do not edit.\n", source);
+    fprintf(out, "// %d states, %d rules. Build with structs.h and the parser objects;\n", table->num_states,
+            grammar->num_rules);
+    fprintf(out, "// -DLR_GEN_MAIN adds a standalone driver.\n");
+    fprintf(out, "#include \"structs.h\"\n\n");
+
+    fprintf(out, "// Function prototypes from other modules\n");
+    fprintf(out, "Node* arena_node(NodeArena* arena, int symbol);\n");
+    fprintf(out, "Node** arena_children(NodeArena* arena, int count);\n");
+    fprintf(out, "int push(Stack* stack, int state, Node* node);\n");
+    if (grammar->lexer) {
+        fprintf(out, "int lex_scan(const Lexer* lexer, const char* input, int len, int pos,\n");
+        fprintf(out, "             int* start, int* end, int partial);\n");
+    }
+    fprintf(out, "\n#define GEN_STALE -3  // Lookahead must be read again (after a shift)\n\n");
+
+    // Lookahead: read lazily, like recognize(), so default reductions never lex
+    fprintf(out, "// Read the lookahead unless it is still current\n");
+    if (grammar->lexer) {
+        fprintf(out, "#define GEN_LOOK() do { \\\n"
+                     "        if (symbol == GEN_STALE) { \\\n"
+                     "            symbol = lex_scan(grammar->lexer, input, input_len, pos, &start, &end, 0); \\\n"
+                     "        } \\\n"
+                     "    } while (0)\n\n");
+    } else {
+        fprintf(out, "#define GEN_LOOK() do { \\\n"
+                     "        if (symbol == GEN_STALE) { \\\n"
+                     "            start = pos; \\\n"
+                     "            end = pos < input_len ? pos + 1 : pos; \\\n"
+                     "            symbol = pos < input_len ? (unsigned char)input[pos] : '$'; \\\n"
+                     "        } \\\n"
+                     "    } while (0)\n\n");
+    }
+
+    write_function(out, grammar, table, prefix, 1);
+    write_function(out, grammar, table, prefix, 0);
+
+    fprintf(out,
+        "#ifdef LR_GEN_MAIN\n"
+        "int load_grammar_table(const char* filename, Grammar* grammar, Table* table);\n"
+        "void free_table(Table* table);\n"
+        "void free_grammar(Grammar* grammar);\n"
+        "NodeArena* create_arena(size_t slab_size);\n"
+        "void free_arena(NodeArena* arena);\n"
+        "Stack* create_stack(int initial_capacity);\n"
+        "void free_stack(Stack* stack);\n"
+        "int print_tree_as(Node* root, const Grammar* grammar, int format);\n"
+        "const char* lr_strerror(int code);\n"
+        "\n"
+        "// Standalone driver: <grammar_file> <input> prints ACCEPT\\t<tree> or\n"
+        "// REJECT\\t<pos>. The grammar file only supplies the lexer.\n"
+        "int main(int argc, char* argv[]) {\n"
+        "    if (argc < 3) {\n"
+        "        fprintf(stderr, \"Usage: %%s <grammar_file> <input_string>\\n\", argv[0]);\n"
+        "        return 1;\n"
+        "    }\n"
+        "    Grammar grammar;\n"
+        "    Table table;\n"
+        "    if (!load_grammar_table(argv[1], &grammar, &table)) return 1;\n"
+        "    Stack* stack = create_stack(100);\n"
+        "    NodeArena* arena = create_arena(64 * 1024);\n"
+        "    ParseResult result;\n"
+        "    int status = %s_parse(&grammar, argv[2], (int)strlen(argv[2]), stack, arena, &result);\n"
+        "    if (status == 1) {\n"
+        "        printf(\"ACCEPT\\t\");\n"
+        "        print_tree_as(result.tree, &grammar, TREE_COMPACT);\n"
+        "    } else if (status == 0) {\n"
+        "        printf(\"REJECT\\t%%ld\\n\", result.error_pos);\n"
+        "    } else {\n"
+        "        fprintf(stderr, \"Error: %%s\\n\", lr_strerror(status));\n"
+        "    }\n"
+        "    free_arena(arena);\n"
+        "    free_stack(stack);\n"
+        "    free_grammar(&grammar);\n"
+        "    free_table(&table);\n"
+        "    return status == 1 ? 0 : 1;\n"
+        "}\n"
+        "#endif\n",
+        prefix);
+}
+
+// Write the generated parser to 'filename'. The function prefix is the
+// file's base name (test3_gen.c -> test3_gen_parse). Returns 1 on success.
+int save_parser_c(const char* filename, const char* source, Grammar* grammar, Table* table) {
+    const char* base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    char prefix[64];
+    int len = 0;
+    if (isdigit((unsigned char)base[0])) prefix[len++] = 'p';
+    for (const char* p = base; *p && *p != '.' && len < (int)sizeof(prefix) - 1; p++) {
+        prefix[len++] = isalnum((unsigned char)*p) ? *p : '_';
+    }
+    if (len == 0) {
+        strcpy(prefix, "parser");
+        len = 6;
+    }
+    prefix[len] = '\0';
+
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+        return 0;
+    }
+    write_parser_c(grammar, table, source, prefix, out);
+    int ok = !ferror(out);
+    if (fclose(out) != 0) ok = 0;
+    return ok;
+}
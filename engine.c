@@ -1,28 +1,63 @@
 #include "structs.h"
 
 // Function prototypes from other modules
-Node* create_node(char symbol);
+Node* create_node(int symbol);
 void add_child(Node* parent, Node* child);
-void print_tree(Node* root);
+void print_tree(Node* root, const Grammar* grammar);
+int print_tree_as(Node* root, const Grammar* grammar, int format);
 void free_tree(Node* node);
 
+NodeArena* create_arena(size_t slab_size);
+Node* arena_node(NodeArena* arena, int symbol);
+Node** arena_children(NodeArena* arena, int count);
+void free_arena(NodeArena* arena);
+
+int flat_append(FlatTree* tree, int symbol, int rule, int arity, int size,
+                int offset, int length);
+void write_symbol(FILE* out, const Grammar* grammar, int symbol, int lhs);
+int escape_terminal(char* out, int c);
+
+int lex_scan(const Lexer* lexer, const char* input, int len, int pos,
+             int* start, int* end, int partial);
+
+#define LOOKAHEAD_STALE -3  // Cached lookahead must be read again (after a shift)
+
+// Terminal at 'pos': the byte itself, or the next token when the grammar
+// has a lexer. Sets its span [*start, *end) and returns the symbol, '$' at
+// the end of input, or LEX_ERROR.
+static inline int next_terminal(const Lexer* lexer, const char* input, int input_len, int pos,
+                                int* start, int* end) {
+    if (lexer) {
+        return lex_scan(lexer, input, input_len, pos, start, end, 0);
+    }
+    *start = pos;
+    if (pos >= input_len) {
+        *end = pos;
+        return '$';
+    }
+    *end = pos + 1;
+    return (unsigned char)input[pos];
+}
+
 Stack* create_stack(int initial_capacity);
-void push(Stack* stack, int state, Node* node);
+int push(Stack* stack, int state, Node* node);
 StackElement pop(Stack* stack);
 int peek_state(Stack* stack);
 StackElement* get_element(Stack* stack, int offset);
 int is_empty(Stack* stack);
 int stack_size(Stack* stack);
 void free_stack(Stack* stack);
+int grow_value_stack(ValueStack* stack, int top);
+int grow_state_stack(StateStack* stack);
 
 // Print current parsing state (for trace output)
-void print_trace(const char* input, int input_pos, Stack* stack) {
+void print_trace(const char* input, int input_len, int input_pos, Stack* stack) {
     // Print remaining input
     printf("Flot: ");
-    for (int i = input_pos; input[i]; i++) {
+    for (int i = input_pos; i < input_len; i++) {
         printf("%c", input[i]);
     }
-    if (!input[input_pos]) {
+    if (input_pos >= input_len) {
         printf("$");
     }
     
@@ -34,61 +69,228 @@ void print_trace(const char* input, int input_pos, Stack* stack) {
     printf("\n");
 }
 
-// Main LR parsing engine
-int parse(Grammar* grammar, Table* table, const char* input, int trace) {
-    Stack* stack = create_stack(100);
+// One step of a unit chain: if 'goto_state' reduces by a unit rule whatever
+// the lookahead, return the GOTO of that rule's LHS from 'prev_state' (rule
+// index in *rule_num), or 0 if the chain ends here
+static int unit_chain_step(Grammar* grammar, Table* table, int prev_state,
+                           int goto_state, int* rule_num) {
+    if (goto_state <= 0 || goto_state >= table->num_states) return 0;
+    int action = table->default_reduce[goto_state];
+    if (action >= 0 || action == ACTION_ACCEPT) return 0;
+    Rule* unit = &grammar->rules[-action - 1];
+    if (unit->rhs_len != 1) return 0;
+    *rule_num = -action - 1;
+    int next = table_action(table, prev_state, unit->lhs);
+    return next > 0 ? next : 0;
+}
+
+#ifndef LR_NO_STATS
+// Count the unit rules that unit_goto(prev_state, lhs) jumps over, so the
+// collapsing engines report the same reductions as the ones that walk the chain
+static void count_unit_chain(Grammar* grammar, Table* table, int prev_state, int lhs) {
+    int goto_state = table_action(table, prev_state, lhs);
+    int unit_rule;
+    for (int steps = 0; steps < grammar->num_rules &&
+         (goto_state = unit_chain_step(grammar, table, prev_state, goto_state, &unit_rule)) > 0; steps++) {
+        STAT_RULE(unit_rule);
+    }
+}
+#define STAT_UNIT_CHAIN(grammar, table, state, lhs) \
+    do { if (lr_stats) count_unit_chain(grammar, table, state, lhs); } while (0)
+#else
+#define STAT_UNIT_CHAIN(grammar, table, state, lhs) ((void)0)
+#endif
+
+// Reduce by rule 'rule_num' (0-based): pop the RHS, build the LHS node
+// (unless arena is NULL) and push the GOTO state. Unit reductions that
+// follow by default are collapsed into the same step.
+// Returns the GOTO state, -1 if the rule or GOTO entry is invalid, or -2
+// if out of memory. Nothing is printed unless 'trace' is set.
+int reduce_rule(Grammar* grammar, Table* table, Stack* stack, NodeArena* arena,
+                int rule_num, int trace) {
+    if (rule_num < 0 || rule_num >= grammar->num_rules) {
+        if (trace) printf("\nERROR: Invalid rule number %d\n", rule_num + 1);
+        return -1;
+    }
+    
+    Rule* rule = &grammar->rules[rule_num];
+    
+    if (trace) {
+        printf("Action: REDUCE by rule %d: ", rule_num + 1);
+        write_symbol(stdout, grammar, rule->lhs, 1);
+        printf(" ->");
+        for (int i = 0; i < rule->rhs_len; i++) {
+            putchar(' ');
+            write_symbol(stdout, grammar, rule->rhs[i], 0);
+        }
+        printf("\n");
+    }
+    
+    Node* new_node = NULL;
+    int rhs_len = rule->rhs_len;
+    if (rhs_len > stack->top) {
+        // The table reduces more symbols than were shifted
+        return -1;
+    }
+    
+    if (!arena) {
+        // No tree: just drop the RHS states
+        stack->top -= rhs_len;
+    } else {
+        // Create new node for LHS
+        new_node = arena_node(arena, rule->lhs);
+        if (!new_node) return -2;
+        
+        // Pop L elements (where L = length of RHS) straight into
+        // an exact-size child array from the arena
+        if (rhs_len > 0) {
+            Node** children = arena_children(arena, rhs_len);
+            if (!children) return -2;
+            
+            // Pop in reverse order, so children end up left-to-right
+            for (int i = rhs_len - 1; i >= 0; i--) {
+                StackElement elem = pop(stack);
+                children[i] = elem.node;
+            }
+            
+            new_node->children = children;
+            new_node->num_children = rhs_len;
+        }
+    }
+    
+    // GOTO: Look at new top state (after popping RHS elements)
+    int prev_state = peek_state(stack);
+    int lhs_symbol = rule->lhs;
+    int goto_state = 0;
+    
+    if (prev_state >= 0 && !arena && !trace) {
+        // No nodes to build: jump straight to the end of the unit chain
+        goto_state = unit_goto(table, prev_state, lhs_symbol);
+        STAT_UNIT_CHAIN(grammar, table, prev_state, lhs_symbol);
+    } else if (prev_state >= 0) {
+        goto_state = table_action(table, prev_state, lhs_symbol);
+        
+        if (trace) {
+            printf("Current state after pop: %d, Looking for GOTO on ", prev_state);
+            write_symbol(stdout, grammar, lhs_symbol, 1);
+            printf(" (0x%02x)\n", lhs_symbol);
+            printf("Table entry: %d\n", goto_state);
+        }
+        
+        // Unit chain: wrap the node once per unit reduction, no stack traffic
+        int unit_rule;
+        int next;
+        for (int steps = 0; steps < grammar->num_rules &&
+             (next = unit_chain_step(grammar, table, prev_state, goto_state, &unit_rule)) > 0; steps++) {
+            Rule* unit = &grammar->rules[unit_rule];
+            STAT_RULE(unit_rule);
+            
+            if (trace) {
+                printf("Action: REDUCE by rule %d (unit chain): ", unit_rule + 1);
+                write_symbol(stdout, grammar, unit->lhs, 1);
+                printf(" -> state %d\n", next);
+            }
+            if (arena) {
+                Node* parent = arena_node(arena, unit->lhs);
+                Node** children = parent ? arena_children(arena, 1) : NULL;
+                if (!children) return -2;
+                children[0] = new_node;
+                parent->children = children;
+                parent->num_children = 1;
+                new_node = parent;
+            }
+            lhs_symbol = unit->lhs;
+            goto_state = next;
+        }
+    }
+    
+    if (goto_state <= 0) {
+        if (trace) {
+            printf("\nERROR: No GOTO for state %d, non-terminal ", prev_state);
+            write_symbol(stdout, grammar, lhs_symbol, 1);
+            printf(" (index %d)\n", lhs_symbol);
+        }
+        return -1;
+    }
+    
+    if (trace) {
+        printf("GOTO: state %d\n", goto_state);
+    }
+    
+    // Push new state with new node
+    if (!push(stack, goto_state, new_node)) return -2;
+    return goto_state;
+}
+
+// Core LR parsing loop over input[0..input_len), reusing the caller's
+// stack and arena (NULL arena = no tree is built). Returns 1 on accept,
+// 0 on reject, -1 on a table error, -2 if out of memory. Nothing is
+// printed unless 'trace' is set.
+int parse_input(Grammar* grammar, Table* table, const char* input, int input_len,
+                int trace, Stack* stack, NodeArena* arena, ParseResult* result) {
+    stack->top = -1;
+    result->accepted = 0;
+    result->error_pos = -1;
+    result->tree = NULL;
     
     // Initialize: push state 0 with null node
-    push(stack, 0, NULL);
+    if (!push(stack, 0, NULL)) return -2;
+    STAT_ADD(inputs, 1);
+    TRACE(TRACE_BEGIN, 0, 0, 0, 0, 0, 1);
     
     int input_pos = 0;
-    int input_len = strlen(input);
+    int symbol = LOOKAHEAD_STALE;
+    int tok_start = 0;
+    int tok_end = 0;
     
     if (trace) {
         printf("\n=== Parsing Trace ===\n");
-        printf("Input: %s\n\n", input);
+        printf("Input: %.*s\n\n", input_len, input);
     }
     
     while (1) {
         int current_state = peek_state(stack);
         
-        // Get current input symbol (or $ for end)
-        char current_char;
-        if (input_pos >= input_len) {
-            current_char = '$';
-        } else {
-            current_char = input[input_pos];
+        // Get current input symbol (or $ for end): a byte, or a token with a lexer
+        if (symbol == LOOKAHEAD_STALE) {
+            symbol = next_terminal(grammar->lexer, input, input_len, input_pos, &tok_start, &tok_end);
+            if (trace && grammar->lexer && symbol != LEX_ERROR) {
+                printf("Token: %c '%.*s' at %d\n", symbol, tok_end - tok_start, input + tok_start, tok_start);
+            }
         }
-        
         if (trace) {
-            print_trace(input, input_pos, stack);
+            print_trace(input, input_len, input_pos, stack);
         }
         
-        // Look up action in table
-        short action = table->data[current_state * TABLE_COLS + (unsigned char)current_char];
+        // Look up action in table (states with a default reduction skip the lookahead)
+        int action = table->default_reduce[current_state];
+        if (action == ACTION_ERROR && symbol != LEX_ERROR) {
+            action = table_action(table, current_state, symbol);
+        }
         
-        if (action == 0) {
+        if (action == ACTION_ERROR) {
             // Error
-            if (trace) {
-                printf("\nERROR: No action for state %d, symbol '%c'\n", current_state, current_char);
+            if (trace && symbol == LEX_ERROR) {
+                printf("\nERROR: No token matches at position %d\n", tok_start);
+            } else if (trace) {
+                printf("\nERROR: No action for state %d, symbol '%c'\n", current_state, symbol);
             }
-            printf("REJECT\n");
-            free_stack(stack);
+            TRACE(TRACE_ACTION, current_state, ACTION_ERROR, 0, symbol, tok_start, stack->top + 1);
+            result->error_pos = tok_start;
             return 0;
             
-        } else if (action == -127) {
+        } else if (action == ACTION_ACCEPT) {
             // Accept
             if (trace) {
                 printf("\nACCEPT\n");
             }
+            TRACE(TRACE_ACTION, current_state, ACTION_ACCEPT, 0, symbol, input_pos, stack->top + 1);
             
             // The parse tree is at the top of the stack
-            if (stack->top >= 0 && stack->elements[stack->top].node) {
-                printf("\nParse Tree:\n");
-                print_tree(stack->elements[stack->top].node);
+            result->accepted = 1;
+            if (stack->top >= 0) {
+                result->tree = stack->elements[stack->top].node;
             }
-            
-            free_stack(stack);
             return 1;
             
         } else if (action > 0) {
@@ -97,93 +299,590 @@ int parse(Grammar* grammar, Table* table, const char* input, int trace) {
                 printf("Action: SHIFT %d\n", action);
             }
             
-            // Create leaf node for this terminal
-            Node* leaf = create_node(current_char);
+            // Create leaf node for this terminal (none without an arena)
+            Node* leaf = NULL;
+            if (arena) {
+                leaf = arena_node(arena, symbol);
+                if (!leaf) return -2;
+                leaf->offset = tok_start;
+                leaf->length = tok_end - tok_start;
+            }
             
             // Push new state and node
-            push(stack, action, leaf);
+            if (!push(stack, action, leaf)) return -2;
+            STAT_SHIFT(current_state, stack->top);
+            TRACE(TRACE_ACTION, current_state, action, action, symbol, input_pos, stack->top + 1);
             
-            // Consume input character
-            input_pos++;
+            // Consume the input character or token
+            input_pos = tok_end;
+            symbol = LOOKAHEAD_STALE;
             
         } else {
             // Reduce by rule abs(action)
-            int rule_num = -action - 1;  // Convert to 0-based index
-            
-            if (rule_num < 0 || rule_num >= grammar->num_rules) {
-                fprintf(stderr, "Error: Invalid rule number %d\n", rule_num + 1);
-                free_stack(stack);
-                return 0;
+            int goto_state = reduce_rule(grammar, table, stack, arena, -action - 1, trace);
+            if (goto_state < 0) {
+                result->error_pos = tok_start;
+                return goto_state;
             }
-            
+            STAT_REDUCE(current_state, -action - 1, stack->top);
+            TRACE(TRACE_ACTION, current_state, action, goto_state, symbol, input_pos, stack->top + 1);
+        }
+    }
+}
+
+// Recognize-only parsing: the stack holds states only, and nothing is
+// allocated unless the stack has to grow. Returns 1 on accept, 0 on
+// reject (position in *error_pos), -1 on a table error, -2 if out of memory.
+int recognize(Grammar* grammar, Table* table, const char* input, int input_len,
+              StateStack* stack, int* error_pos) {
+    int* states = stack->states;
+    int top = 0;
+    int input_pos = 0;
+    int symbol = LOOKAHEAD_STALE;
+    int tok_start = 0;
+    int tok_end = 0;
+    int status = -1;
+    states[0] = 0;
+    *error_pos = -1;
+    STAT_ADD(inputs, 1);
+    TRACE(TRACE_BEGIN, 0, 0, 0, 0, 0, 1);
+    
+    while (1) {
+        int action = table->default_reduce[states[top]];
+        if (action == ACTION_ERROR) {
+            // The lookahead is only read when the state needs it
+            if (symbol == LOOKAHEAD_STALE) {
+                symbol = next_terminal(grammar->lexer, input, input_len, input_pos, &tok_start, &tok_end);
+            }
+            if (symbol != LEX_ERROR) {
+                action = table_action(table, states[top], symbol);
+            }
+        }
+        
+        if (action > 0) {
+            // Shift
+            if (top + 1 >= stack->capacity) {
+                if (!grow_state_stack(stack)) {
+                    status = -2;
+                    break;
+                }
+                states = stack->states;
+            }
+            STAT_SHIFT(states[top], top + 1);
+            TRACE(TRACE_ACTION, states[top], action, action, symbol, input_pos, top + 2);
+            states[++top] = action;
+            input_pos = tok_end;
+            symbol = LOOKAHEAD_STALE;
+        } else if (action == ACTION_ACCEPT) {
+            TRACE(TRACE_ACTION, states[top], ACTION_ACCEPT, 0, symbol, input_pos, top + 1);
+            stack->top = top;
+            return 1;
+        } else if (action == ACTION_ERROR) {
+            TRACE(TRACE_ACTION, states[top], ACTION_ERROR, 0, symbol, tok_start, top + 1);
+            stack->top = top;
+            *error_pos = tok_start;
+            return 0;
+        } else {
+            // Reduce: drop the RHS states and take the GOTO
+            int rule_num = -action - 1;
+            if (rule_num >= grammar->num_rules) break;
             Rule* rule = &grammar->rules[rule_num];
-            
-            if (trace) {
-                printf("Action: REDUCE by rule %d: %c ->", rule_num + 1, GET_CHAR(rule->lhs));
-                for (int i = 0; i < rule->rhs_len; i++) {
-                    if (IS_NONTERMINAL(rule->rhs[i])) {
-                        printf(" $%c", GET_CHAR(rule->rhs[i]));
-                    } else {
-                        printf(" %c", rule->rhs[i]);
-                    }
+            STAT_REDUCE(states[top], rule_num, top - rule->rhs_len + 1);
+            top -= rule->rhs_len;
+            if (top < 0) break;
+            int goto_state = unit_goto(table, states[top], rule->lhs);
+            if (goto_state <= 0) break;
+            STAT_UNIT_CHAIN(grammar, table, states[top], rule->lhs);
+            if (top + 1 >= stack->capacity) {
+                if (!grow_state_stack(stack)) {
+                    status = -2;
+                    break;
                 }
-                printf("\n");
+                states = stack->states;
             }
-            
-            // Create new node for LHS
-            Node* new_node = create_node(rule->lhs);
-            
-            // Pop L elements (where L = length of RHS)
-            // and attach them as children (in reverse order to maintain left-to-right)
+            // The popped states are still in place above the new top
+            TRACE(TRACE_ACTION, states[top + rule->rhs_len], action, goto_state, symbol, input_pos,
+                  top + 2);
+            states[++top] = goto_state;
+        }
+    }
+    
+    stack->top = -1;
+    *error_pos = input_pos;
+    return status;
+}
+
+// Parse into a flat post-order tree (appended to 'tree', which is reset
+// first). Each stack element records the index of its subtree root, so a
+// reduce only appends one node. Returns 1 on accept, 0 on reject
+// (position in *error_pos), -1 on a table error, -2 if out of memory.
+int parse_flat(Grammar* grammar, Table* table, const char* input, int input_len,
+               Stack* stack, FlatTree* tree, int* error_pos) {
+    stack->top = -1;
+    tree->count = 0;
+    *error_pos = -1;
+    if (!push(stack, 0, NULL)) return -2;
+    STAT_ADD(inputs, 1);
+    TRACE(TRACE_BEGIN, 0, 0, 0, 0, 0, 1);
+    int input_pos = 0;
+    int symbol = LOOKAHEAD_STALE;
+    int tok_start = 0;
+    int tok_end = 0;
+    int status = -1;
+    
+    while (1) {
+        int current_state = stack->elements[stack->top].state;
+        int action = table->default_reduce[current_state];
+        if (action == ACTION_ERROR) {
+            if (symbol == LOOKAHEAD_STALE) {
+                symbol = next_terminal(grammar->lexer, input, input_len, input_pos, &tok_start, &tok_end);
+            }
+            if (symbol != LEX_ERROR) {
+                action = table_action(table, current_state, symbol);
+            }
+        }
+        
+        if (action > 0) {
+            int leaf = flat_append(tree, symbol, -1, 0, 1, tok_start, tok_end - tok_start);
+            if (leaf < 0 || !push(stack, action, NULL)) {
+                status = -2;
+                break;
+            }
+            STAT_SHIFT(current_state, stack->top);
+            TRACE(TRACE_ACTION, current_state, action, action, symbol, input_pos, stack->top + 1);
+            stack->elements[stack->top].index = leaf;
+            input_pos = tok_end;
+            symbol = LOOKAHEAD_STALE;
+        } else if (action == ACTION_ACCEPT) {
+            TRACE(TRACE_ACTION, current_state, ACTION_ACCEPT, 0, symbol, input_pos, stack->top + 1);
+            return 1;
+        } else if (action == ACTION_ERROR) {
+            TRACE(TRACE_ACTION, current_state, ACTION_ERROR, 0, symbol, tok_start, stack->top + 1);
+            *error_pos = tok_start;
+            return 0;
+        } else {
+            int rule_num = -action - 1;
+            if (rule_num >= grammar->num_rules) break;
+            Rule* rule = &grammar->rules[rule_num];
             int rhs_len = rule->rhs_len;
-            Node** children = NULL;
+            if (stack->top - rhs_len < 0) break;
+            STAT_REDUCE(current_state, rule_num, stack->top - rhs_len + 1);
             
+            // The children are the consecutive subtrees ending at the top
+            int start = tree->count;
             if (rhs_len > 0) {
-                children = (Node**)malloc(rhs_len * sizeof(Node*));
-                
-                // Pop in reverse order, so we can add children left-to-right
-                for (int i = rhs_len - 1; i >= 0; i--) {
-                    StackElement elem = pop(stack);
-                    children[i] = elem.node;
-                }
-                
-                // Add children to new node
-                for (int i = 0; i < rhs_len; i++) {
-                    add_child(new_node, children[i]);
-                }
-                
-                free(children);
+                int first = stack->elements[stack->top - rhs_len + 1].index;
+                start = first - tree->size[first] + 1;
             }
+            stack->top -= rhs_len;
+            int prev_state = stack->elements[stack->top].state;
+            int goto_state = table_action(table, prev_state, rule->lhs);
+            int node = flat_append(tree, rule->lhs, rule_num, rhs_len, tree->count - start + 1, -1, 0);
             
-            // GOTO: Look at new top state (after popping RHS elements)
-            int prev_state = peek_state(stack);
-            unsigned char lhs_symbol = (unsigned char)rule->lhs;
-            short goto_state = table->data[prev_state * TABLE_COLS + lhs_symbol];
-            
-            if (trace) {
-                printf("Current state after pop: %d, Looking for GOTO on %c (0x%02x)\n", 
-                       prev_state, GET_CHAR(rule->lhs), lhs_symbol);
-                printf("Table entry: %d\n", goto_state);
+            int unit_rule;
+            int next;
+            for (int steps = 0; node >= 0 && steps < grammar->num_rules &&
+                 (next = unit_chain_step(grammar, table, prev_state, goto_state, &unit_rule)) > 0; steps++) {
+                node = flat_append(tree, grammar->rules[unit_rule].lhs, unit_rule, 1, tree->size[node] + 1,
+                                   -1, 0);
+                STAT_RULE(unit_rule);
+                goto_state = next;
+            }
+            if (node < 0) {
+                status = -2;
+                break;
+            }
+            if (goto_state <= 0) break;
+            if (!push(stack, goto_state, NULL)) {
+                status = -2;
+                break;
+            }
+            TRACE(TRACE_ACTION, current_state, action, goto_state, symbol, input_pos, stack->top + 1);
+            stack->elements[stack->top].index = node;
+        }
+    }
+    
+    *error_pos = input_pos;
+    return status;
+}
+
+// Parse with semantic actions: every shift calls actions->on_shift with the
+// token text and every reduce (unit chains included) calls on_reduce with
+// the values of the RHS symbols; the returned value replaces them on the
+// value stack. No tree is built. Returns 1 on accept (the axiom's value in
+// *value), 0 on reject (position in *error_pos), -1 on a table error, -2 if
+// out of memory.
+int parse_actions(Grammar* grammar, Table* table, const char* input, int input_len,
+                  ValueStack* stack, SemanticActions* actions, SemValue* value, int* error_pos) {
+    int top = 0;
+    int input_pos = 0;
+    int symbol = LOOKAHEAD_STALE;
+    int tok_start = 0;
+    int tok_end = 0;
+    int status = -1;
+    SemValue zero;
+    memset(&zero, 0, sizeof(zero));
+    stack->states[0] = 0;
+    stack->values[0] = zero;
+    *error_pos = -1;
+    STAT_ADD(inputs, 1);
+    
+    while (1) {
+        int current_state = stack->states[top];
+        int action = table->default_reduce[current_state];
+        if (action == ACTION_ERROR) {
+            if (symbol == LOOKAHEAD_STALE) {
+                symbol = next_terminal(grammar->lexer, input, input_len, input_pos, &tok_start, &tok_end);
             }
+            if (symbol != LEX_ERROR) {
+                action = table_action(table, current_state, symbol);
+            }
+        }
+        
+        if (action > 0) {
+            if (top + 1 >= stack->capacity && !grow_value_stack(stack, top + 1)) {
+                status = -2;
+                break;
+            }
+            STAT_SHIFT(current_state, top + 1);
+            top++;
+            stack->states[top] = action;
+            stack->values[top] = actions->on_shift
+                ? actions->on_shift(symbol, input + tok_start, tok_end - tok_start, actions->user)
+                : zero;
+            input_pos = tok_end;
+            symbol = LOOKAHEAD_STALE;
+        } else if (action == ACTION_ACCEPT) {
+            stack->top = top;
+            *value = stack->values[top];
+            return 1;
+        } else if (action == ACTION_ERROR) {
+            stack->top = top;
+            *error_pos = tok_start;
+            return 0;
+        } else {
+            int rule_num = -action - 1;
+            if (rule_num >= grammar->num_rules) break;
+            Rule* rule = &grammar->rules[rule_num];
+            int rhs_len = rule->rhs_len;
+            if (top - rhs_len < 0) break;
+            STAT_REDUCE(current_state, rule_num, top - rhs_len + 1);
             
-            if (goto_state <= 0) {
-                fprintf(stderr, "Error: No GOTO for state %d, non-terminal %c (index %d)\n", 
-                        prev_state, GET_CHAR(rule->lhs), lhs_symbol);
-                fprintf(stderr, "Table value at [%d][%d] = %d\n", 
-                        prev_state, lhs_symbol, goto_state);
-                free_stack(stack);
-                return 0;
+            // The RHS values are the top rhs_len slots; the result takes the first
+            if (top + 1 >= stack->capacity && !grow_value_stack(stack, top + 1)) {
+                status = -2;
+                break;
             }
+            SemValue* values = &stack->values[top - rhs_len + 1];
+            SemValue result = actions->on_reduce
+                ? actions->on_reduce(rule_num, values, rhs_len, actions->user)
+                : (rhs_len > 0 ? values[0] : zero);
+            top -= rhs_len;
+            int prev_state = stack->states[top];
+            int goto_state = table_action(table, prev_state, rule->lhs);
             
-            if (trace) {
-                printf("GOTO: state %d\n", goto_state);
+            int unit_rule;
+            int next;
+            for (int steps = 0; steps < grammar->num_rules &&
+                 (next = unit_chain_step(grammar, table, prev_state, goto_state, &unit_rule)) > 0; steps++) {
+                if (actions->on_reduce) {
+                    result = actions->on_reduce(unit_rule, &result, 1, actions->user);
+                }
+                STAT_RULE(unit_rule);
+                goto_state = next;
+            }
+            if (goto_state <= 0) break;
+            top++;
+            stack->states[top] = goto_state;
+            stack->values[top] = result;
+        }
+    }
+    
+    stack->top = -1;
+    *error_pos = input_pos;
+    return status;
+}
+
+// Record one syntax error; returns 0 if out of memory
+static int add_error(ErrorList* errors, int pos, int length, int found, const uint64_t* expected) {
+    if (errors->count == errors->capacity) {
+        int capacity = errors->capacity ? errors->capacity * 2 : 16;
+        ParseError* items = (ParseError*)realloc(errors->items, capacity * sizeof(ParseError));
+        if (!items) return 0;
+        errors->items = items;
+        errors->capacity = capacity;
+    }
+    ParseError* error = &errors->items[errors->count++];
+    error->pos = pos;
+    error->length = length;
+    error->found = found;
+    memcpy(error->expected, expected, sizeof(error->expected));
+    return 1;
+}
+
+#define RECOVERY_DEPTH 64  // States a recovery check may push above the real stack
+
+// Whether 'symbol' gets shifted (or accepted) from the stack states[0..top]
+// with 'extra' pushed on top (0 = nothing), running the reductions on a
+// scratch copy of the states above the real stack
+static int shifts_after(Grammar* grammar, Table* table, const int* states, int top,
+                        int extra, int symbol) {
+    int above[RECOVERY_DEPTH];
+    int count = 0;
+    if (extra) above[count++] = extra;
+    
+    for (int steps = 0; steps < 4 * RECOVERY_DEPTH; steps++) {
+        int state = count ? above[count - 1] : states[top];
+        int action = table_action(table, state, symbol);
+        if (action > 0 || action == ACTION_ACCEPT) return 1;
+        if (action == ACTION_ERROR || -action - 1 >= grammar->num_rules) return 0;
+        
+        Rule* rule = &grammar->rules[-action - 1];
+        if (rule->rhs_len <= count) {
+            count -= rule->rhs_len;
+        } else {
+            top -= rule->rhs_len - count;
+            count = 0;
+            if (top < 0) return 0;
+        }
+        state = count ? above[count - 1] : states[top];
+        int goto_state = table_action(table, state, rule->lhs);
+        if (goto_state <= 0 || count == RECOVERY_DEPTH) return 0;
+        above[count++] = goto_state;
+    }
+    return 0;
+}
+
+// Where recovery can resume with terminal 'symbol': the topmost stack
+// index from which it is shifted after the reductions it triggers
+// (*inserted = 0), or from which it is shifted after the GOTO on some
+// non-terminal (*inserted = that GOTO state, as if the missing phrase had
+// been read). Returns -1 if no state qualifies.
+static int resume_point(Grammar* grammar, Table* table, const int* states, int top,
+                        int symbol, int* inserted) {
+    for (int i = top; i >= 0; i--) {
+        *inserted = 0;
+        if (shifts_after(grammar, table, states, i, 0, symbol)) return i;
+        for (int a = NT_BASE; a < table->num_cols; a++) {
+            int target = table_action(table, states[i], a);
+            if (target > 0 && target < table->num_states &&
+                shifts_after(grammar, table, states, i, target, symbol)) {
+                *inserted = target;
+                return i;
             }
+        }
+    }
+    return -1;
+}
+
+// Terminals the parse could have gone on with at an error in states[top]:
+// those shifted after the reductions they trigger from there, among the
+// 'allowed' ones that take the default reductions run since the lookahead
+// was last looked up (those ran whatever the lookahead was)
+static void expected_terminals(Grammar* grammar, Table* table, const int* states, int top,
+                               const uint64_t* allowed, uint64_t* expected) {
+    memset(expected, 0, TERMSET_WORDS * sizeof(uint64_t));
+    for (int c = 0; c < NT_BASE; c++) {
+        if (TERMSET_HAS(allowed, c) && shifts_after(grammar, table, states, top, 0, c)) {
+            TERMSET_ADD(expected, c);
+        }
+    }
+}
+
+// Recognize with panic-mode error recovery: every syntax error is recorded
+// in 'errors' (reset first) and parsing resumes, so one pass finds them all.
+// On an error, tokens are dropped until one the stack can resume with (see
+// resume_point), and the stack is cut back to that point. Only sync tokens
+// and the token after a dropped sync token are tried (any token if the
+// grammar has no %sync). Errors are not recorded again until a token has
+// been shifted, and a second error before that drops the token.
+// Returns 1 if the input is valid, 0 if errors were found, -1 on a table
+// error, -2 if out of memory.
+int diagnose(Grammar* grammar, Table* table, const char* input, int input_len,
+             StateStack* stack, ErrorList* errors) {
+    int* states = stack->states;
+    int top = 0;
+    int input_pos = 0;
+    int symbol = LOOKAHEAD_STALE;
+    int tok_start = 0;
+    int tok_end = 0;
+    int recovering = 0;     // No shift since the last error
+    int any_sync = termset_empty(grammar->sync);
+    int status = -1;
+    uint64_t allowed[TERMSET_WORDS];    // Lookaheads the default reductions since the last lookup take
+    uint64_t expected[TERMSET_WORDS];
+    memset(allowed, 0xff, sizeof(allowed));
+    states[0] = 0;
+    errors->count = 0;
+    STAT_ADD(inputs, 1);
+    
+    while (1) {
+        int action = table->default_reduce[states[top]];
+        if (action == ACTION_ERROR) {
+            if (symbol == LOOKAHEAD_STALE) {
+                symbol = next_terminal(grammar->lexer, input, input_len, input_pos, &tok_start, &tok_end);
+            }
+            if (symbol != LEX_ERROR) {
+                action = table_action(table, states[top], symbol);
+            }
+            if (action != ACTION_ERROR) memset(allowed, 0xff, sizeof(allowed));
+        } else {
+            // Taken without looking: only its own lookaheads would have
+            for (int w = 0; w < TERMSET_WORDS; w++) {
+                allowed[w] &= table->expected[states[top] * TERMSET_WORDS + w];
+            }
+        }
+        
+        if (action > 0) {
+            if (top + 1 >= stack->capacity) {
+                if (!grow_state_stack(stack)) {
+                    status = -2;
+                    break;
+                }
+                states = stack->states;
+            }
+            STAT_SHIFT(states[top], top + 1);
+            states[++top] = action;
+            input_pos = tok_end;
+            symbol = LOOKAHEAD_STALE;
+            recovering = 0;
+        } else if (action == ACTION_ACCEPT) {
+            stack->top = top;
+            return errors->count == 0;
+        } else if (action == ACTION_ERROR) {
+            if (!recovering) {
+                expected_terminals(grammar, table, states, top, allowed, expected);
+                if (!add_error(errors, tok_start, symbol == LEX_ERROR ? 1 : tok_end - tok_start,
+                               symbol, expected)) {
+                    status = -2;
+                    break;
+                }
+            }
+            memset(allowed, 0xff, sizeof(allowed));
             
-            // Push new state with new node
-            push(stack, goto_state, new_node);
+            // Panic mode: drop tokens until the stack can continue with one
+            int drop = recovering;
+            int after_sync = 0;
+            recovering = 1;
+            while (1) {
+                int is_sync = symbol >= 0 && symbol < NT_BASE &&
+                              (any_sync || symbol == '$' || TERMSET_HAS(grammar->sync, symbol));
+                if (!drop && (is_sync || (after_sync && symbol >= 0 && symbol < NT_BASE))) {
+                    int inserted;
+                    int i = resume_point(grammar, table, states, top, symbol, &inserted);
+                    if (i >= 0) {
+                        top = i;
+                        if (inserted) {
+                            if (top + 1 >= stack->capacity) {
+                                if (!grow_state_stack(stack)) {
+                                    status = -2;
+                                    break;
+                                }
+                                states = stack->states;
+                            }
+                            states[++top] = inserted;
+                        }
+                        break;
+                    }
+                }
+                if (symbol == '$') {
+                    stack->top = top;
+                    return 0;
+                }
+                after_sync = is_sync;
+                input_pos = symbol == LEX_ERROR ? tok_start + 1 : tok_end;
+                symbol = next_terminal(grammar->lexer, input, input_len, input_pos, &tok_start, &tok_end);
+                drop = 0;
+            }
+            if (status == -2) break;
+        } else {
+            int rule_num = -action - 1;
+            if (rule_num >= grammar->num_rules) break;
+            Rule* rule = &grammar->rules[rule_num];
+            STAT_REDUCE(states[top], rule_num, top - rule->rhs_len + 1);
+            top -= rule->rhs_len;
+            if (top < 0) break;
+            int goto_state = unit_goto(table, states[top], rule->lhs);
+            if (goto_state <= 0) break;
+            STAT_UNIT_CHAIN(grammar, table, states[top], rule->lhs);
+            if (top + 1 >= stack->capacity) {
+                if (!grow_state_stack(stack)) {
+                    status = -2;
+                    break;
+                }
+                states = stack->states;
+            }
+            states[++top] = goto_state;
         }
     }
     
+    stack->top = -1;
+    return status;
+}
+
+// Print input[pos..pos + length) with its control and non-ASCII bytes escaped
+static void print_escaped(const char* input, int pos, int length) {
+    char text[8];
+    for (int i = 0; i < length; i++) {
+        fwrite(text, 1, escape_terminal(text, (unsigned char)input[pos + i]), stdout);
+    }
+}
+
+// Print the errors found by diagnose, one line each with the expected terminals
+void print_errors(const char* input, ErrorList* errors) {
+    char text[8];
+    for (int i = 0; i < errors->count; i++) {
+        ParseError* error = &errors->items[i];
+        printf("Error at position %d: ", error->pos);
+        if (error->found == '$') {
+            printf("unexpected end of input");
+        } else if (error->found == LEX_ERROR) {
+            printf("no token matches '");
+            print_escaped(input, error->pos, 1);
+            printf("'");
+        } else {
+            printf("unexpected '");
+            print_escaped(input, error->pos, error->length);
+            printf("'");
+        }
+        printf(", expected:");
+        for (int c = 0; c < NT_BASE; c++) {
+            if (!TERMSET_HAS(error->expected, c)) continue;
+            putchar(' ');
+            fwrite(text, 1, escape_terminal(text, c), stdout);
+        }
+        printf("\n");
+    }
+}
+
+// Parse and print the result; tree nodes are allocated from 'arena'.
+// Returns the parse_input status.
+int parse_with_arena(Grammar* grammar, Table* table, const char* input, int trace, int format,
+                     NodeArena* arena) {
+    Stack* stack = create_stack(100);
+    ParseResult result;
+    
+    STAT_TIME_BEGIN(parse_start);
+    int status = parse_input(grammar, table, input, strlen(input), trace, stack, arena, &result);
+    STAT_TIME_END(parse_start, PHASE_PARSE);
+    
+    STAT_TIME_BEGIN(output_start);
+    if (status == 0) {
+        printf("REJECT\n");
+    } else if (status == 1 && result.tree) {
+        printf("\nParse Tree:\n");
+        print_tree_as(result.tree, grammar, format);
+    }
+    STAT_TIME_END(output_start, PHASE_OUTPUT);
+    
     free_stack(stack);
-    return 0;
+    return status;
+}
+
+// Parse with a private arena; the whole tree is released in one go
+int parse(Grammar* grammar, Table* table, const char* input, int trace, int format) {
+    NodeArena* arena = create_arena(64 * 1024);
+    int result = parse_with_arena(grammar, table, input, trace, format, arena);
+    free_arena(arena);
+    return result;
 }
@@ -0,0 +1,606 @@
+#include "structs.h"
+#include <math.h>
+
+// GLR parser (Tomita, with Rekers' shared packed parse forest).
+//
+// The LR stack becomes a graph-structured stack (GSS): one vertex per
+// (state, input position), an edge per symbol between two positions.
+// Where a table cell has several actions (table->conflicts) every action
+// is taken; stacks that reach the same state at the same position share
+// one vertex, so the number of vertices per position is bounded by the
+// number of states. Each edge carries the forest node of its symbol, and
+// a reduction that rebuilds a node already made for the same (symbol,
+// span) adds a packed alternative to it instead of a new node.
+//
+// With a single stack top and no conflict cell, a step costs one table
+// lookup and one edge walk per RHS symbol, as in the LR engine.
+
+// Function prototypes from other modules
+void* arena_alloc(NodeArena* arena, size_t size);
+Node* arena_node(NodeArena* arena, int symbol);
+void write_symbol(FILE* out, const Grammar* grammar, int symbol, int lhs);
+Node** arena_children(NodeArena* arena, int count);
+int conflict_range(const Table* table, int state, int symbol, int* first);
+int lex_scan(const Lexer* lexer, const char* input, int len, int pos,
+             int* start, int* end, int partial);
+
+typedef struct GssVertex GssVertex;
+
+typedef struct GssEdge {
+    GssVertex* to;          // Vertex below (earlier position)
+    ForestNode* label;      // Forest node of the symbol between the two
+    struct GssEdge* next;
+} GssEdge;
+
+struct GssVertex {
+    int state;
+    int level;              // Input position (token index)
+    GssEdge* edges;
+};
+
+// Pending reduction: every path of the rule's length down from 'vertex',
+// restricted to those starting with 'first' or containing 'needed'
+typedef struct {
+    GssVertex* vertex;
+    int rule;
+    GssEdge* first;
+    GssEdge* needed;
+} Reduction;
+
+typedef struct {
+    GssVertex* vertex;
+    int state;
+} Shift;
+
+// Forest node of the current position, found by (symbol, start)
+typedef struct {
+    int stamp;
+    ForestNode* node;
+} ForestSlot;
+
+struct GlrParser {
+    Grammar* grammar;
+    Table* table;
+    NodeArena* arena;       // GSS and forest of the current parse
+
+    int level;              // Current input position
+    int symbol;             // Lookahead at this position
+    int stamp;              // Position stamp for by_state and slots
+
+    GssVertex** tops;       // Stack tops at the current position
+    int num_tops;
+    int cap_tops;
+    GssVertex** by_state;   // Top in each state (valid if state_stamp matches)
+    int* state_stamp;
+    int epsilon_edges;      // Some edge at this position spans no input
+
+    Reduction* reductions;  // Worklist
+    int num_reductions;
+    int cap_reductions;
+    Shift* shifts;
+    int num_shifts;
+    int cap_shifts;
+    GssVertex* accept;      // Top that accepts at the end of input
+
+    ForestSlot* slots;      // Open addressing, size a power of two
+    int slot_mask;
+    int slot_count;
+
+    int* starts;            // Byte span of the token at each position
+    int* ends;
+    int cap_levels;
+
+    ForestNode** path;      // RHS nodes of the path being reduced [longest RHS]
+};
+
+// Create a GLR workspace for one grammar and table
+GlrParser* create_glr(Grammar* grammar, Table* table) {
+    GlrParser* glr = (GlrParser*)calloc(1, sizeof(GlrParser));
+    glr->grammar = grammar;
+    glr->table = table;
+    int num_states = table->num_states > 0 ? table->num_states : 1;
+    glr->by_state = (GssVertex**)calloc(num_states, sizeof(GssVertex*));
+    glr->state_stamp = (int*)calloc(num_states, sizeof(int));
+    glr->cap_tops = 16;
+    glr->tops = (GssVertex**)malloc(glr->cap_tops * sizeof(GssVertex*));
+    glr->cap_reductions = 64;
+    glr->reductions = (Reduction*)malloc(glr->cap_reductions * sizeof(Reduction));
+    glr->cap_shifts = 16;
+    glr->shifts = (Shift*)malloc(glr->cap_shifts * sizeof(Shift));
+    glr->slot_mask = 63;
+    glr->slots = (ForestSlot*)calloc(glr->slot_mask + 1, sizeof(ForestSlot));
+    glr->cap_levels = 1024;
+    glr->starts = (int*)malloc(glr->cap_levels * sizeof(int));
+    glr->ends = (int*)malloc(glr->cap_levels * sizeof(int));
+    int longest = 1;
+    for (int r = 0; r < grammar->num_rules; r++) {
+        if (grammar->rules[r].rhs_len > longest) longest = grammar->rules[r].rhs_len;
+    }
+    glr->path = (ForestNode**)malloc(longest * sizeof(ForestNode*));
+    return glr;
+}
+
+void free_glr(GlrParser* glr) {
+    free(glr->by_state);
+    free(glr->state_stamp);
+    free(glr->tops);
+    free(glr->reductions);
+    free(glr->shifts);
+    free(glr->slots);
+    free(glr->starts);
+    free(glr->ends);
+    free(glr->path);
+    free(glr);
+}
+
+// Top in 'state' at the current position, or NULL
+static inline GssVertex* find_top(GlrParser* glr, int state) {
+    return glr->state_stamp[state] == glr->stamp ? glr->by_state[state] : NULL;
+}
+
+static GssVertex* add_top(GlrParser* glr, int state) {
+    GssVertex* vertex = (GssVertex*)arena_alloc(glr->arena, sizeof(GssVertex));
+    vertex->state = state;
+    vertex->level = glr->level;
+    vertex->edges = NULL;
+    glr->by_state[state] = vertex;
+    glr->state_stamp[state] = glr->stamp;
+    if (glr->num_tops == glr->cap_tops) {
+        glr->cap_tops *= 2;
+        glr->tops = (GssVertex**)realloc(glr->tops, glr->cap_tops * sizeof(GssVertex*));
+    }
+    glr->tops[glr->num_tops++] = vertex;
+    return vertex;
+}
+
+static GssEdge* add_edge(GlrParser* glr, GssVertex* from, GssVertex* to, ForestNode* label) {
+    GssEdge* edge = (GssEdge*)arena_alloc(glr->arena, sizeof(GssEdge));
+    edge->to = to;
+    edge->label = label;
+    edge->next = from->edges;
+    from->edges = edge;
+    if (to->level == from->level) glr->epsilon_edges = 1;
+    return edge;
+}
+
+static void queue_reduction(GlrParser* glr, GssVertex* vertex, int rule, GssEdge* first, GssEdge* needed) {
+    if (glr->num_reductions == glr->cap_reductions) {
+        glr->cap_reductions *= 2;
+        glr->reductions = (Reduction*)realloc(glr->reductions, glr->cap_reductions * sizeof(Reduction));
+    }
+    Reduction* reduction = &glr->reductions[glr->num_reductions++];
+    reduction->vertex = vertex;
+    reduction->rule = rule;
+    reduction->first = first;
+    reduction->needed = needed;
+}
+
+// Queue one action of a top for the current lookahead
+static void queue_action(GlrParser* glr, GssVertex* vertex, int action, GssEdge* first,
+                         GssEdge* needed, int reductions_only) {
+    if (action == ACTION_ACCEPT) {
+        if (!reductions_only) glr->accept = vertex;
+    } else if (action > 0) {
+        if (reductions_only) return;
+        if (glr->num_shifts == glr->cap_shifts) {
+            glr->cap_shifts *= 2;
+            glr->shifts = (Shift*)realloc(glr->shifts, glr->cap_shifts * sizeof(Shift));
+        }
+        glr->shifts[glr->num_shifts].vertex = vertex;
+        glr->shifts[glr->num_shifts].state = action;
+        glr->num_shifts++;
+    } else if (action < 0 && -action - 1 < glr->grammar->num_rules) {
+        int rule = -action - 1;
+        // A path through a new edge has at least one symbol
+        if (reductions_only && glr->grammar->rules[rule].rhs_len == 0) return;
+        queue_reduction(glr, vertex, rule, first, needed);
+    }
+}
+
+// Queue every action of a top; with 'reductions_only', only the reductions
+// whose paths may use a new edge ('first' or 'needed')
+static void queue_actions(GlrParser* glr, GssVertex* vertex, GssEdge* first, GssEdge* needed,
+                          int reductions_only) {
+    Table* table = glr->table;
+    if (glr->symbol == LEX_ERROR) return;
+    int action = table_action(table, vertex->state, glr->symbol);
+    if (action == ACTION_ERROR) return;
+    queue_action(glr, vertex, action, first, needed, reductions_only);
+    int index;
+    int count = conflict_range(table, vertex->state, glr->symbol, &index);
+    for (int i = 0; i < count; i++) {
+        queue_action(glr, vertex, table->conflicts->items[index + i].action, first, needed,
+                     reductions_only);
+    }
+}
+
+// Forest node of (symbol, start) ending at the current position
+static ForestNode* forest_node(GlrParser* glr, int symbol, int start) {
+    unsigned hash = ((unsigned)symbol * 2654435761u) ^ ((unsigned)start * 40503u);
+    int i = (int)(hash & (unsigned)glr->slot_mask);
+    while (glr->slots[i].stamp == glr->stamp) {
+        ForestNode* node = glr->slots[i].node;
+        if (node->symbol == symbol && node->start == start) return node;
+        i = (i + 1) & glr->slot_mask;
+    }
+
+    ForestNode* node = (ForestNode*)arena_alloc(glr->arena, sizeof(ForestNode));
+    node->symbol = symbol;
+    node->start = start;
+    node->end = glr->level;
+    node->offset = glr->starts[start];
+    node->length = start < glr->level ? glr->ends[glr->level - 1] - node->offset : 0;
+    node->alts = NULL;
+    node->mark = 0;
+    glr->slots[i].stamp = glr->stamp;
+    glr->slots[i].node = node;
+
+    // Keep the table at most half full (only this position's nodes move)
+    if (++glr->slot_count * 2 > glr->slot_mask + 1) {
+        ForestSlot* old = glr->slots;
+        int old_size = glr->slot_mask + 1;
+        glr->slot_mask = old_size * 2 - 1;
+        glr->slots = (ForestSlot*)calloc(old_size * 2, sizeof(ForestSlot));
+        for (int k = 0; k < old_size; k++) {
+            if (old[k].stamp != glr->stamp) continue;
+            ForestNode* moved = old[k].node;
+            unsigned h = ((unsigned)moved->symbol * 2654435761u) ^ ((unsigned)moved->start * 40503u);
+            int j = (int)(h & (unsigned)glr->slot_mask);
+            while (glr->slots[j].stamp == glr->stamp) j = (j + 1) & glr->slot_mask;
+            glr->slots[j] = old[k];
+        }
+        free(old);
+    }
+    return node;
+}
+
+// Add the derivation (rule, children) to a node unless it is already there
+static void add_alternative(GlrParser* glr, ForestNode* node, int rule, ForestNode** children, int count) {
+    for (ForestAlt* alt = node->alts; alt; alt = alt->next) {
+        if (alt->rule == rule && memcmp(alt->children, children, count * sizeof(ForestNode*)) == 0) {
+            return;
+        }
+    }
+    ForestAlt* alt = (ForestAlt*)arena_alloc(glr->arena, sizeof(ForestAlt));
+    alt->rule = rule;
+    alt->count = count;
+    alt->children = NULL;
+    if (count > 0) {
+        alt->children = (ForestNode**)arena_alloc(glr->arena, count * sizeof(ForestNode*));
+        memcpy(alt->children, children, count * sizeof(ForestNode*));
+    }
+    alt->next = node->alts;
+    node->alts = alt;
+}
+
+// Reduce by 'rule' along one path whose bottom vertex is 'bottom'
+static void reduce_path(GlrParser* glr, int rule, GssVertex* bottom) {
+    Rule* r = &glr->grammar->rules[rule];
+    int target = table_action(glr->table, bottom->state, r->lhs);
+    if (target <= 0 || target >= glr->table->num_states) return;
+
+    ForestNode* node = forest_node(glr, r->lhs, bottom->level);
+    add_alternative(glr, node, rule, glr->path, r->rhs_len);
+
+    GssVertex* top = find_top(glr, target);
+    if (!top) {
+        top = add_top(glr, target);
+        add_edge(glr, top, bottom, node);
+        queue_actions(glr, top, NULL, NULL, 0);
+        return;
+    }
+
+    for (GssEdge* edge = top->edges; edge; edge = edge->next) {
+        if (edge->to == bottom && edge->label == node) return;
+    }
+    GssEdge* edge = add_edge(glr, top, bottom, node);
+
+    // Reductions already done may have more paths through the new edge:
+    // from 'top' itself, or, once empty edges link tops, from any top
+    if (!glr->epsilon_edges) {
+        queue_actions(glr, top, edge, NULL, 1);
+    } else {
+        for (int i = 0; i < glr->num_tops; i++) {
+            queue_actions(glr, glr->tops[i], NULL, edge, 1);
+        }
+    }
+}
+
+// Walk the paths of 'remaining' more edges below 'vertex' (RHS filled
+// from the right), then reduce along each
+static void walk_paths(GlrParser* glr, Reduction* reduction, GssVertex* vertex, int remaining,
+                       int used) {
+    if (remaining == 0) {
+        if (!reduction->needed || used) reduce_path(glr, reduction->rule, vertex);
+        return;
+    }
+    int depth = glr->grammar->rules[reduction->rule].rhs_len - remaining;
+    for (GssEdge* edge = vertex->edges; edge; edge = edge->next) {
+        if (depth == 0 && reduction->first && edge != reduction->first) continue;
+        glr->path[remaining - 1] = edge->label;
+        walk_paths(glr, reduction, edge->to, remaining - 1, used || edge == reduction->needed);
+    }
+}
+
+// Grow the per-position token spans so that 'level' fits
+static void reserve_levels(GlrParser* glr, int level) {
+    if (level < glr->cap_levels) return;
+    while (level >= glr->cap_levels) glr->cap_levels *= 2;
+    glr->starts = (int*)realloc(glr->starts, glr->cap_levels * sizeof(int));
+    glr->ends = (int*)realloc(glr->ends, glr->cap_levels * sizeof(int));
+}
+
+// Parse input[0..input_len) with every action of conflict cells; the GSS
+// and the forest are allocated in 'arena'. Returns 1 = accept, 0 = reject.
+int parse_glr(GlrParser* glr, const char* input, int input_len, NodeArena* arena, GlrResult* result) {
+    const Lexer* lexer = glr->grammar->lexer;
+    glr->arena = arena;
+    glr->level = 0;
+    glr->stamp++;
+    glr->num_tops = 0;
+    glr->slot_count = 0;
+    glr->accept = NULL;
+    result->accepted = 0;
+    result->error_pos = -1;
+    result->root = NULL;
+    result->max_tops = 1;
+
+    add_top(glr, 0);
+    int pos = 0;
+
+    while (1) {
+        // Lookahead at this position: a byte, or a token with a lexer
+        int start;
+        int end;
+        if (lexer) {
+            glr->symbol = lex_scan(lexer, input, input_len, pos, &start, &end, 0);
+        } else if (pos < input_len) {
+            start = pos;
+            end = pos + 1;
+            glr->symbol = (unsigned char)input[pos];
+        } else {
+            start = end = pos;
+            glr->symbol = '$';
+        }
+        reserve_levels(glr, glr->level);
+        glr->starts[glr->level] = start;
+        glr->ends[glr->level] = end;
+
+        // Reducer: every top's actions, then whatever the reductions add
+        glr->num_shifts = 0;
+        glr->num_reductions = 0;
+        glr->epsilon_edges = 0;
+        for (int i = 0; i < glr->num_tops; i++) {
+            queue_actions(glr, glr->tops[i], NULL, NULL, 0);
+        }
+        while (glr->num_reductions > 0) {
+            Reduction reduction = glr->reductions[--glr->num_reductions];
+            walk_paths(glr, &reduction, reduction.vertex,
+                       glr->grammar->rules[reduction.rule].rhs_len, 0);
+        }
+        if (glr->num_tops > result->max_tops) result->max_tops = glr->num_tops;
+
+        if (glr->symbol == '$' && glr->accept) {
+            for (GssEdge* edge = glr->accept->edges; edge; edge = edge->next) {
+                if (edge->to->level == 0 && edge->to->state == 0) result->root = edge->label;
+            }
+            result->accepted = 1;
+            return 1;
+        }
+        if (glr->num_shifts == 0 || glr->symbol == '$') {
+            result->error_pos = start;
+            return 0;
+        }
+
+        // Shifter: one leaf per position, shared by every stack
+        ForestNode* leaf = (ForestNode*)arena_alloc(arena, sizeof(ForestNode));
+        leaf->symbol = (Symbol)glr->symbol;
+        leaf->start = glr->level;
+        leaf->end = glr->level + 1;
+        leaf->offset = start;
+        leaf->length = end - start;
+        leaf->alts = NULL;
+        leaf->mark = 0;
+
+        glr->level++;
+        glr->stamp++;
+        glr->num_tops = 0;
+        glr->slot_count = 0;
+        for (int i = 0; i < glr->num_shifts; i++) {
+            Shift* shift = &glr->shifts[i];
+            GssVertex* top = find_top(glr, shift->state);
+            if (!top) top = add_top(glr, shift->state);
+            int known = 0;
+            for (GssEdge* edge = top->edges; edge; edge = edge->next) {
+                if (edge->to == shift->vertex) known = 1;
+            }
+            if (!known) add_edge(glr, top, shift->vertex, leaf);
+        }
+        pos = end;
+    }
+}
+
+// Number the nodes below 'root' in post-order (mark = number, from 1).
+// Returns the node count; the nodes are in (*order)[0..count), which the
+// caller frees. Sets *cyclic if some node derives itself.
+static int number_forest(ForestNode* root, ForestNode*** order, int* cyclic) {
+    typedef struct {
+        ForestNode* node;
+        ForestAlt* alt;
+        int child;
+    } Frame;
+
+    int capacity = 64;
+    int count = 0;
+    *order = (ForestNode**)malloc(capacity * sizeof(ForestNode*));
+    *cyclic = 0;
+    int frames_cap = 64;
+    int top = 0;
+    Frame* frames = (Frame*)malloc(frames_cap * sizeof(Frame));
+    frames[0].node = root;
+    frames[0].alt = root->alts;
+    frames[0].child = 0;
+    root->mark = -1;  // On the walk
+
+    while (top >= 0) {
+        Frame* frame = &frames[top];
+        ForestAlt* alt = frame->alt;
+        if (alt && frame->child < alt->count) {
+            ForestNode* child = alt->children[frame->child++];
+            if (child->mark == -1) {
+                *cyclic = 1;
+            } else if (child->mark == 0) {
+                if (++top == frames_cap) {
+                    frames_cap *= 2;
+                    frames = (Frame*)realloc(frames, frames_cap * sizeof(Frame));
+                }
+                frames[top].node = child;
+                frames[top].alt = child->alts;
+                frames[top].child = 0;
+                child->mark = -1;
+            }
+            continue;
+        }
+        if (alt) {
+            frame->alt = alt->next;
+            frame->child = 0;
+            if (frame->alt) continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *order = (ForestNode**)realloc(*order, capacity * sizeof(ForestNode*));
+        }
+        (*order)[count++] = frame->node;
+        frame->node->mark = count;
+        top--;
+    }
+    free(frames);
+    return count;
+}
+
+static void clear_marks(ForestNode** order, int count) {
+    for (int i = 0; i < count; i++) order[i]->mark = 0;
+}
+
+// Derivations per node of 'order' (post-order), INFINITY if cyclic
+static double* count_derivations(ForestNode** order, int count, int cyclic) {
+    double* derivations = (double*)malloc((count > 0 ? count : 1) * sizeof(double));
+    for (int i = 0; i < count; i++) {
+        ForestNode* node = order[i];
+        if (cyclic) {
+            derivations[i] = node->alts ? INFINITY : 1;
+            continue;
+        }
+        if (!node->alts) {
+            derivations[i] = 1;
+            continue;
+        }
+        double total = 0;
+        for (ForestAlt* alt = node->alts; alt; alt = alt->next) {
+            double product = 1;
+            for (int c = 0; c < alt->count; c++) product *= derivations[alt->children[c]->mark - 1];
+            total += product;
+        }
+        derivations[i] = total;
+    }
+    return derivations;
+}
+
+// Number of parse trees in the forest (INFINITY if it has a cycle)
+double forest_derivations(ForestNode* root) {
+    if (!root) return 0;
+    ForestNode** order;
+    int cyclic;
+    int count = number_forest(root, &order, &cyclic);
+    double* derivations = count_derivations(order, count, cyclic);
+    double total = derivations[count - 1];
+    clear_marks(order, count);
+    free(derivations);
+    free(order);
+    return total;
+}
+
+// Print the forest, one line per non-terminal node in post-order:
+// n<id> <symbol> <start>:<end> = r<rule>(<children>) | ...
+void print_forest(ForestNode* root, Grammar* grammar, FILE* out) {
+    if (!root) {
+        fprintf(out, "Forest: empty\n");
+        return;
+    }
+    ForestNode** order;
+    int cyclic;
+    int count = number_forest(root, &order, &cyclic);
+    double* derivations = count_derivations(order, count, cyclic);
+    int ambiguous = 0;
+    for (int i = 0; i < count; i++) {
+        if (order[i]->alts && order[i]->alts->next) ambiguous++;
+    }
+    fprintf(out, "Forest: %d nodes, %d ambiguous, %.0f derivations\n", count, ambiguous,
+            derivations[count - 1]);
+
+    for (int i = 0; i < count; i++) {
+        ForestNode* node = order[i];
+        if (!IS_NONTERMINAL(node->symbol)) continue;
+        fprintf(out, "n%d ", node->mark);
+        write_symbol(out, grammar, node->symbol, 1);
+        fprintf(out, " %d:%d =", node->start, node->end);
+        for (ForestAlt* alt = node->alts; alt; alt = alt->next) {
+            fprintf(out, "%s r%d(", alt == node->alts ? "" : " |", alt->rule + 1);
+            for (int c = 0; c < alt->count; c++) {
+                ForestNode* child = alt->children[c];
+                if (c > 0) fputc(' ', out);
+                if (IS_NONTERMINAL(child->symbol)) fprintf(out, "n%d", child->mark);
+                else fprintf(out, "'%c'", child->symbol);
+            }
+            fputc(')', out);
+        }
+        fputc('\n', out);
+    }
+    clear_marks(order, count);
+    free(derivations);
+    free(order);
+}
+
+// One parse tree of the forest: each node takes its first alternative
+// that does not lead back to itself. Subtrees may be shared.
+Node* forest_tree(ForestNode* root, NodeArena* arena) {
+    if (!root) return NULL;
+    ForestNode** order;
+    int cyclic;
+    int count = number_forest(root, &order, &cyclic);
+    Node** trees = (Node**)calloc(count, sizeof(Node*));
+
+    // Children come before their parents in post-order, except on cycles
+    for (int i = 0; i < count; i++) {
+        ForestNode* node = order[i];
+        if (!node->alts) {
+            Node* leaf = arena_node(arena, node->symbol);
+            leaf->offset = node->offset;
+            leaf->length = node->length;
+            trees[i] = leaf;
+            continue;
+        }
+        for (ForestAlt* alt = node->alts; alt && !trees[i]; alt = alt->next) {
+            int ready = 1;
+            for (int c = 0; c < alt->count && ready; c++) {
+                int index = alt->children[c]->mark - 1;
+                if (index >= i || !trees[index]) ready = 0;
+            }
+            if (!ready) continue;
+            Node* tree = arena_node(arena, node->symbol);
+            if (alt->count > 0) {
+                tree->children = arena_children(arena, alt->count);
+                for (int c = 0; c < alt->count; c++) {
+                    tree->children[c] = trees[alt->children[c]->mark - 1];
+                }
+                tree->num_children = alt->count;
+            }
+            trees[i] = tree;
+        }
+    }
+    Node* tree = trees[count - 1];
+    clear_marks(order, count);
+    free(trees);
+    free(order);
+    return tree;
+}
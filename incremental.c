@@ -0,0 +1,428 @@
+#include <limits.h>
+#include "structs.h"
+
+// Incremental parsing. In a tree built by parse_incremental, every node
+// records the state it was pushed on (Node.state) and its span as a
+// padding and a length: Node.offset is the distance from the end of the
+// previous token to the node's first token, and Node.length runs from that
+// token to the end of the node's last one (0 and 0 for an empty node).
+// Neither depends on where the node sits in the document, so after an
+// edit a subtree of the old tree can go into the new tree as it is.
+//
+// The parse walks the old tree alongside the new text. At each token
+// boundary, the outermost old subtree starting there is shifted as one
+// unit when no edit touches its bytes, its padding or the lookahead read
+// after it, and the state it was pushed on is on top of the stack. When
+// either check fails, its children are tried; when no subtree fits, one
+// token is parsed. The lexer is assumed to read no further past a token
+// than the scan of the next token does.
+
+// Function prototypes from other modules
+int reduce_rule(Grammar* grammar, Table* table, Stack* stack, NodeArena* arena,
+                int rule_num, int trace);
+Node* arena_node(NodeArena* arena, int symbol);
+NodeArena* create_arena(size_t slab_size);
+void free_arena(NodeArena* arena);
+Stack* create_stack(int initial_capacity);
+int push(Stack* stack, int state, Node* node);
+int peek_state(Stack* stack);
+void free_stack(Stack* stack);
+int lex_scan(const Lexer* lexer, const char* input, int len, int pos,
+             int* start, int* end, int partial);
+int lex_reach(const Lexer* lexer, const char* input, int len, int start);
+int outbuf_write(OutBuf* out, const char* data, size_t len);
+int write_padded_tree(Node* root, const Grammar* grammar, int format, OutBuf* out, FILE* sink);
+const char* lr_strerror(int code);
+
+// Old subtree not yet reused or opened, with the old position where its
+// padding starts
+typedef struct {
+    Node* node;
+    long start;
+} PendingTree;
+
+// Old subtrees in document order (the next one on top)
+typedef struct {
+    PendingTree* items;
+    int count;
+    int capacity;
+} ReuseCursor;
+
+// Edits and the shift each one adds: delta[i] is the length change made
+// by the edits before edits[i]
+typedef struct {
+    const TextEdit* edits;
+    int count;
+    long* delta;
+} EditMap;
+
+// Bytes a subtree covers, its padding included
+static inline long tree_size(const Node* node) {
+    return node->offset + node->length;
+}
+
+// Add a subtree to try. Out of memory, it is left out: its text is then
+// parsed again instead of reused.
+static void cursor_push(ReuseCursor* cursor, Node* node, long start) {
+    if (cursor->count == cursor->capacity) {
+        int capacity = cursor->capacity ? cursor->capacity * 2 : 64;
+        PendingTree* items = (PendingTree*)realloc(cursor->items, capacity * sizeof(PendingTree));
+        if (!items) return;
+        cursor->items = items;
+        cursor->capacity = capacity;
+    }
+    cursor->items[cursor->count].node = node;
+    cursor->items[cursor->count].start = start;
+    cursor->count++;
+}
+
+// Replace the next subtree by its children
+static void cursor_open(ReuseCursor* cursor) {
+    PendingTree next = cursor->items[--cursor->count];
+    long end = next.start + tree_size(next.node);
+    for (int i = next.node->num_children - 1; i >= 0; i--) {
+        Node* child = next.node->children[i];
+        end -= tree_size(child);
+        cursor_push(cursor, child, end);
+    }
+}
+
+// Drop the old subtrees that end before 'old_pos' and open the ones that
+// straddle it. Returns the next subtree if it is not empty and its padding
+// starts at 'old_pos', NULL otherwise.
+static PendingTree* cursor_at(ReuseCursor* cursor, long old_pos) {
+    while (cursor->count > 0) {
+        PendingTree* next = &cursor->items[cursor->count - 1];
+        long end = next->start + tree_size(next->node);
+        if (next->start > old_pos) return NULL;
+        if (end == next->start || end <= old_pos) {
+            cursor->count--;        // Empty, or already passed
+        } else if (next->start == old_pos) {
+            return next;
+        } else {
+            cursor_open(cursor);
+        }
+    }
+    return NULL;
+}
+
+// Returns 0 if out of memory
+static int edit_map_init(EditMap* map, const TextEdit* edits, int count) {
+    map->edits = edits;
+    map->count = count;
+    map->delta = (long*)malloc((count + 1) * sizeof(long));
+    if (!map->delta) return 0;
+    map->delta[0] = 0;
+    for (int i = 0; i < count; i++) {
+        map->delta[i + 1] = map->delta[i] + edits[i].inserted - edits[i].removed;
+    }
+    return 1;
+}
+
+// Old position of new position 'pos', or -1 inside inserted text
+static long old_position(const EditMap* map, long pos) {
+    // Last edit whose new text starts at or before pos
+    int lo = 0;
+    int hi = map->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (map->edits[mid].offset + map->delta[mid] <= pos) lo = mid + 1; else hi = mid;
+    }
+    if (lo == 0) return pos;
+    const TextEdit* edit = &map->edits[lo - 1];
+    long new_start = edit->offset + map->delta[lo - 1];
+    if (pos < new_start + edit->inserted) return -1;
+    return pos - map->delta[lo];
+}
+
+// 1 if an edit touches the old bytes [lo, hi] (ends included, so text
+// inserted right before or after the range counts)
+static int edits_touch(const EditMap* map, long lo, long hi) {
+    // First edit that does not end before lo
+    int first = 0;
+    int last = map->count;
+    while (first < last) {
+        int mid = (first + last) / 2;
+        if (map->edits[mid].offset + map->edits[mid].removed < lo) first = mid + 1; else last = mid;
+    }
+    return first < map->count && map->edits[first].offset <= hi;
+}
+
+// End of the input read to find the lookahead after position 'pos'
+static int lookahead_reach(const Lexer* lexer, const char* input, int input_len, int pos) {
+    if (!lexer) return pos + 1;
+    int start, end;
+    lex_scan(lexer, input, input_len, pos, &start, &end, 0);
+    if (start >= input_len) return input_len;
+    int reach = lex_reach(lexer, input, input_len, start);
+    return reach > end ? reach : end;
+}
+
+// Set the state and span of the node a reduction pushed, and of the unit
+// chain nodes wrapped around it
+static void finish_node(Stack* stack, const Rule* rule) {
+    Node* top = stack->elements[stack->top].node;
+    int below = stack->elements[stack->top - 1].state;
+    Node* node = top;
+    while (node->symbol != rule->lhs) node = node->children[0];
+
+    long padding = 0;
+    long size = 0;
+    for (int i = 0; i < node->num_children; i++) {
+        Node* child = node->children[i];
+        if (size == 0) padding = child->offset;
+        size += tree_size(child);
+    }
+    for (Node* n = top;; n = n->children[0]) {
+        n->state = below;
+        n->offset = padding;
+        n->length = (int)(size - padding);
+        if (n == node) break;
+    }
+}
+
+// Reduce by 'rule' and record the new node's state and span; returns the
+// reduce_rule error code (< 0) if it fails
+static int reduce(Grammar* grammar, Table* table, Stack* stack, NodeArena* arena, int rule) {
+    int state = peek_state(stack);
+    (void)state;    // Only read by the -S counters
+    int goto_state = reduce_rule(grammar, table, stack, arena, rule, 0);
+    if (goto_state < 0) return goto_state;
+    STAT_REDUCE(state, rule, stack->top);
+    finish_node(stack, &grammar->rules[rule]);
+    return 0;
+}
+
+// Shift the old subtree 'tree' whole if it fits at new position 'pos'.
+// Reductions its first token triggers are done first either way. Returns 1
+// if it was shifted, 0 if not, -1 on a table error, -2 if out of memory.
+static int reuse_tree(Grammar* grammar, Table* table, const char* input, int input_len,
+                      const EditMap* map, PendingTree* tree, int pos, Stack* stack, NodeArena* arena) {
+    Node* node = tree->node;
+    long new_end = pos + tree_size(node);
+    long old_end = tree->start + tree_size(node);
+    if (new_end > input_len || edits_touch(map, tree->start, old_end)) return 0;
+    if (edits_touch(map, tree->start, LONG_MAX)) {
+        // An edit follows: it must not reach the lookahead either
+        int reach = lookahead_reach(grammar->lexer, input, input_len, (int)new_end);
+        if (edits_touch(map, tree->start, old_end + (reach - new_end))) return 0;
+    }
+
+    // The first token is unchanged: reduce on it as the lookahead. It is
+    // scanned again rather than found down the subtree's left spine.
+    int first = (unsigned char)input[pos];
+    if (grammar->lexer) {
+        int start, end;
+        first = lex_scan(grammar->lexer, input, input_len, pos, &start, &end, 0);
+    }
+    while (1) {
+        int state = peek_state(stack);
+        int action = table->default_reduce[state];
+        if (action == ACTION_ERROR && first != LEX_ERROR) action = table_action(table, state, first);
+        if (action >= 0 || action == ACTION_ACCEPT) break;
+        int status = reduce(grammar, table, stack, arena, -action - 1);
+        if (status < 0) return status;
+    }
+
+    int state = peek_state(stack);
+    if (state != node->state) return 0;
+    int target = table_action(table, state, node->symbol);
+    if (target <= 0) return 0;
+    if (!push(stack, target, node)) return -2;
+    STAT_SHIFT(state, stack->top);
+    STAT_ADD(reused, 1);
+    return 1;
+}
+
+// Parse input[0..input_len), reusing the subtrees of 'old_tree' (a tree of
+// parse_incremental for the text before 'edits', or NULL for a full parse).
+// The new tree is built in 'arena' and shares the reused subtrees, which
+// are not modified: the old tree stays valid. Returns 1 on accept, 0 on
+// reject, -1 on a table error, -2 if out of memory, like parse_input.
+int parse_incremental(Grammar* grammar, Table* table, const char* input, int input_len,
+                      Node* old_tree, const TextEdit* edits, int num_edits,
+                      Stack* stack, NodeArena* arena, ParseResult* result) {
+    stack->top = -1;
+    result->accepted = 0;
+    result->error_pos = -1;
+    result->tree = NULL;
+    EditMap map;
+    if (!push(stack, 0, NULL) || !edit_map_init(&map, edits, num_edits)) return -2;
+    STAT_ADD(inputs, 1);
+
+    ReuseCursor cursor = { NULL, 0, 0 };
+    if (old_tree) cursor_push(&cursor, old_tree, 0);
+
+    int pos = 0;        // End of the last token shifted
+    int status = 0;
+    while (1) {
+        // Take the next old subtree whole if one fits here
+        long old_pos = cursor.count > 0 ? old_position(&map, pos) : -1;
+        PendingTree* tree = old_pos >= 0 ? cursor_at(&cursor, old_pos) : NULL;
+        int reused = 0;
+        while (tree) {
+            reused = reuse_tree(grammar, table, input, input_len, &map, tree, pos, stack, arena);
+            if (reused != 0) break;
+            cursor_open(&cursor);
+            tree = cursor_at(&cursor, old_pos);
+        }
+        if (reused < 0) {
+            status = reused;
+            result->error_pos = pos;
+            break;
+        }
+        if (reused) {
+            pos += (int)tree_size(tree->node);
+            cursor.count--;
+            continue;
+        }
+
+        // Otherwise parse one token
+        int start = pos;
+        int end = pos + 1;
+        int symbol;
+        if (grammar->lexer) {
+            symbol = lex_scan(grammar->lexer, input, input_len, pos, &start, &end, 0);
+        } else {
+            symbol = pos < input_len ? (unsigned char)input[pos] : '$';
+            if (pos >= input_len) end = pos;
+        }
+        int done = 0;
+        while (!done) {
+            int state = peek_state(stack);
+            int action = table->default_reduce[state];
+            if (action == ACTION_ERROR && symbol != LEX_ERROR) {
+                action = table_action(table, state, symbol);
+            }
+            if (action == ACTION_ERROR) {
+                result->error_pos = start;
+                done = 1;
+            } else if (action == ACTION_ACCEPT) {
+                result->accepted = 1;
+                result->tree = stack->elements[stack->top].node;
+                status = 1;
+                done = 1;
+            } else if (action > 0) {
+                Node* leaf = arena_node(arena, symbol);
+                if (!leaf || !push(stack, action, leaf)) {
+                    result->error_pos = start;
+                    status = -2;
+                    done = 1;
+                    break;
+                }
+                leaf->state = state;
+                leaf->offset = start - pos;
+                leaf->length = end - start;
+                STAT_SHIFT(state, stack->top);
+                pos = end;
+                break;
+            } else {
+                int reduced = reduce(grammar, table, stack, arena, -action - 1);
+                if (reduced < 0) {
+                    result->error_pos = start;
+                    status = reduced;
+                    done = 1;
+                }
+            }
+        }
+        if (done) break;
+    }
+
+    free(cursor.items);
+    free(map.delta);
+    return status;
+}
+
+// Read a whole file into 'out'; returns 0 if it cannot be opened or read
+static int read_file(const char* path, OutBuf* out) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        return 0;
+    }
+    char chunk[64 * 1024];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        if (!outbuf_write(out, chunk, got)) {
+            fprintf(stderr, "Error: Out of memory reading %s\n", path);
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+// Parse 'old_path', then 'new_path' incrementally from its tree, with one
+// edit covering the bytes between their common prefix and suffix. Prints
+// the result of the second parse like -m; returns 1 on accept, 0 on
+// reject, -1 if a file cannot be read.
+int run_reparse(Grammar* grammar, Table* table, const char* old_path, const char* new_path,
+                int tree_format) {
+    OutBuf old_text = { NULL, 0, 0 };
+    OutBuf new_text = { NULL, 0, 0 };
+    if (!read_file(old_path, &old_text) || !read_file(new_path, &new_text)) {
+        free(old_text.data);
+        free(new_text.data);
+        return -1;
+    }
+    if (old_text.len > INT_MAX || new_text.len > INT_MAX) {
+        fprintf(stderr, "Error: Incremental parsing takes inputs up to 2 GiB\n");
+        free(old_text.data);
+        free(new_text.data);
+        return -1;
+    }
+
+    TextEdit edit = { 0, 0, 0 };
+    size_t shorter = old_text.len < new_text.len ? old_text.len : new_text.len;
+    while ((size_t)edit.offset < shorter && old_text.data[edit.offset] == new_text.data[edit.offset]) {
+        edit.offset++;
+    }
+    size_t suffix = 0;
+    while (suffix < shorter - edit.offset &&
+           old_text.data[old_text.len - 1 - suffix] == new_text.data[new_text.len - 1 - suffix]) {
+        suffix++;
+    }
+    edit.removed = (long)(old_text.len - suffix) - edit.offset;
+    edit.inserted = (long)(new_text.len - suffix) - edit.offset;
+
+    NodeArena* arena = create_arena(1024 * 1024);
+    Stack* stack = create_stack(1024);
+    ParseResult old_result;
+    ParseResult result = { 0, -1, NULL };
+    int status = parse_incremental(grammar, table, old_text.data, (int)old_text.len, NULL,
+                                   NULL, 0, stack, arena, &old_result);
+    if (status != 1) {
+        fprintf(stderr, "Warning: %s is rejected; %s is parsed in full\n", old_path, new_path);
+        old_result.tree = NULL;
+    }
+
+    STAT_TIME_BEGIN(parse_start);
+    int num_edits = edit.removed > 0 || edit.inserted > 0;
+    status = parse_incremental(grammar, table, new_text.data, (int)new_text.len, old_result.tree,
+                               &edit, num_edits, stack, arena, &result);
+    STAT_TIME_END(parse_start, PHASE_PARSE);
+    if (status < 0) fprintf(stderr, "Error: %s\n", lr_strerror(status));
+
+    STAT_TIME_BEGIN(output_start);
+    if (status == 1) {
+        printf("ACCEPT");
+        if (tree_format) {
+            printf("\t");
+            OutBuf out = { NULL, 0, 0 };
+            write_padded_tree(result.tree, grammar, tree_format, &out, stdout);
+            free(out.data);
+        } else {
+            printf("\n");
+        }
+    } else {
+        printf("REJECT\t%ld\n", result.error_pos);
+    }
+    STAT_TIME_END(output_start, PHASE_OUTPUT);
+
+    free_stack(stack);
+    free_arena(arena);
+    free(old_text.data);
+    free(new_text.data);
+    return status == 1;
+}
@@ -0,0 +1,717 @@
+#include <stdint.h>
+#include "structs.h"
+
+// Function prototypes from other modules
+void add_conflict(Table* table, int state, int symbol, int action);
+void write_symbol(FILE* out, const Grammar* grammar, int symbol, int lhs);
+int conflict_range(const Table* table, int state, int symbol, int* first);
+void free_conflicts(Conflicts* conflicts);
+
+// LALR(1) table generator.
+//
+// 1. Build the canonical LR(0) item sets of the augmented grammar S' -> S.
+// 2. Compute LALR(1) lookaheads for every kernel item by spontaneous
+//    generation and propagation (LR(1) closure with a dummy lookahead '#').
+// 3. Fill the action/goto table; conflicts are reported and resolved the
+//    yacc way (shift over reduce, lower rule number over higher). The
+//    other actions of a conflict cell are kept in table->conflicts (GLR).
+// 4. Merge states whose rows are equivalent (Moore-style partition
+//    refinement), so equivalent states share one row. States with a
+//    conflict cell are never merged.
+
+#define LA_DUMMY 0               // Bit used for the '#' propagation marker
+
+// Set of terminals (lookaheads and FIRST sets)
+typedef struct {
+    uint64_t bits[TERMSET_WORDS];
+} SymSet;
+
+static int set_add(SymSet* dst, const SymSet* src) {
+    int changed = 0;
+    for (int i = 0; i < TERMSET_WORDS; i++) {
+        uint64_t merged = dst->bits[i] | src->bits[i];
+        if (merged != dst->bits[i]) {
+            dst->bits[i] = merged;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+static int set_has(const SymSet* set, int sym) {
+    return (set->bits[sym >> 6] >> (sym & 63)) & 1;
+}
+
+static void set_put(SymSet* set, int sym) {
+    set->bits[sym >> 6] |= (uint64_t)1 << (sym & 63);
+}
+
+// Sorted list of kernel items of one LR(0) state
+typedef struct {
+    int* items;
+    int count;
+    unsigned hash;
+} Kernel;
+
+typedef struct {
+    Grammar* grammar;
+    Rule* rules;            // Grammar rules plus the augmented rule (last)
+    int num_rules;
+    int aug_rule;
+    Symbol aug_rhs;         // Right-hand side of the augmented rule
+    int num_symbols;        // Grammar symbols plus the augmented start symbol
+
+    // Items: (rule, dot) numbered consecutively per rule
+    int* item_base;         // Item id of (rule, 0)
+    int* item_rule;
+    int* item_dot;
+    int num_items;
+
+    // Rules grouped by LHS symbol
+    int* rules_by_lhs;      // Rule indices sorted by LHS
+    int* lhs_start;         // rules_by_lhs[lhs_start[s]..lhs_start[s+1])
+
+    unsigned char* nullable;    // Per symbol
+    SymSet* first;
+
+    // LR(0) automaton
+    Kernel* kernels;
+    int num_states;
+    int cap_states;
+    int* trans;             // [state * num_symbols + symbol] -> target state, -1 if none
+    int* hash_heads;        // Kernel hash table (chained through hash_next)
+    int* hash_next;
+    int hash_size;
+
+    // Lookaheads per kernel item
+    int* kernel_base;       // Global index of a state's first kernel item
+    SymSet* la;
+    int* prop_from;         // Propagation edges between kernel items
+    int* prop_to;
+    int num_props;
+    int cap_props;
+
+    // Scratch for closures
+    int* closure;
+    int closure_len;
+    int* mark;
+    int stamp;
+    SymSet* closure_la;
+} Gen;
+
+static int next_symbol(Gen* gen, int item, int* symbol) {
+    Rule* rule = &gen->rules[gen->item_rule[item]];
+    int dot = gen->item_dot[item];
+    if (dot >= rule->rhs_len) return 0;
+    *symbol = rule->rhs[dot];
+    return 1;
+}
+
+// FIRST set of rhs[pos..] of a rule; returns 1 if that suffix is nullable
+static int first_of_suffix(Gen* gen, Rule* rule, int pos, SymSet* out) {
+    for (int i = pos; i < rule->rhs_len; i++) {
+        int sym = rule->rhs[i];
+        if (IS_TERMINAL(sym)) {
+            set_put(out, sym);
+            return 0;
+        }
+        set_add(out, &gen->first[sym]);
+        if (!gen->nullable[sym]) return 0;
+    }
+    return 1;
+}
+
+static void compute_first(Gen* gen) {
+    gen->nullable = (unsigned char*)calloc(gen->num_symbols, 1);
+    gen->first = (SymSet*)calloc(gen->num_symbols, sizeof(SymSet));
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int r = 0; r < gen->num_rules; r++) {
+            Rule* rule = &gen->rules[r];
+            int lhs = rule->lhs;
+            SymSet f;
+            memset(&f, 0, sizeof(f));
+            int nullable = first_of_suffix(gen, rule, 0, &f);
+            if (set_add(&gen->first[lhs], &f)) changed = 1;
+            if (nullable && !gen->nullable[lhs]) {
+                gen->nullable[lhs] = 1;
+                changed = 1;
+            }
+        }
+    }
+}
+
+// LR(0) closure of a state's kernel into gen->closure
+static void closure0(Gen* gen, Kernel* kernel) {
+    gen->stamp++;
+    gen->closure_len = 0;
+    for (int i = 0; i < kernel->count; i++) {
+        gen->mark[kernel->items[i]] = gen->stamp;
+        gen->closure[gen->closure_len++] = kernel->items[i];
+    }
+    for (int i = 0; i < gen->closure_len; i++) {
+        int sym;
+        if (!next_symbol(gen, gen->closure[i], &sym) || IS_TERMINAL(sym)) continue;
+        for (int k = gen->lhs_start[sym]; k < gen->lhs_start[sym + 1]; k++) {
+            int item = gen->item_base[gen->rules_by_lhs[k]];
+            if (gen->mark[item] != gen->stamp) {
+                gen->mark[item] = gen->stamp;
+                gen->closure[gen->closure_len++] = item;
+            }
+        }
+    }
+}
+
+static unsigned kernel_hash(int* items, int count) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        h = (h ^ (unsigned)items[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int cmp_int(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Find the state with this (sorted) kernel or create it
+static int find_or_add_state(Gen* gen, int* items, int count) {
+    unsigned h = kernel_hash(items, count);
+    for (int s = gen->hash_heads[h % gen->hash_size]; s >= 0; s = gen->hash_next[s]) {
+        Kernel* k = &gen->kernels[s];
+        if (k->hash == h && k->count == count && memcmp(k->items, items, count * sizeof(int)) == 0) {
+            return s;
+        }
+    }
+
+    if (gen->num_states == gen->cap_states) {
+        gen->cap_states *= 2;
+        gen->kernels = (Kernel*)realloc(gen->kernels, gen->cap_states * sizeof(Kernel));
+        gen->trans = (int*)realloc(gen->trans, (size_t)gen->cap_states * gen->num_symbols * sizeof(int));
+        gen->hash_next = (int*)realloc(gen->hash_next, gen->cap_states * sizeof(int));
+    }
+    int s = gen->num_states++;
+    Kernel* k = &gen->kernels[s];
+    k->items = (int*)malloc(count * sizeof(int));
+    memcpy(k->items, items, count * sizeof(int));
+    k->count = count;
+    k->hash = h;
+    for (int c = 0; c < gen->num_symbols; c++) gen->trans[(size_t)s * gen->num_symbols + c] = -1;
+    gen->hash_next[s] = gen->hash_heads[h % gen->hash_size];
+    gen->hash_heads[h % gen->hash_size] = s;
+    return s;
+}
+
+// Build the LR(0) automaton (states in discovery order, state 0 = start)
+static void build_lr0(Gen* gen) {
+    gen->cap_states = 64;
+    gen->kernels = (Kernel*)malloc(gen->cap_states * sizeof(Kernel));
+    gen->trans = (int*)malloc((size_t)gen->cap_states * gen->num_symbols * sizeof(int));
+    gen->hash_next = (int*)malloc(gen->cap_states * sizeof(int));
+    gen->hash_size = 4099;
+    gen->hash_heads = (int*)malloc(gen->hash_size * sizeof(int));
+    for (int i = 0; i < gen->hash_size; i++) gen->hash_heads[i] = -1;
+
+    int start = gen->item_base[gen->aug_rule];
+    find_or_add_state(gen, &start, 1);
+
+    int* next_kernel = (int*)malloc(gen->num_items * sizeof(int));
+    int* seen = (int*)calloc(gen->num_symbols, sizeof(int));
+    for (int s = 0; s < gen->num_states; s++) {
+        closure0(gen, &gen->kernels[s]);
+
+        // Group closure items by the symbol after the dot
+        for (int i = 0; i < gen->closure_len; i++) {
+            int sym;
+            if (!next_symbol(gen, gen->closure[i], &sym) || seen[sym] == s + 1) continue;
+            seen[sym] = s + 1;
+
+            int count = 0;
+            for (int j = i; j < gen->closure_len; j++) {
+                int other;
+                if (next_symbol(gen, gen->closure[j], &other) && other == sym) {
+                    next_kernel[count++] = gen->closure[j] + 1;
+                }
+            }
+            qsort(next_kernel, count, sizeof(int), cmp_int);
+            int target = find_or_add_state(gen, next_kernel, count);
+            gen->trans[(size_t)s * gen->num_symbols + sym] = target;
+        }
+    }
+    free(seen);
+    free(next_kernel);
+}
+
+// Global index of 'item' in the kernel of 'state'
+static int kernel_index(Gen* gen, int state, int item) {
+    Kernel* k = &gen->kernels[state];
+    int* hit = (int*)bsearch(&item, k->items, k->count, sizeof(int), cmp_int);
+    return gen->kernel_base[state] + (int)(hit - k->items);
+}
+
+// LR(1) closure seeded with the lookaheads already in gen->closure_la
+// for the items in gen->closure[0..closure_len)
+static void closure1(Gen* gen) {
+    int changed = 1;
+    while (changed) {
+        // Repeat until no lookahead set of an already present item grows
+        changed = 0;
+        for (int i = 0; i < gen->closure_len; i++) {
+            int item = gen->closure[i];
+            int sym;
+            if (!next_symbol(gen, item, &sym) || IS_TERMINAL(sym)) continue;
+
+            Rule* rule = &gen->rules[gen->item_rule[item]];
+            SymSet la;
+            memset(&la, 0, sizeof(la));
+            if (first_of_suffix(gen, rule, gen->item_dot[item] + 1, &la)) {
+                set_add(&la, &gen->closure_la[item]);
+            }
+
+            for (int k = gen->lhs_start[sym]; k < gen->lhs_start[sym + 1]; k++) {
+                int added = gen->item_base[gen->rules_by_lhs[k]];
+                if (gen->mark[added] != gen->stamp) {
+                    gen->mark[added] = gen->stamp;
+                    gen->closure_la[added] = la;
+                    gen->closure[gen->closure_len++] = added;
+                } else if (set_add(&gen->closure_la[added], &la)) {
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+static void add_propagation(Gen* gen, int from, int to) {
+    if (gen->num_props == gen->cap_props) {
+        gen->cap_props = gen->cap_props ? gen->cap_props * 2 : 256;
+        gen->prop_from = (int*)realloc(gen->prop_from, gen->cap_props * sizeof(int));
+        gen->prop_to = (int*)realloc(gen->prop_to, gen->cap_props * sizeof(int));
+    }
+    gen->prop_from[gen->num_props] = from;
+    gen->prop_to[gen->num_props] = to;
+    gen->num_props++;
+}
+
+// Compute LALR(1) lookaheads of every kernel item
+static void compute_lookaheads(Gen* gen) {
+    gen->kernel_base = (int*)malloc((gen->num_states + 1) * sizeof(int));
+    int total = 0;
+    for (int s = 0; s < gen->num_states; s++) {
+        gen->kernel_base[s] = total;
+        total += gen->kernels[s].count;
+    }
+    gen->kernel_base[gen->num_states] = total;
+    gen->la = (SymSet*)calloc(total, sizeof(SymSet));
+    set_put(&gen->la[0], '$');  // S' -> .S with lookahead $
+
+    for (int s = 0; s < gen->num_states; s++) {
+        Kernel* kernel = &gen->kernels[s];
+        for (int j = 0; j < kernel->count; j++) {
+            // LR(1) closure of the single kernel item with lookahead '#'
+            gen->stamp++;
+            gen->closure_len = 0;
+            int item = kernel->items[j];
+            gen->mark[item] = gen->stamp;
+            memset(&gen->closure_la[item], 0, sizeof(SymSet));
+            set_put(&gen->closure_la[item], LA_DUMMY);
+            gen->closure[gen->closure_len++] = item;
+            closure1(gen);
+
+            for (int i = 0; i < gen->closure_len; i++) {
+                int c = gen->closure[i];
+                int sym;
+                if (!next_symbol(gen, c, &sym)) continue;
+                int target = kernel_index(gen, gen->trans[(size_t)s * gen->num_symbols + sym], c + 1);
+                SymSet spontaneous = gen->closure_la[c];
+                if (set_has(&spontaneous, LA_DUMMY)) {
+                    add_propagation(gen, gen->kernel_base[s] + j, target);
+                    spontaneous.bits[0] &= ~(uint64_t)1;
+                }
+                set_add(&gen->la[target], &spontaneous);
+            }
+        }
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int p = 0; p < gen->num_props; p++) {
+            if (set_add(&gen->la[gen->prop_to[p]], &gen->la[gen->prop_from[p]])) changed = 1;
+        }
+    }
+}
+
+static void print_symbol(FILE* out, const Grammar* grammar, int sym) {
+    if (IS_NONTERMINAL(sym)) write_symbol(out, grammar, sym, 0);
+    else fprintf(out, "'%c'", sym);
+}
+
+// Set one action cell, resolving and reporting conflicts; the action that
+// loses is kept as a conflict action of the table
+static int set_action(Gen* gen, Table* table, int* row, int state, int sym, int action, int report) {
+    int old = row[sym];
+    if (old == ACTION_ERROR || old == action) {
+        row[sym] = action;
+        return 0;
+    }
+
+    int keep;
+    if (old == ACTION_ACCEPT || action == ACTION_ACCEPT) keep = ACTION_ACCEPT;
+    else if (old > 0) keep = old;          // Shift wins over reduce
+    else if (action > 0) keep = action;
+    else keep = old > action ? old : action;  // Lower rule number wins
+
+    if (report) {
+        const char* kind = (old > 0 || action > 0) ? "shift/reduce" : "reduce/reduce";
+        fprintf(stderr, "Conflict (%s) in state %d on ", kind, state);
+        print_symbol(stderr, gen->grammar, sym);
+        fprintf(stderr, ": ");
+        int actions[2] = { old, action };
+        for (int i = 0; i < 2; i++) {
+            int a = actions[i];
+            if (i) fprintf(stderr, " vs ");
+            if (a == ACTION_ACCEPT) fprintf(stderr, "accept");
+            else if (a > 0) fprintf(stderr, "shift %d", a);
+            else fprintf(stderr, "reduce %d", -a);
+        }
+        fprintf(stderr, ", using %s\n", keep > 0 ? "shift" : (keep == ACTION_ACCEPT ? "accept" : "reduce"));
+    }
+    row[sym] = keep;
+    add_conflict(table, state, sym, keep == old ? action : old);
+    return 1;
+}
+
+// Fill the dense table from the LALR(1) automaton; returns the conflict count
+static int fill_actions(Gen* gen, Table* table, int* data, int report) {
+    int conflicts = 0;
+    for (int s = 0; s < gen->num_states; s++) {
+        Kernel* kernel = &gen->kernels[s];
+        int* row = &data[(size_t)s * table->num_cols];
+
+        // LR(1) closure from all kernel items with their final lookaheads
+        gen->stamp++;
+        gen->closure_len = 0;
+        for (int j = 0; j < kernel->count; j++) {
+            int item = kernel->items[j];
+            gen->mark[item] = gen->stamp;
+            gen->closure_la[item] = gen->la[gen->kernel_base[s] + j];
+            gen->closure[gen->closure_len++] = item;
+        }
+        closure1(gen);
+
+        // Shifts and gotos
+        for (int sym = 0; sym < table->num_cols; sym++) {
+            int target = gen->trans[(size_t)s * gen->num_symbols + sym];
+            if (target >= 0) row[sym] = target;
+        }
+
+        // Reductions and accept
+        for (int i = 0; i < gen->closure_len; i++) {
+            int item = gen->closure[i];
+            int sym;
+            if (next_symbol(gen, item, &sym)) continue;
+            int r = gen->item_rule[item];
+            SymSet* la = &gen->closure_la[item];
+            for (int a = 1; a < NT_BASE; a++) {
+                if (!set_has(la, a)) continue;
+                if (r == gen->aug_rule && a != '$') continue;
+                int action = (r == gen->aug_rule) ? ACTION_ACCEPT : -(r + 1);
+                conflicts += set_action(gen, table, row, s, a, action, report);
+            }
+        }
+    }
+    return conflicts;
+}
+
+// Signature of a row under the current partition: targets become classes
+static void row_signature(int* row, int num_cols, int* cls, int* sig) {
+    for (int c = 0; c < num_cols; c++) {
+        int a = row[c];
+        sig[c] = (a > 0) ? INT32_MAX - cls[a] : a;
+    }
+}
+
+static int* sort_sig;       // Signatures used by cmp_state
+static int* sort_cls;
+static int sort_cols;
+
+static int cmp_state(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    if (sort_cls[x] != sort_cls[y]) return sort_cls[x] - sort_cls[y];
+    return memcmp(&sort_sig[(size_t)x * sort_cols], &sort_sig[(size_t)y * sort_cols],
+                  sort_cols * sizeof(int));
+}
+
+// Merge equivalent states; returns the new state count (table rewritten in
+// place, old state s becomes map[s]). States with conflict actions stay alone.
+static int minimize_states(int* data, int num_states, int num_cols, const Conflicts* conflicts,
+                           int* map) {
+    int* cls = (int*)calloc(num_states, sizeof(int));
+    int* next_cls = (int*)malloc(num_states * sizeof(int));
+    int* sig = (int*)malloc((size_t)num_states * num_cols * sizeof(int));
+    int* order = (int*)malloc(num_states * sizeof(int));
+    // The start state stays alone: target 0 would read as an error cell
+    for (int s = 1; s < num_states; s++) cls[s] = 1;
+    int num_classes = num_states > 1 ? 2 : 1;
+    for (int i = 0; conflicts && i < conflicts->count; i++) {
+        int s = (int)(conflicts->items[i].cell / num_cols);
+        if (s > 0 && cls[s] == 1) cls[s] = num_classes++;
+    }
+
+    while (1) {
+        for (int s = 0; s < num_states; s++) {
+            row_signature(&data[(size_t)s * num_cols], num_cols, cls, &sig[(size_t)s * num_cols]);
+            order[s] = s;
+        }
+        sort_sig = sig;
+        sort_cls = cls;
+        sort_cols = num_cols;
+        qsort(order, num_states, sizeof(int), cmp_state);
+
+        int count = 0;
+        for (int i = 0; i < num_states; i++) {
+            if (i > 0 && cmp_state(&order[i - 1], &order[i]) != 0) count++;
+            next_cls[order[i]] = count;
+        }
+        count++;
+        memcpy(cls, next_cls, num_states * sizeof(int));
+        if (count == num_classes) break;
+        num_classes = count;
+    }
+
+    // Number classes by first appearance so state 0 stays the start state
+    int* renum = (int*)malloc(num_classes * sizeof(int));
+    for (int c = 0; c < num_classes; c++) renum[c] = -1;
+    int next_id = 0;
+    for (int s = 0; s < num_states; s++) {
+        if (renum[cls[s]] < 0) {
+            int id = next_id++;
+            renum[cls[s]] = id;
+            // id <= s, so the row being overwritten was already visited
+            memmove(&data[(size_t)id * num_cols], &data[(size_t)s * num_cols], num_cols * sizeof(int));
+        }
+    }
+    for (int s = 0; s < next_id; s++) {
+        int* row = &data[(size_t)s * num_cols];
+        for (int c = 0; c < num_cols; c++) {
+            if (row[c] > 0) row[c] = renum[cls[row[c]]];
+        }
+    }
+    for (int s = 0; s < num_states; s++) {
+        map[s] = renum[cls[s]];
+    }
+
+    free(renum);
+    free(order);
+    free(sig);
+    free(next_cls);
+    free(cls);
+    return next_id;
+}
+
+static void free_gen(Gen* gen) {
+    for (int s = 0; s < gen->num_states; s++) free(gen->kernels[s].items);
+    free(gen->kernels);
+    free(gen->trans);
+    free(gen->hash_heads);
+    free(gen->hash_next);
+    free(gen->kernel_base);
+    free(gen->la);
+    free(gen->prop_from);
+    free(gen->prop_to);
+    free(gen->closure);
+    free(gen->mark);
+    free(gen->closure_la);
+    free(gen->item_base);
+    free(gen->item_rule);
+    free(gen->item_dot);
+    free(gen->rules_by_lhs);
+    free(gen->lhs_start);
+    free(gen->nullable);
+    free(gen->first);
+    free(gen->rules);
+}
+
+// Generate an LALR(1) table for 'grammar' into 'table' (dense layout).
+// Conflicts are reported on stderr when 'report' is set; report > 1 also
+// prints a summary of the state counts.
+// Returns the number of conflicts, or -1 if the grammar cannot be handled.
+int generate_table(Grammar* grammar, Table* table, int report) {
+    if (grammar->num_rules == 0) {
+        fprintf(stderr, "Error: Grammar has no rules\n");
+        return -1;
+    }
+    if (grammar->num_rules >= -ACTION_ACCEPT) {
+        fprintf(stderr, "Error: Too many rules for the action encoding (%d)\n", grammar->num_rules);
+        return -1;
+    }
+
+    Gen gen;
+    memset(&gen, 0, sizeof(gen));
+    gen.grammar = grammar;
+    gen.num_rules = grammar->num_rules + 1;
+    gen.aug_rule = grammar->num_rules;
+    gen.num_symbols = grammar->num_symbols + 1;
+    gen.rules = (Rule*)malloc(gen.num_rules * sizeof(Rule));
+    memcpy(gen.rules, grammar->rules, grammar->num_rules * sizeof(Rule));
+    // The augmented rule S' -> S, S' being the symbol after the grammar's
+    Rule* aug = &gen.rules[gen.aug_rule];
+    aug->lhs = (Symbol)grammar->num_symbols;
+    gen.aug_rhs = grammar->axiom;
+    aug->rhs = &gen.aug_rhs;
+    aug->rhs_len = 1;
+
+    // Number the items
+    gen.item_base = (int*)malloc(gen.num_rules * sizeof(int));
+    for (int r = 0; r < gen.num_rules; r++) {
+        gen.item_base[r] = gen.num_items;
+        gen.num_items += gen.rules[r].rhs_len + 1;
+    }
+    gen.item_rule = (int*)malloc(gen.num_items * sizeof(int));
+    gen.item_dot = (int*)malloc(gen.num_items * sizeof(int));
+    for (int r = 0; r < gen.num_rules; r++) {
+        for (int d = 0; d <= gen.rules[r].rhs_len; d++) {
+            gen.item_rule[gen.item_base[r] + d] = r;
+            gen.item_dot[gen.item_base[r] + d] = d;
+        }
+    }
+
+    // Group rules by LHS (counting sort keeps rule order within a group)
+    int* counts = (int*)calloc(gen.num_symbols + 1, sizeof(int));
+    for (int r = 0; r < gen.num_rules; r++) counts[gen.rules[r].lhs + 1]++;
+    for (int s = 0; s < gen.num_symbols; s++) counts[s + 1] += counts[s];
+    gen.lhs_start = (int*)malloc((gen.num_symbols + 1) * sizeof(int));
+    memcpy(gen.lhs_start, counts, (gen.num_symbols + 1) * sizeof(int));
+    gen.rules_by_lhs = (int*)malloc(gen.num_rules * sizeof(int));
+    for (int r = 0; r < gen.num_rules; r++) {
+        gen.rules_by_lhs[counts[gen.rules[r].lhs]++] = r;
+    }
+    free(counts);
+
+    // Every non-terminal used on a right-hand side needs a rule
+    for (int r = 0; r < grammar->num_rules; r++) {
+        for (int i = 0; i < gen.rules[r].rhs_len; i++) {
+            int sym = gen.rules[r].rhs[i];
+            if (IS_NONTERMINAL(sym) && gen.lhs_start[sym] == gen.lhs_start[sym + 1]) {
+                fprintf(stderr, "Error: Non-terminal ");
+                write_symbol(stderr, grammar, sym, 1);
+                fprintf(stderr, " has no rule\n");
+                free_gen(&gen);
+                return -1;
+            }
+        }
+    }
+
+    gen.closure = (int*)malloc(gen.num_items * sizeof(int));
+    gen.mark = (int*)calloc(gen.num_items, sizeof(int));
+    gen.closure_la = (SymSet*)calloc(gen.num_items, sizeof(SymSet));
+
+    compute_first(&gen);
+    build_lr0(&gen);
+    compute_lookaheads(&gen);
+
+    memset(table, 0, sizeof(Table));
+    table->num_cols = grammar->num_symbols;
+    int* data = (int*)calloc((size_t)gen.num_states * table->num_cols, sizeof(int));
+    int conflicts = fill_actions(&gen, table, data, report);
+    int lalr_states = gen.num_states;
+    int* map = (int*)malloc((lalr_states > 0 ? lalr_states : 1) * sizeof(int));
+    int num_states = minimize_states(data, lalr_states, table->num_cols, table->conflicts, map);
+
+    // Conflict actions follow the merged state numbers
+    for (int i = 0; table->conflicts && i < table->conflicts->count; i++) {
+        ConflictAction* item = &table->conflicts->items[i];
+        item->cell = (long)map[item->cell / table->num_cols] * table->num_cols + item->cell % table->num_cols;
+        if (item->action > 0) item->action = map[item->action];
+    }
+    free(map);
+
+    if (report > 1) {
+        fprintf(stderr, "LALR(1): %d states, %d after merging equivalent states, %d conflict%s\n",
+                lalr_states, num_states, conflicts, conflicts == 1 ? "" : "s");
+    }
+
+    table->data = (int*)realloc(data, (size_t)num_states * table->num_cols * sizeof(int));
+    table->num_states = num_states;
+    free_gen(&gen);
+    return conflicts;
+}
+
+// Write the grammar and table in the text format read by load_grammar_table
+void write_table_text(Grammar* grammar, Table* table, FILE* out) {
+    if (grammar->lexer && grammar->lexer->spec) {
+        fputs(grammar->lexer->spec, out);
+    }
+    if (!termset_empty(grammar->sync)) {
+        fputs("%sync", out);
+        for (int c = 0; c < NT_BASE; c++) {
+            if (TERMSET_HAS(grammar->sync, c)) fprintf(out, " %c", c);
+        }
+        fputc('\n', out);
+    }
+    for (int r = 0; r < grammar->num_rules; r++) {
+        Rule* rule = &grammar->rules[r];
+        write_symbol(out, grammar, rule->lhs, 1);
+        fputc(':', out);
+        for (int i = 0; i < rule->rhs_len; i++) {
+            write_symbol(out, grammar, rule->rhs[i], 0);
+        }
+        fputc('\n', out);
+    }
+
+    // Columns: terminals in byte order, then $, then non-terminals
+    int* columns = (int*)malloc(table->num_cols * sizeof(int));
+    int num_columns = 0;
+    char* used = (char*)calloc(table->num_cols, 1);
+    for (int s = 0; s < table->num_states; s++) {
+        for (int c = 0; c < table->num_cols; c++) {
+            if (table_action(table, s, c) != ACTION_ERROR) used[c] = 1;
+        }
+    }
+    for (int c = 1; c < NT_BASE; c++) {
+        if (used[c] && c != '$') columns[num_columns++] = c;
+        if (used[c] && c >= 'A' && c <= 'Z') {
+            fprintf(stderr, "Warning: Terminal '%c' will read back as a non-terminal column\n", c);
+        }
+    }
+    if (used['$']) columns[num_columns++] = '$';
+    for (int c = NT_BASE; c < table->num_cols; c++) {
+        if (used[c]) columns[num_columns++] = c;
+    }
+
+    for (int i = 0; i < num_columns; i++) {
+        fputc('\t', out);
+        write_symbol(out, grammar, columns[i], 1);
+    }
+    fputc('\n', out);
+
+    for (int s = 0; s < table->num_states; s++) {
+        fprintf(out, "%d", s);
+        for (int i = 0; i < num_columns; i++) {
+            int a = table_action(table, s, columns[i]);
+            fputc('\t', out);
+            if (a == ACTION_ERROR) continue;
+            int first = 0;
+            int extra = conflict_range(table, s, columns[i], &first);
+            // A conflict cell lists its other actions after a '/'
+            for (int k = -1; k < extra; k++) {
+                if (k >= 0) {
+                    a = table->conflicts->items[first + k].action;
+                    fputc('/', out);
+                }
+                if (a == ACTION_ACCEPT) fprintf(out, "a");
+                else if (a < 0) fprintf(out, "r%d", -a);
+                else if (IS_NONTERMINAL(columns[i])) fprintf(out, "%d", a);
+                else fprintf(out, "d%d", a);
+            }
+        }
+        fputc('\n', out);
+    }
+    free(used);
+    free(columns);
+}
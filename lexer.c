@@ -0,0 +1,476 @@
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "structs.h"
+
+// DFA lexer compiled from the %token / %skip lines of a grammar file.
+//
+// Each pattern is a small regular expression:
+//   abc  a|b  a*  a+  a?  (...)  [a-z_]  [^"]  .  \n \t \r \\ \x
+// Patterns are compiled to one Thompson NFA and then to a DFA by subset
+// construction. Scanning takes the longest match; on equal length the
+// pattern declared first wins. DFA states that loop on a few byte ranges
+// (whitespace, identifier and digit runs) are scanned 16 bytes at a time
+// with SSE2 when available.
+
+typedef struct {
+    uint64_t bits[4];
+} ByteSet;
+
+static void byteset_add(ByteSet* set, int c) {
+    set->bits[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static int byteset_has(const ByteSet* set, int c) {
+    return (set->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+// NFA state: either a byte-set edge to 'out' or up to two epsilon edges
+typedef struct {
+    ByteSet set;
+    int is_set;
+    int out;
+    int out2;
+    int accept;         // Pattern index accepted here (-1 = none)
+} NfaState;
+
+typedef struct {
+    NfaState* states;
+    int count;
+    int capacity;
+    const char* pattern;    // Pattern being parsed
+    const char* p;          // Parse position
+    const char* error;      // First parse error (NULL = none)
+} Nfa;
+
+// Sub-automaton with one entry and one (epsilon) exit state
+typedef struct {
+    int start;
+    int end;
+} Frag;
+
+static int nfa_state(Nfa* nfa) {
+    if (nfa->count == nfa->capacity) {
+        nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+        nfa->states = (NfaState*)realloc(nfa->states, nfa->capacity * sizeof(NfaState));
+    }
+    NfaState* s = &nfa->states[nfa->count];
+    memset(s, 0, sizeof(NfaState));
+    s->out = -1;
+    s->out2 = -1;
+    s->accept = -1;
+    return nfa->count++;
+}
+
+static Frag frag_set(Nfa* nfa, const ByteSet* set) {
+    int s = nfa_state(nfa);
+    int e = nfa_state(nfa);
+    nfa->states[s].set = *set;
+    nfa->states[s].is_set = 1;
+    nfa->states[s].out = e;
+    Frag f = { s, e };
+    return f;
+}
+
+static Frag frag_empty(Nfa* nfa) {
+    int s = nfa_state(nfa);
+    Frag f = { s, s };
+    return f;
+}
+
+// Parse one escaped byte after '\'
+static int parse_escape(Nfa* nfa) {
+    char c = *nfa->p;
+    if (!c) {
+        nfa->error = "trailing backslash";
+        return '\\';
+    }
+    nfa->p++;
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case '0': return '\0';
+        default: return (unsigned char)c;
+    }
+}
+
+// Parse a [...] class (the '[' is already consumed)
+static Frag parse_class(Nfa* nfa) {
+    ByteSet set;
+    memset(&set, 0, sizeof(set));
+    int negate = 0;
+    if (*nfa->p == '^') {
+        negate = 1;
+        nfa->p++;
+    }
+    int first = 1;
+    while (*nfa->p && (*nfa->p != ']' || first)) {
+        int lo = (unsigned char)*nfa->p++;
+        if (lo == '\\') lo = parse_escape(nfa);
+        int hi = lo;
+        if (nfa->p[0] == '-' && nfa->p[1] && nfa->p[1] != ']') {
+            nfa->p++;
+            hi = (unsigned char)*nfa->p++;
+            if (hi == '\\') hi = parse_escape(nfa);
+        }
+        for (int c = lo; c <= hi; c++) byteset_add(&set, c);
+        first = 0;
+    }
+    if (*nfa->p != ']') {
+        nfa->error = "unterminated [";
+    } else {
+        nfa->p++;
+    }
+    if (negate) {
+        for (int i = 0; i < 4; i++) set.bits[i] = ~set.bits[i];
+    }
+    return frag_set(nfa, &set);
+}
+
+static Frag parse_alt(Nfa* nfa);
+
+static Frag parse_atom(Nfa* nfa) {
+    ByteSet set;
+    memset(&set, 0, sizeof(set));
+    char c = *nfa->p++;
+
+    if (c == '(') {
+        Frag f = parse_alt(nfa);
+        if (*nfa->p != ')') {
+            nfa->error = "unbalanced (";
+        } else {
+            nfa->p++;
+        }
+        return f;
+    } else if (c == '[') {
+        return parse_class(nfa);
+    } else if (c == '.') {
+        for (int b = 0; b < 256; b++) {
+            if (b != '\n') byteset_add(&set, b);
+        }
+    } else if (c == '\\') {
+        byteset_add(&set, parse_escape(nfa));
+    } else {
+        byteset_add(&set, (unsigned char)c);
+    }
+    return frag_set(nfa, &set);
+}
+
+static Frag parse_repeat(Nfa* nfa) {
+    Frag f = parse_atom(nfa);
+    while (*nfa->p == '*' || *nfa->p == '+' || *nfa->p == '?') {
+        char op = *nfa->p++;
+        int e = nfa_state(nfa);
+        if (op == '?') {
+            int s = nfa_state(nfa);
+            nfa->states[s].out = f.start;
+            nfa->states[s].out2 = e;
+            nfa->states[f.end].out = e;
+            f.start = s;
+        } else {
+            // Loop back from the exit; '*' may also skip the body
+            nfa->states[f.end].out = f.start;
+            nfa->states[f.end].out2 = e;
+            if (op == '*') {
+                int s = nfa_state(nfa);
+                nfa->states[s].out = f.start;
+                nfa->states[s].out2 = e;
+                f.start = s;
+            }
+        }
+        f.end = e;
+    }
+    return f;
+}
+
+static Frag parse_concat(Nfa* nfa) {
+    Frag f = frag_empty(nfa);
+    while (*nfa->p && *nfa->p != '|' && *nfa->p != ')') {
+        Frag next = parse_repeat(nfa);
+        nfa->states[f.end].out = next.start;
+        f.end = next.end;
+    }
+    return f;
+}
+
+static Frag parse_alt(Nfa* nfa) {
+    Frag f = parse_concat(nfa);
+    while (*nfa->p == '|') {
+        nfa->p++;
+        Frag other = parse_concat(nfa);
+        int s = nfa_state(nfa);
+        int e = nfa_state(nfa);
+        nfa->states[s].out = f.start;
+        nfa->states[s].out2 = other.start;
+        nfa->states[f.end].out = e;
+        nfa->states[other.end].out = e;
+        f.start = s;
+        f.end = e;
+    }
+    return f;
+}
+
+// Epsilon closure of the NFA states marked in 'set' (in place)
+static void eps_closure(Nfa* nfa, unsigned char* set, int* work) {
+    int top = 0;
+    for (int i = 0; i < nfa->count; i++) {
+        if (set[i]) work[top++] = i;
+    }
+    while (top > 0) {
+        NfaState* s = &nfa->states[work[--top]];
+        if (s->is_set) continue;
+        int outs[2] = { s->out, s->out2 };
+        for (int k = 0; k < 2; k++) {
+            if (outs[k] >= 0 && !set[outs[k]]) {
+                set[outs[k]] = 1;
+                work[top++] = outs[k];
+            }
+        }
+    }
+}
+
+// Record the byte ranges that loop back to each state (at most 4 ranges)
+static void compute_loops(Lexer* lexer) {
+    lexer->loop_count = (unsigned char*)calloc(lexer->num_states, 1);
+    lexer->loop_lo = (unsigned char*)calloc((size_t)lexer->num_states * LEX_LOOP_RANGES, 1);
+    lexer->loop_hi = (unsigned char*)calloc((size_t)lexer->num_states * LEX_LOOP_RANGES, 1);
+
+    for (int s = 0; s < lexer->num_states; s++) {
+        const short* row = &lexer->trans[s * 256];
+        int n = 0;
+        int c = 0;
+        while (c < 256) {
+            if (row[c] != s) {
+                c++;
+                continue;
+            }
+            int lo = c;
+            while (c < 256 && row[c] == s) c++;
+            if (n == LEX_LOOP_RANGES) {
+                n = 0;  // Too many ranges: no fast path
+                break;
+            }
+            lexer->loop_lo[s * LEX_LOOP_RANGES + n] = (unsigned char)lo;
+            lexer->loop_hi[s * LEX_LOOP_RANGES + n] = (unsigned char)(c - 1);
+            n++;
+        }
+        lexer->loop_count[s] = (unsigned char)n;
+    }
+}
+
+// Compile token patterns into a DFA lexer. symbols[i] is the terminal
+// returned for patterns[i], or LEX_SKIP for input that is dropped.
+// Returns NULL (with a message on stderr) if a pattern is malformed.
+Lexer* compile_lexer(const char** patterns, const short* symbols, int count) {
+    Nfa nfa;
+    memset(&nfa, 0, sizeof(nfa));
+
+    // One start state with an epsilon chain to every pattern
+    int start = nfa_state(&nfa);
+    int link = start;
+    for (int i = 0; i < count; i++) {
+        nfa.pattern = patterns[i];
+        nfa.p = patterns[i];
+        Frag f = parse_alt(&nfa);
+        if (!nfa.error && *nfa.p) nfa.error = "unbalanced )";
+        if (nfa.error) {
+            fprintf(stderr, "Error: Bad token pattern '%s': %s\n", patterns[i], nfa.error);
+            free(nfa.states);
+            return NULL;
+        }
+        nfa.states[f.end].accept = i;
+        int next = nfa_state(&nfa);
+        nfa.states[link].out = f.start;
+        nfa.states[link].out2 = next;
+        link = next;
+    }
+
+    // Subset construction
+    int n = nfa.count;
+    int set_cap = 16;
+    int num_sets = 0;
+    unsigned char** sets = (unsigned char**)malloc(set_cap * sizeof(unsigned char*));
+    int trans_cap = set_cap;
+    short* trans = (short*)malloc((size_t)trans_cap * 256 * sizeof(short));
+    int* work = (int*)malloc((n + 1) * sizeof(int));
+    unsigned char* next = (unsigned char*)malloc(n);
+
+    unsigned char* first = (unsigned char*)calloc(n, 1);
+    first[start] = 1;
+    eps_closure(&nfa, first, work);
+    sets[num_sets++] = first;
+
+    for (int d = 0; d < num_sets; d++) {
+        for (int c = 0; c < 256; c++) {
+            memset(next, 0, n);
+            int any = 0;
+            for (int i = 0; i < n; i++) {
+                NfaState* s = &nfa.states[i];
+                if (sets[d][i] && s->is_set && byteset_has(&s->set, c)) {
+                    next[s->out] = 1;
+                    any = 1;
+                }
+            }
+            short target = -1;
+            if (any) {
+                eps_closure(&nfa, next, work);
+                int found = -1;
+                for (int k = 0; k < num_sets && found < 0; k++) {
+                    if (memcmp(sets[k], next, n) == 0) found = k;
+                }
+                if (found < 0) {
+                    if (num_sets == set_cap) {
+                        set_cap *= 2;
+                        sets = (unsigned char**)realloc(sets, set_cap * sizeof(unsigned char*));
+                    }
+                    sets[num_sets] = (unsigned char*)malloc(n);
+                    memcpy(sets[num_sets], next, n);
+                    found = num_sets++;
+                }
+                target = (short)found;
+            }
+            if (d >= trans_cap) {
+                trans_cap *= 2;
+                trans = (short*)realloc(trans, (size_t)trans_cap * 256 * sizeof(short));
+            }
+            trans[d * 256 + c] = target;
+        }
+    }
+
+    Lexer* lexer = (Lexer*)malloc(sizeof(Lexer));
+    lexer->spec = NULL;
+    lexer->num_states = num_sets;
+    lexer->trans = (short*)realloc(trans, (size_t)num_sets * 256 * sizeof(short));
+    lexer->accept = (short*)malloc(num_sets * sizeof(short));
+    for (int d = 0; d < num_sets; d++) {
+        // The pattern declared first wins among those accepting here
+        int best = -1;
+        for (int i = 0; i < n; i++) {
+            int a = nfa.states[i].accept;
+            if (sets[d][i] && a >= 0 && (best < 0 || a < best)) best = a;
+        }
+        lexer->accept[d] = best >= 0 ? symbols[best] : LEX_NONE;
+        free(sets[d]);
+    }
+    compute_loops(lexer);
+
+    free(sets);
+    free(work);
+    free(next);
+    free(nfa.states);
+    return lexer;
+}
+
+// Free a lexer
+void free_lexer(Lexer* lexer) {
+    if (!lexer) return;
+    free(lexer->trans);
+    free(lexer->accept);
+    free(lexer->loop_count);
+    free(lexer->loop_lo);
+    free(lexer->loop_hi);
+    free(lexer->spec);
+    free(lexer);
+}
+
+// Advance over bytes that keep the DFA in 'state' (a self-loop run)
+static int scan_run(const Lexer* lexer, int state, const char* input, int i, int len) {
+    const short* row = &lexer->trans[state * 256];
+#ifdef __SSE2__
+    int n = lexer->loop_count[state];
+    const unsigned char* lo = &lexer->loop_lo[state * LEX_LOOP_RANGES];
+    const unsigned char* hi = &lexer->loop_hi[state * LEX_LOOP_RANGES];
+    __m128i base[LEX_LOOP_RANGES];
+    __m128i width[LEX_LOOP_RANGES];
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    for (int r = 0; r < n; r++) {
+        base[r] = _mm_set1_epi8((char)lo[r]);
+        width[r] = _mm_set1_epi8((char)((hi[r] - lo[r]) ^ 0x80));
+    }
+    while (i + 16 <= len) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(input + i));
+        // A byte is outside the set when (x - lo) > (hi - lo) unsigned for every range
+        __m128i outside = _mm_set1_epi8((char)0xFF);
+        for (int r = 0; r < n; r++) {
+            __m128i d = _mm_xor_si128(_mm_sub_epi8(x, base[r]), bias);
+            outside = _mm_and_si128(outside, _mm_cmpgt_epi8(d, width[r]));
+        }
+        int mask = _mm_movemask_epi8(outside);
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+#endif
+    while (i < len && row[(unsigned char)input[i]] == state) i++;
+    return i;
+}
+
+// 1 if some byte leads out of 'state' (a token there may still grow)
+static int can_extend(const Lexer* lexer, int state) {
+    const short* row = &lexer->trans[state * 256];
+    for (int c = 0; c < 256; c++) {
+        if (row[c] >= 0) return 1;
+    }
+    return 0;
+}
+
+// End of the bytes the DFA reads to scan a token at 'start': one past the
+// byte that stops it (at most 'len')
+int lex_reach(const Lexer* lexer, const char* input, int len, int start) {
+    int state = 0;
+    int i = start;
+    while (i < len) {
+        int next = lexer->trans[state * 256 + (unsigned char)input[i++]];
+        if (next < 0) break;
+        state = next;
+    }
+    return i;
+}
+
+// Scan the next token at or after 'pos', skipping %skip input.
+// Sets [*start, *end) to its span and returns its terminal symbol, '$' at
+// the end of input, or LEX_ERROR if no pattern matches at *start.
+// With 'partial' set, a match that could continue past 'len' returns
+// LEX_MORE instead (*start = where the unfinished token begins); a token
+// whose DFA state has no way out is complete even at the end.
+int lex_scan(const Lexer* lexer, const char* input, int len, int pos,
+             int* start, int* end, int partial) {
+    while (1) {
+        *start = pos;
+        *end = pos;
+        if (pos >= len) return partial ? LEX_MORE : '$';
+
+        int state = 0;
+        int symbol = LEX_NONE;
+        int last = pos;
+        int i = pos;
+        while (i < len) {
+            if (lexer->loop_count[state]) {
+                i = scan_run(lexer, state, input, i, len);
+                if (lexer->accept[state] != LEX_NONE && i > pos) {
+                    symbol = lexer->accept[state];
+                    last = i;
+                }
+                if (i >= len) break;
+            }
+            int next = lexer->trans[state * 256 + (unsigned char)input[i]];
+            if (next < 0) break;
+            state = next;
+            i++;
+            if (lexer->accept[state] != LEX_NONE) {
+                symbol = lexer->accept[state];
+                last = i;
+            }
+        }
+
+        if (partial && i >= len && can_extend(lexer, state)) return LEX_MORE;
+        if (symbol == LEX_NONE) return LEX_ERROR;
+        if (symbol == LEX_SKIP) {
+            pos = last;
+            continue;
+        }
+        *end = last;
+        return symbol;
+    }
+}
@@ -1,381 +1,568 @@
+#define _POSIX_C_SOURCE 200809L   // getline
 #include "structs.h"
 
-// Read and parse the grammar and table from file
-int read_file(const char* filename, Grammar* grammar, Table* table) {
-    FILE* fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+int is_binary_table(const char* filename);
+int load_binary(const char* filename, Grammar* grammar, Table* table);
+int generate_table(Grammar* grammar, Table* table, int report);
+void prepare_table(Grammar* grammar, Table* table);
+void add_conflict(Table* table, int state, int symbol, int action);
+Lexer* compile_lexer(const char** patterns, const short* symbols, int count);
+void free_lexer(Lexer* lexer);
+
+
+int outbuf_write(OutBuf* out, const char* data, size_t len);
+
+// Lexer directives collected before the rules
+typedef struct {
+    char* patterns[NT_BASE];
+    short symbols[NT_BASE];
+    int count;
+    OutBuf spec;        // Directive lines, kept for write_table_text
+} LexSpec;
+
+static void add_pattern(LexSpec* spec, const char* pattern, size_t len, short symbol) {
+    char* copy = (char*)malloc(len + 1);
+    memcpy(copy, pattern, len);
+    copy[len] = '\0';
+    spec->patterns[spec->count] = copy;
+    spec->symbols[spec->count] = symbol;
+    spec->count++;
+}
+
+// Parse "%sync <c> <c> ...": terminals where error recovery resumes
+static int parse_sync(char* p, Grammar* grammar) {
+    int count = 0;
+    while (*p) {
+        if (*p == ' ' || *p == '\t') {
+            p++;
+            continue;
+        }
+        if (*p == '$' || (p[1] && p[1] != ' ' && p[1] != '\t')) return 0;
+        TERMSET_ADD(grammar->sync, (unsigned char)*p);
+        count++;
+        p++;
+    }
+    return count > 0;
+}
+
+// Parse "%token <c> <pattern>", "%skip <pattern>" or "%sync <c> ...";
+// returns 0 if malformed
+static int parse_directive(char* line, LexSpec* spec, Grammar* grammar) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char* p = line;
+    short symbol;
+    if (strncmp(p, "%sync", 5) == 0 && (p[5] == ' ' || p[5] == '\t')) {
+        return parse_sync(p + 5, grammar);
+    } else if (strncmp(p, "%token", 6) == 0 && (p[6] == ' ' || p[6] == '\t')) {
+        p += 6;
+        while (*p == ' ' || *p == '\t') p++;
+        symbol = (unsigned char)*p;
+        if (!*p || *p == '$' || (p[1] != ' ' && p[1] != '\t')) return 0;
+        p++;
+    } else if (strncmp(p, "%skip", 5) == 0 && (p[5] == ' ' || p[5] == '\t')) {
+        p += 5;
+        symbol = LEX_SKIP;
+    } else {
         return 0;
     }
+    while (*p == ' ' || *p == '\t') p++;
+    if (!*p || spec->count >= NT_BASE - 1) return 0;
+    add_pattern(spec, p, strlen(p), symbol);
+    outbuf_write(&spec->spec, line, strlen(line));
+    outbuf_write(&spec->spec, "\n", 1);
+    return 1;
+}
 
-    char line[1024];
-    grammar->rules = NULL;
-    grammar->num_rules = 0;
-    int rules_capacity = 10;
-    grammar->rules = (Rule*)malloc(rules_capacity * sizeof(Rule));
-    
-    int reading_grammar = 1;
-    int first_rule = 1;
-    
-    // Read grammar rules
-    while (fgets(line, sizeof(line), fp)) {
-        // Skip empty lines
-        if (line[0] == '\n' || line[0] == '\r') continue;
-        
-        // Check if we've reached the table header (line with just terminals/non-terminals)
-        if (line[0] == '\t' || (line[0] != ' ' && strchr(line, '\t') && !strchr(line, ':'))) {
-            reading_grammar = 0;
-            break;
-        }
-        
-        if (reading_grammar) {
-            // Parse grammar rule: LHS:RHS
-            char* colon = strchr(line, ':');
-            if (!colon) continue;
-            
-            // Get LHS (non-terminal)
-            char lhs_char = line[0];
-            char lhs = MAKE_NONTERMINAL(lhs_char);
-            
-            // Set axiom from first rule
-            if (first_rule) {
-                grammar->axiom = lhs;
-                first_rule = 0;
-            }
-            
-            // Get RHS (production)
-            char* rhs_start = colon + 1;
-            int rhs_idx = 0;
-            char rhs[MAX_PRODUCTION_LEN] = {0};
-            
-            for (char* p = rhs_start; *p && *p != '\n' && *p != '\r'; p++) {
-                if (*p == '$') {
-                    // Next character is a non-terminal
-                    p++;
-                    if (*p && *p != '\n' && *p != '\r') {
-                        rhs[rhs_idx++] = MAKE_NONTERMINAL(*p);
-                    }
-                } else if (*p != ' ' && *p != '\t') {
-                    // Terminal
-                    rhs[rhs_idx++] = *p;
-                }
-            }
-            
-            // Expand rules array if needed
-            if (grammar->num_rules >= rules_capacity) {
-                rules_capacity *= 2;
-                grammar->rules = (Rule*)realloc(grammar->rules, rules_capacity * sizeof(Rule));
-            }
-            
-            // Add rule
-            grammar->rules[grammar->num_rules].lhs = lhs;
-            strcpy(grammar->rules[grammar->num_rules].rhs, rhs);
-            grammar->rules[grammar->num_rules].rhs_len = rhs_idx;
-            grammar->num_rules++;
+// Compile the directives into grammar->lexer. Terminals used by the rules
+// without a %token line match themselves literally.
+static int build_lexer(Grammar* grammar, LexSpec* spec) {
+    int declared[NT_BASE] = {0};
+    for (int i = 0; i < spec->count; i++) {
+        if (spec->symbols[i] >= 0) declared[spec->symbols[i]] = 1;
+    }
+    for (int r = 0; r < grammar->num_rules; r++) {
+        Rule* rule = &grammar->rules[r];
+        for (int i = 0; i < rule->rhs_len; i++) {
+            int c = rule->rhs[i];
+            if (IS_NONTERMINAL(c) || declared[c] || spec->count >= NT_BASE - 1) continue;
+            char literal[2] = { '\\', (char)c };
+            int alnum = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+            add_pattern(spec, alnum ? literal + 1 : literal, alnum ? 1 : 2, c);
+            declared[c] = 1;
         }
     }
-    
-    // Read table header (skip it, we know columns are indexed by character value)
-    if (!reading_grammar) {
-        // Already read the header line above
+
+    grammar->lexer = compile_lexer((const char**)spec->patterns, spec->symbols, spec->count);
+    for (int i = 0; i < spec->count; i++) free(spec->patterns[i]);
+    if (!grammar->lexer) {
+        free(spec->spec.data);
+        return 0;
+    }
+    outbuf_write(&spec->spec, "", 1);  // NUL-terminate
+    grammar->lexer->spec = spec->spec.data;
+    return 1;
+}
+
+
+// Build the symbol table of a grammar: every byte names its terminal, A-Z
+// name the first non-terminals, and the 'count' NUL-terminated names at
+// 'pool' name the ones after Z. The pool is not copied.
+void set_symbol_names(Grammar* grammar, char* pool, int count) {
+    int fixed = NT_BASE + NT_LETTERS;
+    int num_symbols = fixed + count;
+    // One block: the pointers, then the one-character names
+    char** names = (char**)malloc(num_symbols * sizeof(char*) + 2 * fixed);
+    char* chars = (char*)(names + num_symbols);
+    for (int c = 0; c < fixed; c++) {
+        chars[2 * c] = (char)(c < NT_BASE ? c : 'A' + c - NT_BASE);
+        chars[2 * c + 1] = '\0';
+        names[c] = &chars[2 * c];
+    }
+    for (int i = 0; i < count; i++) {
+        names[fixed + i] = pool;
+        pool += strlen(pool) + 1;
+    }
+    grammar->num_symbols = num_symbols;
+    grammar->names = names;
+}
+
+// Free what a loader allocated for a grammar (the right-hand sides and
+// names of a mapped table stay in the mapping, which free_table releases)
+void free_grammar(Grammar* grammar) {
+    free(grammar->rules);
+    free(grammar->rhs_pool);
+    free(grammar->name_pool);
+    free(grammar->names);
+    free_lexer(grammar->lexer);
+    grammar->rules = NULL;
+    grammar->rhs_pool = NULL;
+    grammar->name_pool = NULL;
+    grammar->names = NULL;
+    grammar->lexer = NULL;
+}
+
+// Write a symbol in the grammar file notation: a terminal as itself, a
+// non-terminal as $X or $<name> on a right-hand side and X or <name> as a
+// left-hand side
+void write_symbol(FILE* out, const Grammar* grammar, int symbol, int lhs) {
+    const char* name = grammar->names[symbol];
+    if (IS_TERMINAL(symbol)) {
+        fputc(symbol, out);
+    } else if (symbol < NT_BASE + NT_LETTERS) {
+        fprintf(out, lhs ? "%s" : "$%s", name);
     } else {
-        fgets(line, sizeof(line), fp);  // Read header
+        fprintf(out, lhs ? "<%s>" : "$<%s>", name);
     }
-    
-    // Count states first
-    long pos = ftell(fp);
-    int num_states = 0;
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] >= '0' && line[0] <= '9') {
-            num_states++;
-        }
+}
+
+// Write terminal byte 'c' for a message into 'out' (room for 5 bytes): as
+// itself if printable, otherwise as \n, \t, \\ or \xNN. Returns the length.
+int escape_terminal(char* out, int c) {
+    if (c == '\n' || c == '\t' || c == '\\') {
+        out[0] = '\\';
+        out[1] = c == '\n' ? 'n' : c == '\t' ? 't' : '\\';
+        return 2;
     }
-    fseek(fp, pos, SEEK_SET);
-    
-    // Allocate table
-    table->num_states = num_states;
-    table->data = (short*)calloc(num_states * TABLE_COLS, sizeof(short));
-    
-    // Read table rows
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] < '0' || line[0] > '9') continue;
-        
-        int state = atoi(line);
-        char* token = strtok(line, "\t");
-        token = strtok(NULL, "\t");  // Skip state number
-        
-        int col_idx = 0;
-        char headers[TABLE_COLS][10];
-        
-        // Re-read header to get column order
-        long current_pos = ftell(fp);
-        fseek(fp, pos - strlen(line) - 100, SEEK_SET);
-        char header_line[1024];
-        int found_header = 0;
-        while (fgets(header_line, sizeof(header_line), fp) && ftell(fp) < pos) {
-            if (header_line[0] == '\t' || (header_line[0] != ' ' && strchr(header_line, '\t'))) {
-                found_header = 1;
-                break;
-            }
+    if (c < 32 || c >= 127) return sprintf(out, "\\x%02x", c);
+    out[0] = (char)c;
+    return 1;
+}
+
+// Non-terminal names being read: the <name> ones are stored NUL-separated
+// in 'pool' and found through an open-addressing hash table
+typedef struct {
+    OutBuf pool;
+    int* starts;        // Offset of each name in pool
+    int count;
+    int capacity;
+    int* slots;         // Name index + 1, 0 = free
+    int slot_mask;
+} NameTable;
+
+static unsigned name_hash(const char* name, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+    return h;
+}
+
+// Symbol of the non-terminal called name[0..len): A-Z are fixed, other
+// names get the next free ID. Returns -1 if the IDs are exhausted.
+static int intern_name(NameTable* table, const char* name, size_t len) {
+    if (len == 1 && name[0] >= 'A' && name[0] <= 'Z') return NT_LETTER(name[0]);
+
+    unsigned h = name_hash(name, len);
+    int i = table->slots ? (int)(h & (unsigned)table->slot_mask) : 0;
+    while (table->slots && table->slots[i]) {
+        const char* other = table->pool.data + table->starts[table->slots[i] - 1];
+        if (strncmp(other, name, len) == 0 && other[len] == '\0') {
+            return NT_BASE + NT_LETTERS + table->slots[i] - 1;
         }
-        
-        // Parse headers
-        int num_cols = 0;
-        char* htoken = strtok(header_line, "\t\n\r");
-        while (htoken) {
-            strcpy(headers[num_cols++], htoken);
-            htoken = strtok(NULL, "\t\n\r");
+        i = (i + 1) & table->slot_mask;
+    }
+    if (NT_BASE + NT_LETTERS + table->count >= MAX_SYMBOLS) return -1;
+
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 64;
+        table->starts = (int*)realloc(table->starts, table->capacity * sizeof(int));
+    }
+    table->starts[table->count] = (int)table->pool.len;
+    outbuf_write(&table->pool, name, len);
+    outbuf_write(&table->pool, "", 1);
+    table->count++;
+
+    // Keep the hash table at most half full
+    if (2 * table->count > table->slot_mask + 1) {
+        free(table->slots);
+        table->slot_mask = table->slot_mask ? 2 * table->slot_mask + 1 : 127;
+        table->slots = (int*)calloc(table->slot_mask + 1, sizeof(int));
+        for (int k = 0; k < table->count; k++) {
+            const char* other = table->pool.data + table->starts[k];
+            int j = (int)(name_hash(other, strlen(other)) & (unsigned)table->slot_mask);
+            while (table->slots[j]) j = (j + 1) & table->slot_mask;
+            table->slots[j] = k + 1;
         }
-        
-        fseek(fp, current_pos - strlen(line) - 1, SEEK_SET);
-        fgets(line, sizeof(line), fp);
-        
-        // Parse state line
-        token = strtok(line, "\t");
-        token = strtok(NULL, "\t");
-        col_idx = 0;
-        
-        while (token && col_idx < num_cols) {
-            if (token[0] != '\n' && token[0] != '\r' && strlen(token) > 0) {
-                // Determine symbol for this column
-                char symbol;
-                if (headers[col_idx][0] == '$') {
-                    symbol = MAKE_NONTERMINAL(headers[col_idx][1]);
-                } else {
-                    symbol = headers[col_idx][0];
-                }
-                
-                // Parse action
-                short action = 0;
-                if (token[0] == 'd') {
-                    // Shift
-                    action = (short)atoi(token + 1);
-                } else if (token[0] == 'r') {
-                    // Reduce
-                    action = -(short)atoi(token + 1);
-                } else if (token[0] == 'a') {
-                    // Accept
-                    action = -127;
-                } else if (token[0] >= '0' && token[0] <= '9') {
-                    // GOTO (just state number)
-                    action = (short)atoi(token);
-                }
-                
-                table->data[state * TABLE_COLS + (unsigned char)symbol] = action;
-            }
-            token = strtok(NULL, "\t");
-            col_idx++;
+    } else {
+        table->slots[i] = table->count;
+    }
+    return NT_BASE + NT_LETTERS + table->count - 1;
+}
+
+// Read a non-terminal name at *p: one character, or "<name>". Returns its
+// symbol and moves *p past it; -1 if malformed or out of IDs.
+static int scan_nonterminal(NameTable* table, char** p) {
+    char* name = *p;
+    size_t len = 1;
+    if (name[0] == '<' && name[1] && name[1] != '>') {
+        char* close = strchr(name, '>');
+        if (!close || strcspn(name, " \t\r\n") < (size_t)(close - name)) return -1;
+        name++;
+        len = close - name;
+        *p = close + 1;
+    } else if (!name[0] || name[0] == ' ' || name[0] == '\t' || name[0] == '\r' || name[0] == '\n') {
+        return -1;
+    } else {
+        *p = name + 1;
+    }
+    return intern_name(table, name, len);
+}
+
+// Right-hand sides being read, in one growing array
+typedef struct {
+    Symbol* symbols;
+    size_t len;
+    size_t cap;
+} SymbolBuf;
+
+static void symbol_push(SymbolBuf* buf, int symbol) {
+    if (buf->len == buf->cap) {
+        buf->cap = buf->cap ? buf->cap * 2 : 1024;
+        buf->symbols = (Symbol*)realloc(buf->symbols, buf->cap * sizeof(Symbol));
+    }
+    buf->symbols[buf->len++] = (Symbol)symbol;
+}
+
+// Rules being read: their right-hand sides go one after the other into
+// 'rhs' and get their Rule.rhs pointers once the rules are complete
+typedef struct {
+    NameTable names;
+    SymbolBuf rhs;
+    size_t* starts;     // Offset of each rule's RHS in rhs
+    int capacity;       // Allocated rules
+} RuleReader;
+
+// Parse a rule line "X:rhs" or "<name>:rhs" into the next rule; returns 0
+// if malformed
+static int parse_rule(char* line, Grammar* grammar, RuleReader* reader) {
+    char* p = line;
+    int lhs = scan_nonterminal(&reader->names, &p);
+    if (lhs < 0 || *p != ':') return 0;
+    p++;
+
+    size_t start = reader->rhs.len;
+    while (*p && *p != '\n' && *p != '\r') {
+        if (*p == '$') {
+            p++;
+            int symbol = scan_nonterminal(&reader->names, &p);
+            if (symbol < 0) return 0;
+            symbol_push(&reader->rhs, symbol);
+        } else if (*p != ' ' && *p != '\t') {
+            symbol_push(&reader->rhs, (unsigned char)*p++);
+        } else {
+            p++;
         }
     }
-    
-    fclose(fp);
+    if (reader->rhs.len - start > MAX_RHS) return 0;
+
+    if (grammar->num_rules == reader->capacity) {
+        reader->capacity = reader->capacity ? reader->capacity * 2 : 64;
+        grammar->rules = (Rule*)realloc(grammar->rules, reader->capacity * sizeof(Rule));
+        reader->starts = (size_t*)realloc(reader->starts, reader->capacity * sizeof(size_t));
+    }
+    // rhs_len can be 0 for epsilon production
+    reader->starts[grammar->num_rules] = start;
+    Rule* rule = &grammar->rules[grammar->num_rules++];
+    rule->lhs = (Symbol)lhs;
+    rule->rhs_len = (int)(reader->rhs.len - start);
+    rule->rhs = NULL;
+    if (grammar->num_rules == 1) grammar->axiom = rule->lhs;
     return 1;
 }
 
+// Hand the rules and names read to the grammar
+static void finish_rules(Grammar* grammar, RuleReader* reader) {
+    grammar->rhs_pool = reader->rhs.symbols;
+    for (int r = 0; r < grammar->num_rules; r++) {
+        grammar->rules[r].rhs = grammar->rhs_pool + reader->starts[r];
+    }
+    grammar->name_pool = reader->names.pool.data;
+    set_symbol_names(grammar, grammar->name_pool, reader->names.count);
+    free(reader->starts);
+    free(reader->names.starts);
+    free(reader->names.slots);
+    memset(reader, 0, sizeof(*reader));
+}
+
+// Give up loading a text file: free what was read so far
+static int abandon_text(FILE* fp, char* line, Grammar* grammar, RuleReader* reader) {
+    free(reader->starts);
+    free(reader->names.starts);
+    free(reader->names.slots);
+    free(reader->names.pool.data);
+    free(reader->rhs.symbols);
+    free_grammar(grammar);
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
 // Simpler version - parse the exact format from the test files
-int load_grammar_table(const char* filename, Grammar* grammar, Table* table) {
+// (files with rules but no table rows get a generated LALR(1) table)
+static int load_text(const char* filename, Grammar* grammar, Table* table) {
     FILE* fp = fopen(filename, "r");
     if (!fp) {
         fprintf(stderr, "Error: Cannot open file %s\n", filename);
         return 0;
     }
 
-    char line[1024];
-    grammar->rules = (Rule*)malloc(MAX_RULES * sizeof(Rule));
-    grammar->num_rules = 0;
-    int first_rule = 1;
-    
-    // Phase 1: Read grammar rules
-    while (fgets(line, sizeof(line), fp)) {
-        // Empty line or start of table
-        if (line[0] == '\t' || line[0] == '\n' || line[0] == '\r') break;
-        if (line[0] < 'A' || line[0] > 'Z') break;
-        
-        char* colon = strchr(line, ':');
-        if (!colon) break;
-        
-        // Parse LHS
-        char lhs = MAKE_NONTERMINAL(line[0]);
-        if (first_rule) {
-            grammar->axiom = lhs;
-            first_rule = 0;
-        }
-        
-        // Parse RHS
-        char rhs[MAX_PRODUCTION_LEN] = {0};
-        int rhs_len = 0;
-        char* p = colon + 1;
-        
-        while (*p && *p != '\n' && *p != '\r') {
-            if (*p == '$') {
-                p++;
-                if (*p && *p != '\n' && *p != '\r' && *p != '\t' && *p != ' ') {
-                    rhs[rhs_len++] = MAKE_NONTERMINAL(*p);
-                }
-            } else if (*p != ' ' && *p != '\t') {
-                rhs[rhs_len++] = *p;
+    char* line = NULL;
+    size_t line_cap = 0;
+    memset(table, 0, sizeof(Table));
+    memset(grammar, 0, sizeof(Grammar));
+    RuleReader reader;
+    memset(&reader, 0, sizeof(reader));
+    LexSpec spec;
+    memset(&spec, 0, sizeof(spec));
+
+    // Phase 1: Read lexer directives and grammar rules
+    int have_line;
+    while ((have_line = getline(&line, &line_cap, fp) >= 0)) {
+        if (line[0] == '%') {
+            if (!parse_directive(line, &spec, grammar)) {
+                fprintf(stderr, "Error: Bad directive: %s\n", line);
+                return abandon_text(fp, line, grammar, &reader);
             }
-            p++;
+            continue;
         }
-        
-        // rhs_len can be 0 for epsilon production
-        grammar->rules[grammar->num_rules].lhs = lhs;
-        if (rhs_len > 0) {
-            memcpy(grammar->rules[grammar->num_rules].rhs, rhs, rhs_len);
+
+        // Empty line or start of table
+        if (line[0] == '\t' || line[0] == '\n' || line[0] == '\r') break;
+        if ((line[0] < 'A' || line[0] > 'Z') && line[0] != '<') break;
+        if (!strchr(line, ':')) break;
+
+        if (!parse_rule(line, grammar, &reader)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            int full = NT_BASE + NT_LETTERS + reader.names.count >= MAX_SYMBOLS;
+            fprintf(stderr, "Error: %s: %s\n", full ? "Too many symbols" : "Bad rule", line);
+            return abandon_text(fp, line, grammar, &reader);
         }
-        grammar->rules[grammar->num_rules].rhs[rhs_len] = '\0';
-        grammar->rules[grammar->num_rules].rhs_len = rhs_len;
-        grammar->num_rules++;
     }
-    
-    // Phase 2: Read table header (line should already be in buffer)
-    char symbols[TABLE_COLS];
+
+    // Phase 2: Read table header (line should already be in buffer);
+    // its non-terminals are interned like those of the rules
+    int* symbols = NULL;
     int num_symbols = 0;
-    
-    // Parse header line (currently in line buffer)
-    char* token = strtok(line, "\t\n\r");
-    while (token && num_symbols < TABLE_COLS) {
-        // Skip empty tokens
-        while (token && (strlen(token) == 0 || (strlen(token) == 1 && token[0] == ' '))) {
+    if (have_line) {
+        symbols = (int*)malloc((strlen(line) / 2 + 1) * sizeof(int));
+        char* token = strtok(line, "\t\n\r");
+        while (token) {
+            // In the table header:
+            // - A-Z and <name> are non-terminals
+            // - Everything else (including $, a, b, c, etc.) are terminals
+            if (token[0] == '<' && token[1]) {
+                char* p = token;
+                symbols[num_symbols] = scan_nonterminal(&reader.names, &p);
+                if (symbols[num_symbols] < 0 || *p) {
+                    fprintf(stderr, "Error: Bad table column: %s\n", token);
+                    free(symbols);
+                    return abandon_text(fp, line, grammar, &reader);
+                }
+                num_symbols++;
+            } else if (strlen(token) == 1 && token[0] >= 'A' && token[0] <= 'Z') {
+                symbols[num_symbols++] = NT_LETTER(token[0]);
+            } else if (!(strlen(token) == 1 && token[0] == ' ')) {
+                // Terminal - take the first character
+                symbols[num_symbols++] = (unsigned char)token[0];
+            }
             token = strtok(NULL, "\t\n\r");
         }
-        if (!token) break;
-        
-        // In the table header:
-        // - Uppercase single letters (A-Z) are non-terminals
-        // - Everything else (including $, a, b, c, etc.) are terminals
-        if (strlen(token) == 1 && token[0] >= 'A' && token[0] <= 'Z') {
-            symbols[num_symbols++] = MAKE_NONTERMINAL(token[0]);
-        } else if (strlen(token) >= 1) {
-            // Terminal - take the first character
-            symbols[num_symbols++] = token[0];
-        }
-        token = strtok(NULL, "\t\n\r");
     }
-    
+    finish_rules(grammar, &reader);
+
+    if (spec.count > 0 && !build_lexer(grammar, &spec)) {
+        free(symbols);
+        return abandon_text(fp, line, grammar, &reader);
+    }
+
     // Phase 3: Count states
     long header_pos = ftell(fp);
     int max_state = 0;
-    while (fgets(line, sizeof(line), fp)) {
+    int num_rows = 0;
+    while (getline(&line, &line_cap, fp) >= 0) {
         if (line[0] >= '0' && line[0] <= '9') {
             int state = atoi(line);
             if (state > max_state) max_state = state;
+            num_rows++;
         }
     }
-    
+
+    // Rules only: derive the table from them
+    if (num_rows == 0) {
+        free(symbols);
+        free(line);
+        fclose(fp);
+        return generate_table(grammar, table, 1) >= 0;
+    }
+
     // Allocate table
     table->num_states = max_state + 1;
-    table->data = (short*)calloc(table->num_states * TABLE_COLS, sizeof(short));
-    
+    table->num_cols = grammar->num_symbols;
+    table->data = (int*)calloc((size_t)table->num_states * table->num_cols, sizeof(int));
+
     // Re-read table rows
     fseek(fp, header_pos, SEEK_SET);
-    
-    while (fgets(line, sizeof(line), fp)) {
+
+    while (getline(&line, &line_cap, fp) >= 0) {
         // Remove CR if present (Windows line endings)
-        char* cr = strchr(line, '\r');
-        if (cr) *cr = '\0';
-        char* nl = strchr(line, '\n');
-        if (nl) *nl = '\0';
-        
+        line[strcspn(line, "\r\n")] = '\0';
+
         if (line[0] < '0' || line[0] > '9') continue;
-        
+
         // Parse state number
         int state = atoi(line);
-        
+
         // Find first tab
         char* p = strchr(line, '\t');
         if (!p) continue;
         p++;  // Move past the tab
-        
-        // Parse each column manually to handle empty cells
+
+        // Parse each column in place to handle empty cells
         for (int col = 0; col < num_symbols; col++) {
             // Find the extent of this cell (until next tab or end)
             char* tab_pos = strchr(p, '\t');
-            char cell[100] = {0};
-            
+            char* cell = p;
             if (tab_pos) {
-                int len = tab_pos - p;
-                if (len > 0 && len < 99) {
-                    strncpy(cell, p, len);
-                    cell[len] = '\0';
-                }
+                *tab_pos = '\0';
                 p = tab_pos + 1;  // Move to next cell
-            } else {
-                // Last cell in row
-                strncpy(cell, p, 99);
-                cell[99] = '\0';
             }
-            
-            // Trim whitespace
-            int start = 0;
-            while (cell[start] == ' ') start++;
-            int end = strlen(cell) - 1;
-            while (end >= start && (cell[end] == ' ' || cell[end] == '\r' || cell[end] == '\n')) {
-                cell[end--] = '\0';
-            }
-            
-            // Parse action if cell is not empty
-            if (start <= end && cell[start] != '\0') {
-                short action = 0;
-                
-                if (cell[start] == 'd') {
+
+            // Parse the actions if the cell is not empty; a conflict cell
+            // lists several separated by '/', the first one is used by LR
+            char* part = cell;
+            while (*part == ' ') part++;
+            int first = 1;
+            while (*part != '\0') {
+                int action = 0;
+
+                if (*part == 'd') {
                     // Shift
-                    action = (short)atoi(cell + start + 1);
-                } else if (cell[start] == 'r') {
+                    action = atoi(part + 1);
+                } else if (*part == 'r') {
                     // Reduce
-                    action = -(short)atoi(cell + start + 1);
-                } else if (cell[start] == 'a') {
+                    action = -atoi(part + 1);
+                } else if (*part == 'a') {
                     // Accept
-                    action = -127;
-                } else if (cell[start] >= '0' && cell[start] <= '9') {
+                    action = ACTION_ACCEPT;
+                } else if (*part >= '0' && *part <= '9') {
                     // GOTO state
-                    action = (short)atoi(cell + start);
+                    action = atoi(part);
                 }
-                
-                if (action != 0) {
-                    table->data[state * TABLE_COLS + (unsigned char)symbols[col]] = action;
+
+                if (action != 0 && first) {
+                    table->data[(size_t)state * table->num_cols + symbols[col]] = action;
+                    first = 0;
+                } else if (action != 0) {
+                    add_conflict(table, state, symbols[col], action);
                 }
+
+                char* slash = strchr(part, '/');
+                if (!slash) break;
+                part = slash + 1;
             }
-            
+
             if (!tab_pos) break;  // No more cells
         }
     }
-    
+    free(symbols);
+    free(line);
     fclose(fp);
     return 1;
 }
 
+// Load a grammar and table file; precompiled binary tables are detected
+// and mapped instead. The lookahead-free parts are precomputed either way.
+int load_grammar_table(const char* filename, Grammar* grammar, Table* table) {
+    int ok;
+    if (is_binary_table(filename)) {
+        ok = load_binary(filename, grammar, table);
+    } else {
+        ok = load_text(filename, grammar, table);
+    }
+    if (ok) {
+        prepare_table(grammar, table);
+    }
+    return ok;
+}
+
 // Print grammar for debugging
 void print_grammar(Grammar* grammar) {
-    printf("Axiom: %c\n", GET_CHAR(grammar->axiom));
-    printf("Rules:\n");
+    printf("Axiom: ");
+    write_symbol(stdout, grammar, grammar->axiom, 1);
+    printf("\nRules:\n");
     for (int i = 0; i < grammar->num_rules; i++) {
-        printf("  %d: %c ->", i + 1, GET_CHAR(grammar->rules[i].lhs));
+        printf("  %d: ", i + 1);
+        write_symbol(stdout, grammar, grammar->rules[i].lhs, 1);
+        printf(" ->");
         for (int j = 0; j < grammar->rules[i].rhs_len; j++) {
-            char c = grammar->rules[i].rhs[j];
-            if (IS_NONTERMINAL(c)) {
-                printf(" $%c", GET_CHAR(c));
-            } else {
-                printf(" %c", c);
-            }
+            putchar(' ');
+            write_symbol(stdout, grammar, grammar->rules[i].rhs[j], 0);
         }
         printf("\n");
     }
 }
 
+size_t table_memory(Table* table);
+
 // Print table for debugging
-void print_table(Table* table) {
+void print_table(Grammar* grammar, Table* table) {
     printf("Table (%d states):\n", table->num_states);
+    if (table->data) {
+        printf("Layout: dense, %zu bytes\n", table_memory(table));
+    } else {
+        printf("Layout: compressed, %d classes, %d packed cells, %zu bytes\n",
+               table->num_classes, table->packed_len, table_memory(table));
+    }
     // Print a subset for debugging
     for (int i = 0; i < table->num_states && i < 10; i++) {
         printf("State %d: ", i);
         int count = 0;
-        for (int j = 0; j < TABLE_COLS && count < 10; j++) {
-            short action = table->data[i * TABLE_COLS + j];
+        for (int j = 0; j < table->num_cols && count < 10; j++) {
+            int action = table_action(table, i, j);
             if (action != 0) {
-                printf("[%c:", j);
+                putchar('[');
+                write_symbol(stdout, grammar, j, 1);
+                putchar(':');
                 if (action > 0) printf("s%d", action);
-                else if (action == -127) printf("acc");
+                else if (action == ACTION_ACCEPT) printf("acc");
                 else printf("r%d", -action);
                 printf("] ");
                 count++;
@@ -0,0 +1,214 @@
+#include <limits.h>
+#include "lrparser.h"
+
+// Embedding API: opaque grammar and context handles over the engine.
+
+// Function prototypes from other modules
+int load_grammar_table(const char* filename, Grammar* grammar, Table* table);
+void free_table(Table* table);
+void free_grammar(Grammar* grammar);
+int parse_input(Grammar* grammar, Table* table, const char* input, int input_len,
+                int trace, Stack* stack, NodeArena* arena, ParseResult* result);
+int recognize(Grammar* grammar, Table* table, const char* input, int input_len,
+              StateStack* stack, int* error_pos);
+Stack* create_stack(int initial_capacity);
+void free_stack(Stack* stack);
+StateStack* create_state_stack(int initial_capacity);
+void free_state_stack(StateStack* stack);
+NodeArena* create_arena(size_t slab_size);
+void reset_arena(NodeArena* arena);
+size_t arena_bytes(const NodeArena* arena);
+void free_arena(NodeArena* arena);
+int write_tree(Node* root, const Grammar* grammar, int format, OutBuf* out, FILE* sink);
+int write_padded_tree(Node* root, const Grammar* grammar, int format, OutBuf* out, FILE* sink);
+int parse_incremental(Grammar* grammar, Table* table, const char* input, int input_len,
+                      Node* old_tree, const TextEdit* edits, int num_edits,
+                      Stack* stack, NodeArena* arena, ParseResult* result);
+
+struct LrGrammar {
+    Grammar grammar;
+    Table table;
+};
+
+struct ParserCtx {
+    Grammar* grammar;       // Shared with other contexts (read-only)
+    Table* table;
+    Stack* stack;           // Kept across parses
+    StateStack* states;
+    NodeArena* arena;
+    OutBuf out;             // Tree output buffer
+    ParseResult result;     // Last parse
+    int padded;             // result.tree comes from lr_reparse
+
+    // Base of the next lr_reparse
+    Node* base;             // Tree of the last accepted lr_reparse (NULL = none)
+    long base_len;          // Length of its text
+    size_t full_bytes;      // Arena bytes after the last full parse
+};
+
+// Load a grammar file (text or binary); *out is NULL on error
+int lr_grammar_load(const char* filename, LrGrammar** out) {
+    *out = NULL;
+    if (!filename) return LR_ERR_ARG;
+    LrGrammar* loaded = (LrGrammar*)malloc(sizeof(LrGrammar));
+    if (!loaded) return LR_ERR_NOMEM;
+    if (!load_grammar_table(filename, &loaded->grammar, &loaded->table)) {
+        free(loaded);
+        return LR_ERR_LOAD;
+    }
+    *out = loaded;
+    return LR_ACCEPT;
+}
+
+void lr_grammar_free(LrGrammar* grammar) {
+    if (!grammar) return;
+    // Rules of a mapped binary table live in the mapping
+    free_grammar(&grammar->grammar);
+    free_table(&grammar->table);
+    free(grammar);
+}
+
+// Create a context for one grammar; *out is NULL on error
+int lr_ctx_create(const LrGrammar* grammar, ParserCtx** out) {
+    *out = NULL;
+    if (!grammar) return LR_ERR_ARG;
+    ParserCtx* ctx = (ParserCtx*)calloc(1, sizeof(ParserCtx));
+    if (!ctx) return LR_ERR_NOMEM;
+    // The engine takes non-const pointers but never writes the grammar or table
+    ctx->grammar = (Grammar*)&grammar->grammar;
+    ctx->table = (Table*)&grammar->table;
+    ctx->stack = create_stack(256);
+    ctx->states = create_state_stack(256);
+    ctx->arena = create_arena(64 * 1024);
+    if (!ctx->stack || !ctx->states || !ctx->arena) {
+        lr_ctx_free(ctx);
+        return LR_ERR_NOMEM;
+    }
+    ctx->result.error_pos = -1;
+    *out = ctx;
+    return LR_ACCEPT;
+}
+
+void lr_ctx_free(ParserCtx* ctx) {
+    if (!ctx) return;
+    if (ctx->stack) free_stack(ctx->stack);
+    if (ctx->states) free_state_stack(ctx->states);
+    if (ctx->arena) free_arena(ctx->arena);
+    free(ctx->out.data);
+    free(ctx);
+}
+
+// Drop the last tree in O(1); the stacks and arena slabs are kept
+void lr_ctx_reset(ParserCtx* ctx) {
+    reset_arena(ctx->arena);
+    ctx->stack->top = -1;
+    ctx->states->top = -1;
+    ctx->out.len = 0;
+    ctx->result.accepted = 0;
+    ctx->result.error_pos = -1;
+    ctx->result.tree = NULL;
+    ctx->padded = 0;
+    ctx->base = NULL;
+}
+
+// 1 if 'edits' are sorted, do not overlap and turn a text of 'old_len'
+// bytes into one of 'new_len'
+static int valid_edits(const LrEdit* edits, int num_edits, long old_len, size_t new_len) {
+    long end = 0;
+    long len = old_len;
+    for (int i = 0; i < num_edits; i++) {
+        const LrEdit* edit = &edits[i];
+        if (edit->offset < end || edit->removed < 0 || edit->inserted < 0 ||
+            edit->offset + edit->removed > old_len) {
+            return 0;
+        }
+        end = edit->offset + edit->removed;
+        len += edit->inserted - edit->removed;
+    }
+    return len == (long)new_len;
+}
+
+// Parse input[0..len) reusing the subtrees of the last accepted lr_reparse
+int lr_reparse(ParserCtx* ctx, const char* input, size_t len, const LrEdit* edits,
+               int num_edits) {
+    if (!ctx || !input || len > INT_MAX || num_edits < 0 || (num_edits > 0 && !edits)) {
+        return LR_ERR_ARG;
+    }
+    if (ctx->base && !valid_edits(edits, num_edits, ctx->base_len, len)) return LR_ERR_ARG;
+    if (ctx->base && arena_bytes(ctx->arena) > 4 * ctx->full_bytes) {
+        // Mostly replaced nodes by now: start over with a full parse
+        lr_ctx_reset(ctx);
+    }
+    Node* base = ctx->base;
+    if (!base) {
+        lr_ctx_reset(ctx);
+        num_edits = 0;
+    }
+    ctx->out.len = 0;
+    int status = parse_incremental(ctx->grammar, ctx->table, input, (int)len, base, edits,
+                                   num_edits, ctx->stack, ctx->arena, &ctx->result);
+    ctx->padded = 1;
+    if (status == LR_ACCEPT) {
+        if (!base) ctx->full_bytes = arena_bytes(ctx->arena);
+        ctx->base = ctx->result.tree;
+        ctx->base_len = (long)len;
+    }
+    return status;
+}
+
+// Parse input[0..len) and build its tree in the context's arena
+int lr_parse(ParserCtx* ctx, const char* input, size_t len) {
+    if (!ctx || !input || len > INT_MAX) return LR_ERR_ARG;
+    lr_ctx_reset(ctx);
+    return parse_input(ctx->grammar, ctx->table, input, (int)len, 0, ctx->stack, ctx->arena,
+                       &ctx->result);
+}
+
+// Accept or reject input[0..len) without building a tree
+int lr_recognize(ParserCtx* ctx, const char* input, size_t len) {
+    if (!ctx || !input || len > INT_MAX) return LR_ERR_ARG;
+    lr_ctx_reset(ctx);
+    int error_pos;
+    int status = recognize(ctx->grammar, ctx->table, input, (int)len, ctx->states, &error_pos);
+    ctx->result.accepted = status == LR_ACCEPT;
+    ctx->result.error_pos = error_pos;
+    return status;
+}
+
+const Node* lr_tree(const ParserCtx* ctx) {
+    return ctx->result.accepted ? ctx->result.tree : NULL;
+}
+
+long lr_error_pos(const ParserCtx* ctx) {
+    return ctx->result.error_pos;
+}
+
+// Write the last tree in a TREE_* format to 'out'. Returns LR_ACCEPT,
+// LR_REJECT if there is no tree, or LR_ERR_NOMEM (the output stops short).
+int lr_write_tree(const ParserCtx* ctx, int format, FILE* out) {
+    if (!ctx || !out || format < TREE_COMPACT || format > TREE_JSON) return LR_ERR_ARG;
+    if (!ctx->result.accepted || !ctx->result.tree) return LR_REJECT;
+    // The buffer is scratch space, not part of the parse result
+    OutBuf* buf = (OutBuf*)&ctx->out;
+    int written = ctx->padded ? write_padded_tree(ctx->result.tree, ctx->grammar, format, buf, out)
+                              : write_tree(ctx->result.tree, ctx->grammar, format, buf, out);
+    return written ? LR_ACCEPT : LR_ERR_NOMEM;
+}
+
+// Grammar of a context, for tools built on structs.h (symbol names)
+const Grammar* lr_ctx_grammar(const ParserCtx* ctx) {
+    return ctx->grammar;
+}
+
+// Short description of a return code
+const char* lr_strerror(int code) {
+    switch (code) {
+    case LR_ACCEPT: return "accepted";
+    case LR_REJECT: return "syntax error";
+    case LR_ERR_TABLE: return "malformed parsing table";
+    case LR_ERR_NOMEM: return "out of memory";
+    case LR_ERR_LOAD: return "cannot load grammar file";
+    case LR_ERR_ARG: return "invalid argument";
+    }
+    return "unknown error";
+}
@@ -0,0 +1,75 @@
+#ifndef LRPARSER_H
+#define LRPARSER_H
+
+// Embedding API of the LR engine (liblrparser.a / liblrparser.so).
+//
+// A loaded grammar is read-only and can be shared by any number of
+// parser contexts, one per thread. A context keeps its stacks and node
+// arena across parses, so after the first few inputs a parse allocates
+// nothing. Errors are reported through return codes; the library never
+// exits the process.
+
+#include <stddef.h>
+#include "structs.h"
+
+// Return codes (parse results follow the engine: 1 = accept, 0 = reject,
+// -1 = table error, -2 = out of memory)
+#define LR_ACCEPT 1
+#define LR_REJECT 0
+#define LR_ERR_TABLE -1     // Malformed table: bad rule number or missing GOTO
+#define LR_ERR_NOMEM -2     // Out of memory
+#define LR_ERR_LOAD -3      // Grammar/table file could not be loaded
+#define LR_ERR_ARG -4       // NULL argument or input too long
+
+// Functions exported by the library; its other symbols are hidden
+#define LR_API __attribute__((visibility("default")))
+
+typedef struct LrGrammar LrGrammar;  // Grammar and table loaded from a file
+typedef struct ParserCtx ParserCtx;  // Per-thread parser state
+typedef TextEdit LrEdit;             // Replaced byte range {offset, removed, inserted}
+
+// Load a grammar file (text or binary); *out is NULL on error
+LR_API int lr_grammar_load(const char* filename, LrGrammar** out);
+LR_API void lr_grammar_free(LrGrammar* grammar);
+
+// Create a context for one grammar; *out is NULL on error
+LR_API int lr_ctx_create(const LrGrammar* grammar, ParserCtx** out);
+LR_API void lr_ctx_free(ParserCtx* ctx);
+
+// Drop the last tree in O(1); the stacks and arena slabs are kept
+LR_API void lr_ctx_reset(ParserCtx* ctx);
+
+// Parse input[0..len) and build its tree (valid until the next parse or
+// reset). Returns LR_ACCEPT, LR_REJECT or an LR_ERR_* code.
+LR_API int lr_parse(ParserCtx* ctx, const char* input, size_t len);
+
+// Parse input[0..len) incrementally. 'edits' (sorted by offset, not
+// overlapping, in old coordinates) turn the text of the last accepted
+// lr_reparse into 'input'; the subtrees of its tree that they do not touch
+// are reused whole. The first call after lr_ctx_create, lr_parse,
+// lr_recognize or lr_ctx_reset parses in full and ignores 'edits'. A
+// rejected input keeps the previous tree as the base. Replaced nodes are
+// freed by the occasional full parse that runs once the arena holds four
+// times the nodes of the last full parse.
+LR_API int lr_reparse(ParserCtx* ctx, const char* input, size_t len, const LrEdit* edits,
+                      int num_edits);
+
+// Accept or reject input[0..len) without building a tree
+LR_API int lr_recognize(ParserCtx* ctx, const char* input, size_t len);
+
+// Tree of the last accepted lr_parse or lr_reparse (NULL otherwise). In
+// lr_reparse trees, a leaf's offset counts from the end of the previous
+// leaf; lr_write_tree prints absolute offsets for both.
+LR_API const Node* lr_tree(const ParserCtx* ctx);
+
+// Byte position of the last syntax error (-1 if none)
+LR_API long lr_error_pos(const ParserCtx* ctx);
+
+// Write the last tree in a TREE_* format to 'out'. Returns LR_ACCEPT,
+// LR_REJECT if there is no tree, or LR_ERR_NOMEM (the output stops short).
+LR_API int lr_write_tree(const ParserCtx* ctx, int format, FILE* out);
+
+// Short description of a return code
+LR_API const char* lr_strerror(int code);
+
+#endif // LRPARSER_H
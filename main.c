@@ -3,25 +3,254 @@
 // Function prototypes
 int load_grammar_table(const char* filename, Grammar* grammar, Table* table);
 void print_grammar(Grammar* grammar);
-void print_table(Table* table);
-int parse(Grammar* grammar, Table* table, const char* input, int trace);
+void print_table(Grammar* grammar, Table* table);
+int compress_table(Table* table);
+void free_table(Table* table);
+int save_binary(const char* filename, Grammar* grammar, Table* table);
+extern int bin_verify;
+int save_parser_c(const char* filename, const char* source, Grammar* grammar, Table* table);
+int parse(Grammar* grammar, Table* table, const char* input, int trace, int format);
+int recognize(Grammar* grammar, Table* table, const char* input, int input_len,
+              StateStack* stack, int* error_pos);
+StateStack* create_state_stack(int initial_capacity);
+void free_state_stack(StateStack* stack);
+int diagnose(Grammar* grammar, Table* table, const char* input, int input_len,
+             StateStack* stack, ErrorList* errors);
+void print_errors(const char* input, ErrorList* errors);
+int parse_actions(Grammar* grammar, Table* table, const char* input, int input_len,
+                  ValueStack* stack, SemanticActions* actions, SemValue* value, int* error_pos);
+ValueStack* create_value_stack(int initial_capacity);
+void free_value_stack(ValueStack* stack);
+long run_batch(Grammar* grammar, Table* table, FILE* in, char delim, int tree_format,
+               int all_errors);
+long run_batch_parallel(Grammar* grammar, Table* table, FILE* in, char delim,
+                        int tree_format, int all_errors, int num_threads);
+int run_stream(Grammar* grammar, Table* table, FILE* in, int tree_format);
+int run_mapped(Grammar* grammar, Table* table, const char* path, int tree_format,
+               int num_threads);
+int run_reparse(Grammar* grammar, Table* table, const char* old_path, const char* new_path,
+                int tree_format);
+int run_server(const char* socket_path, int cache_size);
+int generate_table(Grammar* grammar, Table* table, int report);
+void free_grammar(Grammar* grammar);
+void write_table_text(Grammar* grammar, Table* table, FILE* out);
+void prepare_table(Grammar* grammar, Table* table);
+ParserStats* create_stats(int num_states, int num_rules);
+void free_stats(ParserStats* stats);
+void write_stats_json(ParserStats* stats, Grammar* grammar, FILE* out);
+TraceLog* create_trace(const char* path, long keep);
+int finish_trace(TraceLog* log);
+NodeArena* create_arena(size_t slab_size);
+void free_arena(NodeArena* arena);
+int print_tree_as(Node* root, const Grammar* grammar, int format);
+GlrParser* create_glr(Grammar* grammar, Table* table);
+void free_glr(GlrParser* glr);
+int parse_glr(GlrParser* glr, const char* input, int input_len, NodeArena* arena, GlrResult* result);
+double forest_derivations(ForestNode* root);
+void print_forest(ForestNode* root, Grammar* grammar, FILE* out);
+Node* forest_tree(ForestNode* root, NodeArena* arena);
+const char* lr_strerror(int code);
+
+// Release the grammar and table
+static void cleanup(Grammar* grammar, Table* table) {
+    free_grammar(grammar);
+    free_table(table);
+}
+
+// Write the run's counters for -S ("-" = stderr) and stop counting
+static int finish_stats(ParserStats* stats, Grammar* grammar, const char* path) {
+    if (!stats) return 1;
+#ifndef LR_NO_STATS
+    lr_stats = NULL;
+#endif
+    FILE* out = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+    if (out) {
+        write_stats_json(stats, grammar, out);
+        if (out != stderr) fclose(out);
+    } else {
+        fprintf(stderr, "Error: Cannot write stats to %s\n", path);
+    }
+    free_stats(stats);
+    return out != NULL;
+}
+
+// End of a parsing run: write the -S counters and close the -T trace.
+// Returns 0 if either could not be written.
+static int finish_run(ParserStats* stats, Grammar* grammar, const char* stats_path,
+                      TraceLog* trace_log) {
+    int ok = finish_stats(stats, grammar, stats_path);
+    return finish_trace(trace_log) && ok;
+}
+
+// Evaluator for -x: a token's value is the integer it spells (0 otherwise)
+static SemValue eval_shift(int symbol, const char* text, int length, void* user) {
+    (void)symbol;
+    (void)user;
+    SemValue value = { 0 };
+    for (int i = 0; i < length && text[i] >= '0' && text[i] <= '9'; i++) {
+        value.num = value.num * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+// Evaluator for -x: X -> X op X applies + - * /, X -> ( X ) passes the
+// inner value, anything else keeps its first value
+static SemValue eval_reduce(int rule, SemValue* values, int count, void* user) {
+    Rule* r = &((Grammar*)user)->rules[rule];
+    SemValue value = { 0 };
+    if (count == 3 && r->rhs[0] == '(' && r->rhs[2] == ')') {
+        value = values[1];
+    } else if (count == 3 && IS_NONTERMINAL(r->rhs[0]) && IS_NONTERMINAL(r->rhs[2])) {
+        long a = values[0].num;
+        long b = values[2].num;
+        switch (r->rhs[1]) {
+            case '+': value.num = a + b; break;
+            case '-': value.num = a - b; break;
+            case '*': value.num = a * b; break;
+            case '/': value.num = b ? a / b : 0; break;
+            default: value = values[0]; break;
+        }
+    } else if (count > 0) {
+        value = values[0];
+    }
+    return value;
+}
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <grammar_file> [input_string] [-v]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <grammar_file> [input_string] [-v] [-c] [-r] [-a] [-x] [-G] [-f FORMAT]\n", argv[0]);
+        fprintf(stderr, "       %s <grammar_file> -b [input_file] [-0] [-t] [-f FORMAT] [-a] [-j N] [-c]\n", argv[0]);
+        fprintf(stderr, "       %s <grammar_file> -s [input_file] [-t] [-f FORMAT] [-c]\n", argv[0]);
+        fprintf(stderr, "       %s <grammar_file> -m <input_file> [-t] [-f FORMAT] [-j N | -u <old_file>] [-c]\n", argv[0]);
+        fprintf(stderr, "       %s <grammar_file> -o <binary_file> [-c]\n", argv[0]);
+        fprintf(stderr, "       %s <grammar_file> -C <parser.c> [-g]\n", argv[0]);
+        fprintf(stderr, "       %s <grammar_file> -g -e\n", argv[0]);
+        fprintf(stderr, "       %s -d <socket> [-n cache_size]\n", argv[0]);
+        fprintf(stderr, "Any parsing mode also takes -S <stats_file> and -T <trace_file> [-L N]\n");
         fprintf(stderr, "  -v : Enable verbose trace output\n");
+        fprintf(stderr, "  -c : Use the compressed table layout\n");
+        fprintf(stderr, "  -r : Recognize only (accept/reject, no parse tree)\n");
+        fprintf(stderr, "  -a : Report all syntax errors with their expected terminals (error recovery)\n");
+        fprintf(stderr, "  -x : Evaluate the input as integer arithmetic with semantic actions (no tree)\n");
+        fprintf(stderr, "  -G : GLR parse taking every action of conflict cells; prints the parse forest\n");
+        fprintf(stderr, "  -b : Batch mode, one input per line of input_file (default stdin)\n");
+        fprintf(stderr, "  -0 : Batch inputs are NUL-delimited instead of newline-delimited\n");
+        fprintf(stderr, "  -s : Stream one document from input_file (default stdin) in chunks\n");
+        fprintf(stderr, "  -m : Map input_file into memory and parse it in place (any size)\n");
+        fprintf(stderr, "  -u : Parse old_file, then the -m input incrementally from its tree\n");
+        fprintf(stderr, "  -t : Include the parse tree in batch/stream results\n");
+        fprintf(stderr, "  -f : Tree format: compact (default), indent or json (implies -t)\n");
+        fprintf(stderr, "  -j : Number of batch worker threads, or of chunks parsed in parallel with -m (default 1)\n");
+        fprintf(stderr, "  -o : Compile the grammar and table to a binary file and exit\n");
+        fprintf(stderr, "  -V : Verify the checksum of a binary table file while loading it\n");
+        fprintf(stderr, "  -C : Generate a direct-coded C parser for the table and exit\n");
+        fprintf(stderr, "  -g : Generate the LALR(1) table from the rules (ignore any table in the file)\n");
+        fprintf(stderr, "  -e : Print the grammar and table in the text file format and exit\n");
+        fprintf(stderr, "  -S : Write per-state/per-rule counters as JSON at the end of the run (- = stderr)\n");
+        fprintf(stderr, "  -T : Record every engine step to a binary trace file (view with lr_replay)\n");
+        fprintf(stderr, "  -L : Keep only the last N steps in the trace (ring buffer)\n");
+        fprintf(stderr, "  -d : Serve parse requests on a Unix socket until SIGTERM (client: lr_client)\n");
+        fprintf(stderr, "  -n : Number of grammars the daemon keeps loaded (default 16)\n");
+        fprintf(stderr, "Grammar files with rules but no table get a generated table\n");
+        fprintf(stderr, "A binary file can be given instead of the grammar file\n");
         fprintf(stderr, "If no input_string is provided, it will be read from stdin\n");
         return 1;
     }
     
+    // Daemon mode: each request names its grammar
+    if (strcmp(argv[1], "-d") == 0) {
+        int cache_size = 16;
+        for (int i = 3; i + 1 < argc; i++) {
+            if (strcmp(argv[i], "-n") == 0) cache_size = atoi(argv[++i]);
+        }
+        if (argc < 3 || cache_size < 1) {
+            fprintf(stderr, "Error: -d needs a socket path and a cache size of at least 1\n");
+            return 1;
+        }
+        return run_server(argv[2], cache_size);
+    }
+    
     char* filename = argv[1];
     char* input_string = NULL;
     int trace = 0;
+    int compressed = 0;
+    int recognize_only = 0;
+    int all_errors = 0;
+    int evaluate = 0;
+    int glr = 0;
+    int batch = 0;
+    int stream = 0;
+    int mapped = 0;
+    int tree_format = TREE_NONE;
+    char delim = '\n';
+    int num_threads = 1;
+    char* output_file = NULL;
+    char* parser_file = NULL;
+    int generate = 0;
+    int emit = 0;
+    char* stats_file = NULL;
+    char* trace_file = NULL;
+    long trace_keep = 0;
+    char* old_file = NULL;
     
     // Parse command line arguments
     for (int i = 2; i < argc; i++) {
         if (strcmp(argv[i], "-v") == 0) {
             trace = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            compressed = 1;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            recognize_only = 1;
+        } else if (strcmp(argv[i], "-x") == 0) {
+            evaluate = 1;
+        } else if (strcmp(argv[i], "-G") == 0) {
+            glr = 1;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            all_errors = 1;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            stream = 1;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            mapped = 1;
+        } else if (strcmp(argv[i], "-0") == 0) {
+            delim = '\0';
+        } else if (strcmp(argv[i], "-t") == 0) {
+            if (tree_format == TREE_NONE) tree_format = TREE_COMPACT;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "compact") == 0) {
+                tree_format = TREE_COMPACT;
+            } else if (strcmp(argv[i], "indent") == 0) {
+                tree_format = TREE_INDENT;
+            } else if (strcmp(argv[i], "json") == 0) {
+                tree_format = TREE_JSON;
+            } else {
+                fprintf(stderr, "Error: Unknown tree format %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-g") == 0) {
+            generate = 1;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            emit = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (strcmp(argv[i], "-V") == 0) {
+            bin_verify = 1;
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            parser_file = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+            if (num_threads < 1) num_threads = 1;
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            old_file = argv[++i];
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            stats_file = argv[++i];
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            trace_keep = atol(argv[++i]);
+            if (trace_keep < 1) trace_keep = 1;
         } else if (input_string == NULL) {
             input_string = argv[i];
         }
@@ -31,18 +260,141 @@ int main(int argc, char* argv[]) {
     Grammar grammar;
     Table table;
     
-    printf("Loading grammar from: %s\n", filename);
+    int quiet = batch || stream || mapped || output_file || parser_file || emit;
+    if (!quiet) {
+        printf("Loading grammar from: %s\n", filename);
+    }
+    double load_start = stats_now_ns();
     if (!load_grammar_table(filename, &grammar, &table)) {
         fprintf(stderr, "Failed to load grammar and table\n");
         return 1;
     }
     
+    // Replace the stored table by one derived from the rules
+    if (generate) {
+        if (table.mapping) {
+            fprintf(stderr, "Error: Cannot regenerate the table of a binary file\n");
+            cleanup(&grammar, &table);
+            return 1;
+        }
+        free_table(&table);
+        if (generate_table(&grammar, &table, 2) < 0) {
+            cleanup(&grammar, &table);
+            return 1;
+        }
+        prepare_table(&grammar, &table);
+    }
+    
+    // Emit step: print the text format and exit
+    if (emit) {
+        write_table_text(&grammar, &table, stdout);
+        cleanup(&grammar, &table);
+        return 0;
+    }
+    
+    if (compressed && !compress_table(&table)) {
+        fprintf(stderr, "Warning: mapped tables cannot be compressed, using the stored layout\n");
+    }
+    
+    // Compile step: write the binary table and exit
+    if (output_file) {
+        int ok = save_binary(output_file, &grammar, &table);
+        cleanup(&grammar, &table);
+        return ok ? 0 : 1;
+    }
+    
+    // Code generation step: write the direct-coded parser and exit
+    if (parser_file) {
+        int ok = save_parser_c(parser_file, filename, &grammar, &table);
+        cleanup(&grammar, &table);
+        return ok ? 0 : 1;
+    }
+    
+    // Counters for -S, shared by every parsing mode below
+    ParserStats* stats = NULL;
+    if (stats_file) {
+        stats = create_stats(table.num_states, grammar.num_rules);
+        if (!stats) {
+            fprintf(stderr, "Error: %s\n", lr_strerror(-2));
+            return 1;
+        }
+        stats->phase_ns[PHASE_LOAD] = stats_now_ns() - load_start;
+#ifndef LR_NO_STATS
+        lr_stats = stats;
+#endif
+    }
+    
+    // Step trace for -T; worker threads of -j are not recorded
+    TraceLog* trace_log = NULL;
+    if (trace_file) {
+        trace_log = create_trace(trace_file, trace_keep);
+        if (!trace_log) {
+            finish_stats(stats, &grammar, stats_file);
+            cleanup(&grammar, &table);
+            return 1;
+        }
+        if (num_threads > 1) {
+            fprintf(stderr, "Warning: -T records the main thread only; run without -j to trace every step\n");
+        }
+#ifndef LR_NO_TRACE
+        lr_trace = trace_log;
+#endif
+    }
+    
+    // Batch and stream modes: stdout carries only the results
+    if (batch && tree_format == TREE_INDENT) {
+        fprintf(stderr, "Error: Batch results are one line each; use -f compact or -f json\n");
+        finish_run(stats, &grammar, stats_file, trace_log);
+        cleanup(&grammar, &table);
+        return 1;
+    }
+    if (mapped) {
+        int status = -1;
+        if (input_string && old_file) {
+            status = run_reparse(&grammar, &table, old_file, input_string, tree_format);
+        } else if (input_string) {
+            status = run_mapped(&grammar, &table, input_string, tree_format, num_threads);
+        } else {
+            fprintf(stderr, "Error: -m needs an input file\n");
+        }
+        int written = finish_run(stats, &grammar, stats_file, trace_log);
+        cleanup(&grammar, &table);
+        return status == 1 && written ? 0 : 1;
+    }
+    if (batch || stream) {
+        FILE* in = stdin;
+        if (input_string && strcmp(input_string, "-") != 0) {
+            in = fopen(input_string, "rb");
+            if (!in) {
+                fprintf(stderr, "Error: Cannot open file %s\n", input_string);
+                finish_run(stats, &grammar, stats_file, trace_log);
+                cleanup(&grammar, &table);
+                return 1;
+            }
+        }
+        long rejected;
+        if (stream) {
+            rejected = !run_stream(&grammar, &table, in, tree_format);
+        } else if (num_threads > 1) {
+            rejected = run_batch_parallel(&grammar, &table, in, delim, tree_format, all_errors,
+                                          num_threads);
+        } else {
+            rejected = run_batch(&grammar, &table, in, delim, tree_format, all_errors);
+        }
+        if (in != stdin) {
+            fclose(in);
+        }
+        int written = finish_run(stats, &grammar, stats_file, trace_log);
+        cleanup(&grammar, &table);
+        return rejected == 0 && written ? 0 : 1;
+    }
+    
     printf("\n=== Grammar ===\n");
     print_grammar(&grammar);
     
     if (trace) {
         printf("\n=== Table Preview ===\n");
-        print_table(&table);
+        print_table(&grammar, &table);
     }
     
     // Get input string if not provided
@@ -55,28 +407,84 @@ int main(int argc, char* argv[]) {
             input_string = input_buffer;
         } else {
             fprintf(stderr, "Failed to read input\n");
+            finish_run(stats, &grammar, stats_file, trace_log);
+            cleanup(&grammar, &table);
             return 1;
         }
     }
     
     printf("\n=== Parsing: %s ===\n", input_string);
     
-    // Parse the input
-    int result = parse(&grammar, &table, input_string, trace);
+    // Parse the input (status: 1 = accept, 0 = reject, < 0 = engine failure)
+    int status;
+    if (all_errors) {
+        StateStack* states = create_state_stack(100);
+        ErrorList errors = { NULL, 0, 0 };
+        STAT_TIME_BEGIN(parse_start);
+        status = diagnose(&grammar, &table, input_string, strlen(input_string), states, &errors);
+        STAT_TIME_END(parse_start, PHASE_PARSE);
+        print_errors(input_string, &errors);
+        free(errors.items);
+        free_state_stack(states);
+    } else if (evaluate) {
+        ValueStack* values = create_value_stack(100);
+        SemanticActions actions = { eval_shift, eval_reduce, &grammar };
+        SemValue value;
+        int error_pos;
+        STAT_TIME_BEGIN(parse_start);
+        status = parse_actions(&grammar, &table, input_string, strlen(input_string), values,
+                               &actions, &value, &error_pos);
+        STAT_TIME_END(parse_start, PHASE_PARSE);
+        if (status == 1) {
+            printf("Value: %ld\n", value.num);
+        } else if (status == 0) {
+            printf("REJECT at position %d\n", error_pos);
+        }
+        free_value_stack(values);
+    } else if (glr) {
+        GlrParser* parser = create_glr(&grammar, &table);
+        NodeArena* arena = create_arena(64 * 1024);
+        GlrResult forest;
+        STAT_TIME_BEGIN(parse_start);
+        status = parse_glr(parser, input_string, strlen(input_string), arena, &forest);
+        STAT_TIME_END(parse_start, PHASE_PARSE);
+        if (status == 1) {
+            print_forest(forest.root, &grammar, stdout);
+            printf("Derivations: %.0f\n", forest_derivations(forest.root));
+            printf("Parse tree: ");
+            print_tree_as(forest_tree(forest.root, arena), &grammar,
+                          tree_format != TREE_NONE ? tree_format : TREE_COMPACT);
+        } else {
+            printf("REJECT at position %d\n", forest.error_pos);
+        }
+        printf("Stack tops: %d max\n", forest.max_tops);
+        free_arena(arena);
+        free_glr(parser);
+    } else if (recognize_only) {
+        StateStack* states = create_state_stack(100);
+        int error_pos;
+        STAT_TIME_BEGIN(parse_start);
+        status = recognize(&grammar, &table, input_string, strlen(input_string), states, &error_pos);
+        STAT_TIME_END(parse_start, PHASE_PARSE);
+        if (status == 0) {
+            printf("REJECT at position %d\n", error_pos);
+        }
+        free_state_stack(states);
+    } else {
+        status = parse(&grammar, &table, input_string, trace,
+                       tree_format != TREE_NONE ? tree_format : TREE_COMPACT);
+    }
+    if (status < 0) fprintf(stderr, "Error: %s\n", lr_strerror(status));
     
-    if (result) {
+    if (status == 1) {
         printf("\nResult: ACCEPT\n");
     } else {
         printf("\nResult: REJECT\n");
     }
     
     // Cleanup
-    if (grammar.rules) {
-        free(grammar.rules);
-    }
-    if (table.data) {
-        free(table.data);
-    }
+    int written = finish_run(stats, &grammar, stats_file, trace_log);
+    cleanup(&grammar, &table);
     
-    return result ? 0 : 1;
+    return status == 1 && written ? 0 : 1;
 }
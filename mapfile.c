@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE     // madvise
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "structs.h"
+
+// Large-document mode: the input file is mapped read-only and parsed in
+// place. Nothing is copied into heap buffers; tree leaves only record
+// byte offsets into the file, so the text of a leaf is map[offset..+length).
+
+// Function prototypes from other modules
+int parse_input(Grammar* grammar, Table* table, const char* input, int input_len,
+                int trace, Stack* stack, NodeArena* arena, ParseResult* result);
+int recognize(Grammar* grammar, Table* table, const char* input, int input_len,
+              StateStack* stack, int* error_pos);
+Stack* create_stack(int initial_capacity);
+void free_stack(Stack* stack);
+StateStack* create_state_stack(int initial_capacity);
+void free_state_stack(StateStack* stack);
+NodeArena* create_arena(size_t slab_size);
+void free_arena(NodeArena* arena);
+int print_tree_as(Node* root, const Grammar* grammar, int format);
+ParserStream* parser_stream_create(Grammar* grammar, Table* table, NodeArena* arena);
+void parser_stream_free(ParserStream* ctx);
+int parser_feed(ParserStream* ctx, const char* buf, size_t len);
+int parser_finish(ParserStream* ctx);
+int parse_parallel(Grammar* grammar, Table* table, const char* input, long len,
+                   int num_threads, NodeArena* arena, ParseResult* result,
+                   ParallelReport* report);
+const char* lr_strerror(int code);
+
+// Files beyond the engines' int positions are fed to the push parser in
+// windows of the mapping; pages of a finished window are dropped
+#define MAP_WINDOW ((size_t)1 << 30)
+
+// Parse a mapping larger than INT_MAX bytes window by window. Returns 1
+// on accept, 0 on reject, -1 on a table error, -2 if out of memory.
+static int parse_windows(Grammar* grammar, Table* table, const char* map, size_t size,
+                         NodeArena* arena, ParseResult* result) {
+    ParserStream* ctx = parser_stream_create(grammar, table, arena);
+    if (!ctx) return -2;
+    for (size_t off = 0; off < size; off += MAP_WINDOW) {
+        size_t len = size - off < MAP_WINDOW ? size - off : MAP_WINDOW;
+        int running = parser_feed(ctx, map + off, len);
+        // Leaves keep offsets, not pointers, so read pages can go
+        madvise((void*)(map + off), len, MADV_DONTNEED);
+        if (!running) break;
+    }
+    int status = parser_finish(ctx);
+    if (ctx->status == STREAM_FAILED) status = ctx->failure;
+    *result = ctx->result;
+    parser_stream_free(ctx);
+    return status;
+}
+
+// Map 'path' and parse it in place, in chunks on 'num_threads' threads if
+// more than one. Prints "ACCEPT[\t<tree>]" or "REJECT\t<pos>" like the
+// stream mode; returns 1 on accept, 0 on reject, -1 if the file cannot be
+// mapped.
+int run_mapped(Grammar* grammar, Table* table, const char* path, int tree_format,
+               int num_threads) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot stat file %s\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const char* map = "";
+    if (size > 0) {
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            fprintf(stderr, "Error: Cannot map file %s\n", path);
+            close(fd);
+            return -1;
+        }
+        // One forward pass: aggressive read-ahead, pages dropped early
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        map = (const char*)mapping;
+    }
+    close(fd);
+
+    NodeArena* arena = tree_format ? create_arena(1024 * 1024) : NULL;
+    if (tree_format && !arena) {
+        fprintf(stderr, "Error: %s\n", lr_strerror(-2));
+        if (size > 0) munmap((void*)map, size);
+        return 0;
+    }
+    ParseResult result = { 0, -1, NULL };
+    int status;
+
+    STAT_TIME_BEGIN(parse_start);
+    if (num_threads > 1) {
+        ParallelReport report;
+        status = parse_parallel(grammar, table, map, (long)size, num_threads, arena, &result, &report);
+        if (report.chunks > 1) {
+            fprintf(stderr, "Parallel: %d chunks, %d stitched, %d reparsed\n",
+                    report.chunks, report.stitched, report.reparsed);
+        }
+    } else if (size > INT_MAX) {
+        status = parse_windows(grammar, table, map, size, arena, &result);
+    } else if (arena) {
+        Stack* stack = create_stack(1024);
+        status = parse_input(grammar, table, map, (int)size, 0, stack, arena, &result);
+        free_stack(stack);
+    } else {
+        StateStack* states = create_state_stack(1024);
+        int error_pos;
+        status = recognize(grammar, table, map, (int)size, states, &error_pos);
+        result.accepted = status == 1;
+        result.error_pos = error_pos;
+        free_state_stack(states);
+    }
+    STAT_TIME_END(parse_start, PHASE_PARSE);
+    if (status < 0) fprintf(stderr, "Error: %s\n", lr_strerror(status));
+
+    STAT_TIME_BEGIN(output_start);
+    if (status == 1) {
+        printf("ACCEPT");
+        if (result.tree) {
+            printf("\t");
+            print_tree_as(result.tree, grammar, tree_format);
+        } else {
+            printf("\n");
+        }
+    } else {
+        printf("REJECT\t%ld\n", result.error_pos);
+    }
+    STAT_TIME_END(output_start, PHASE_OUTPUT);
+
+    if (arena) free_arena(arena);
+    if (size > 0) munmap((void*)map, size);
+    return status == 1;
+}
@@ -0,0 +1,413 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include "structs.h"
+
+// Parallel parsing of one document. The input is cut into chunks right
+// after split terminals (the %sync set, or the terminals that close a
+// recursive rule such as ')' in T:(T)T). A prefix of the input is parsed
+// first to guess the top of the LR stack at those points. Every chunk but
+// the first is then parsed on its own thread from that guessed stack, whose
+// entries carry placeholder ("hole") nodes. The chunks are joined in order:
+// where the real stack at a boundary matches the guess, the chunk's stack
+// replaces the part of it that the chunk reduced, and the holes are filled
+// with the real subtrees. Any other boundary is parsed again sequentially,
+// as is a chunk whose thread or memory could not be had.
+
+// Function prototypes from other modules
+Node* arena_node(NodeArena* arena, int symbol);
+NodeArena* create_arena(size_t slab_size);
+void arena_adopt(NodeArena* arena, NodeArena* other);
+void free_arena(NodeArena* arena);
+int push(Stack* stack, int state, Node* node);
+int lex_scan(const Lexer* lexer, const char* input, int len, int pos,
+             int* start, int* end, int partial);
+ParserStream* parser_stream_create(Grammar* grammar, Table* table, NodeArena* arena);
+void parser_stream_free(ParserStream* ctx);
+int parser_feed(ParserStream* ctx, const char* buf, size_t len);
+int parser_finish(ParserStream* ctx);
+#ifndef LR_NO_STATS
+ParserStats* create_stats(int num_states, int num_rules);
+void free_stats(ParserStats* stats);
+void merge_stats(ParserStats* dst, ParserStats* src);
+#endif
+
+#define GUESS_DEPTH 16              // Stack entries a chunk starts from
+#define GUESS_SAMPLE (256 * 1024)   // Prefix parsed to guess the stack
+#define GUESS_SNAPSHOTS 4096        // Stacks recorded in the prefix at most
+#define GUESS_CONTEXT 8             // Bytes up to a split point matched for it
+#define GUESS_WINDOW (1024 * 1024)  // How far past its target a chunk may start
+#define FEED_PIECE ((long)1 << 30)  // parser_feed takes int-sized pieces
+
+// Top of an LR stack at a split point (bottom first), and the input bytes
+// that end at that point
+typedef struct {
+    int depth;
+    int states[GUESS_DEPTH];
+    int context_len;
+    char context[GUESS_CONTEXT];
+} StackGuess;
+
+// One chunk input[start..end) and the thread parsing it
+typedef struct {
+    Grammar* grammar;
+    Table* table;
+    const char* input;
+    long start;
+    long end;
+    const StackGuess* guess;    // NULL: the chunk starts the document
+    NodeArena* arena;           // Tree nodes (NULL = recognize only)
+    ParserStream* stream;
+    Node* holes[GUESS_DEPTH];   // Placeholders of the guessed stack entries
+    ParserStats* stats;
+    pthread_t thread;
+    int started;                // 1 once 'thread' runs
+} Chunk;
+
+// Feed input[from..to) in pieces the lexer can index with an int
+static int feed_range(ParserStream* ctx, const char* input, long from, long to) {
+    int running = ctx->status == STREAM_RUNNING;
+    while (running && from < to) {
+        long len = to - from < FEED_PIECE ? to - from : FEED_PIECE;
+        running = parser_feed(ctx, input + from, (size_t)len);
+        from += len;
+    }
+    return running;
+}
+
+// 1 if 'symbol' names the rule's LHS. Files with their own table may
+// spell it without '$' in the RHS (T:(T)T), which reads as a terminal.
+static int is_lhs(int symbol, const Rule* rule) {
+    return symbol == rule->lhs ||
+           (rule->lhs < NT_BASE + NT_LETTERS && symbol == 'A' + NT_INDEX(rule->lhs));
+}
+
+// Terminals the input may be cut after: %sync if declared, otherwise the
+// terminal ending a left-recursive rule (X -> X ... t) or preceding the
+// tail of a right-recursive one (X -> ... t X). With a lexer, a terminal
+// only qualifies if it is a complete one-byte token.
+static int split_terminals(Grammar* grammar, uint64_t split[TERMSET_WORDS]) {
+    memcpy(split, grammar->sync, sizeof(grammar->sync));
+    if (termset_empty(split)) {
+        for (int r = 0; r < grammar->num_rules; r++) {
+            Rule* rule = &grammar->rules[r];
+            int last = rule->rhs_len - 1;
+            if (last < 1) continue;
+            if (is_lhs(rule->rhs[0], rule) && IS_TERMINAL(rule->rhs[last])) {
+                TERMSET_ADD(split, rule->rhs[last]);
+            }
+            if (is_lhs(rule->rhs[last], rule) && IS_TERMINAL(rule->rhs[last - 1])) {
+                TERMSET_ADD(split, rule->rhs[last - 1]);
+            }
+        }
+    }
+    int count = 0;
+    for (int c = 0; c < NT_BASE; c++) {
+        if (!TERMSET_HAS(split, c)) continue;
+        if (grammar->lexer) {
+            char byte = (char)c;
+            int start, end;
+            if (lex_scan(grammar->lexer, &byte, 1, 0, &start, &end, 1) != c || end != 1) {
+                split[c >> 6] &= ~((uint64_t)1 << (c & 63));
+                continue;
+            }
+        }
+        count++;
+    }
+    return count;
+}
+
+// Next split byte at or after 'from' (-1 if none)
+static long next_split(const char* input, long from, long len, const uint64_t split[TERMSET_WORDS]) {
+    for (long i = from; i < len; i++) {
+        unsigned char c = (unsigned char)input[i];
+        if (TERMSET_HAS(split, c)) return i;
+    }
+    return -1;
+}
+
+// Order by stack top only
+static int compare_states(const StackGuess* x, const StackGuess* y) {
+    if (x->depth != y->depth) return x->depth - y->depth;
+    return memcmp(x->states, y->states, x->depth * sizeof(int));
+}
+
+// Order by stack top, then by context
+static int compare_guess(const void* a, const void* b) {
+    const StackGuess* x = (const StackGuess*)a;
+    const StackGuess* y = (const StackGuess*)b;
+    int order = compare_states(x, y);
+    if (order != 0) return order;
+    if (x->context_len != y->context_len) return x->context_len - y->context_len;
+    return memcmp(x->context, y->context, x->context_len);
+}
+
+// 1 if the input up to and including input[at] ends with the guess context
+static int has_context(const char* input, long at, const StackGuess* guess) {
+    long from = at + 1 - guess->context_len;
+    return from >= 0 && memcmp(input + from, guess->context, guess->context_len) == 0;
+}
+
+// Where chunk 'target' should start: after the first split byte at or past
+// 'target' preceded by the guess context, or after the first split byte if
+// none is near. Returns -1 if no split byte follows.
+static long chunk_start(const char* input, long target, long len,
+                        const uint64_t split[TERMSET_WORDS], const StackGuess* guess) {
+    long first = next_split(input, target, len, split);
+    for (long at = first; at >= 0 && at - first < GUESS_WINDOW; at = next_split(input, at + 1, len, split)) {
+        if (has_context(input, at, guess)) return at + 1;
+    }
+    return first < 0 ? -1 : first + 1;
+}
+
+// Parse a prefix and take the most frequent stack top found right after a
+// split byte, with its most frequent context (the same split byte may end
+// different constructs). Returns 0 if no split point of the prefix is a
+// token boundary, or if out of memory.
+static int guess_stack(Grammar* grammar, Table* table, const char* input, long len,
+                       const uint64_t split[TERMSET_WORDS], StackGuess* guess) {
+#ifndef LR_NO_STATS
+    // The prefix is parsed again for real: keep it out of the counters
+    ParserStats* saved_stats = lr_stats;
+    lr_stats = NULL;
+#endif
+    long limit = len < GUESS_SAMPLE ? len : GUESS_SAMPLE;
+    StackGuess* seen = (StackGuess*)malloc(GUESS_SNAPSHOTS * sizeof(StackGuess));
+    ParserStream* ctx = seen ? parser_stream_create(grammar, table, NULL) : NULL;
+    int count = 0;
+    long fed = 0;
+    long at;
+    while (ctx && count < GUESS_SNAPSHOTS && (at = next_split(input, fed, limit, split)) >= 0) {
+        if (!parser_feed(ctx, input + fed, at + 1 - fed)) break;
+        fed = at + 1;
+        if (ctx->pending_len != 0 || ctx->pos != fed) continue;
+        StackGuess* snap = &seen[count++];
+        snap->depth = ctx->stack->top + 1 < GUESS_DEPTH ? ctx->stack->top + 1 : GUESS_DEPTH;
+        memset(snap->states, 0, sizeof(snap->states));
+        int base = ctx->stack->top + 1 - snap->depth;
+        for (int i = 0; i < snap->depth; i++) {
+            snap->states[i] = ctx->stack->elements[base + i].state;
+        }
+        snap->context_len = fed < GUESS_CONTEXT ? (int)fed : GUESS_CONTEXT;
+        memcpy(snap->context, input + fed - snap->context_len, snap->context_len);
+    }
+    if (ctx) parser_stream_free(ctx);
+#ifndef LR_NO_STATS
+    lr_stats = saved_stats;
+#endif
+
+    qsort(seen, count, sizeof(StackGuess), compare_guess);
+    int best = 0;
+    for (int i = 0, run = 0; i < count; i += run) {
+        for (run = 1; i + run < count && compare_states(&seen[i], &seen[i + run]) == 0; run++) {}
+        if (run <= best) continue;
+        best = run;
+        // Contexts of one stack top are sorted together
+        int best_context = 0;
+        for (int k = i, same = 0; k < i + run; k += same) {
+            for (same = 1; k + same < i + run && compare_guess(&seen[k], &seen[k + same]) == 0; same++) {}
+            if (same > best_context) {
+                best_context = same;
+                *guess = seen[k];
+            }
+        }
+    }
+    free(seen);
+    return best > 0;
+}
+
+// Parse one chunk from its starting stack. Leaves chunk->stream NULL, or
+// failed, if out of memory.
+static void parse_chunk(Chunk* chunk) {
+    ParserStream* stream = parser_stream_create(chunk->grammar, chunk->table, chunk->arena);
+    chunk->stream = stream;
+    if (!stream) return;
+    if (chunk->guess) {
+        // Same document: only the first chunk counts as an input
+        STAT_ADD(inputs, -1);
+        stream->stack->top = -1;
+        for (int i = 0; i < chunk->guess->depth; i++) {
+            chunk->holes[i] = chunk->arena ? arena_node(chunk->arena, 0) : NULL;
+            if ((chunk->arena && !chunk->holes[i]) ||
+                !push(stream->stack, chunk->guess->states[i], chunk->holes[i])) {
+                stream->status = STREAM_FAILED;
+                stream->failure = -2;
+                return;
+            }
+        }
+        stream->pos = chunk->start;
+        stream->fed = chunk->start;
+    }
+    feed_range(stream, chunk->input, chunk->start, chunk->end);
+}
+
+// Worker thread of a chunk after the first
+static void* chunk_main(void* arg) {
+    Chunk* chunk = (Chunk*)arg;
+#ifndef LR_NO_STATS
+    lr_stats = chunk->stats;
+#endif
+    parse_chunk(chunk);
+    return NULL;
+}
+
+// Number of guessed entries the chunk left untouched, or -1 if 'ctx' is not
+// in the guessed configuration at the start of the chunk
+static int stitch_point(ParserStream* ctx, Chunk* chunk) {
+    const StackGuess* guess = chunk->guess;
+    Stack* stack = ctx->stack;
+    if (ctx->pending_len != 0 || ctx->pos != chunk->start) return -1;
+    if (stack->top + 1 < guess->depth) return -1;
+    int base = stack->top + 1 - guess->depth;
+    for (int i = 0; i < guess->depth; i++) {
+        if (stack->elements[base + i].state != guess->states[i]) return -1;
+    }
+    Stack* ws = chunk->stream->stack;
+    int kept = 0;
+    while (kept < guess->depth && kept <= ws->top &&
+           ws->elements[kept].state == guess->states[kept] &&
+           ws->elements[kept].node == chunk->holes[kept]) {
+        kept++;
+    }
+    return kept;
+}
+
+// Replace the entries above the first 'kept' guessed ones with the chunk's
+// stack. The entries the chunk reduced become the content of their holes.
+// Returns 0 if out of memory.
+static int stitch(ParserStream* ctx, Chunk* chunk, int kept) {
+    Stack* stack = ctx->stack;
+    Stack* ws = chunk->stream->stack;
+    int base = stack->top + 1 - chunk->guess->depth;
+    for (int i = kept; i < chunk->guess->depth; i++) {
+        Node* real = stack->elements[base + i].node;
+        if (chunk->holes[i] && real) *chunk->holes[i] = *real;
+    }
+    stack->top = base + kept - 1;
+    for (int i = kept; i <= ws->top; i++) {
+        if (!push(stack, ws->elements[i].state, ws->elements[i].node)) return 0;
+    }
+    return 1;
+}
+
+// Parse input[0..len) with up to 'num_threads' chunks in parallel. The
+// tree (if 'arena' is set) is built in 'arena'. The first chunk runs on the
+// calling thread. 'report' receives the chunk counts. Returns 1 on accept,
+// 0 on reject, -1 on a table error, -2 if out of memory.
+int parse_parallel(Grammar* grammar, Table* table, const char* input, long len,
+                   int num_threads, NodeArena* arena, ParseResult* result,
+                   ParallelReport* report) {
+    uint64_t split[TERMSET_WORDS];
+    StackGuess guess;
+    int num_chunks = 1;
+    long single[2];
+    long* bounds = num_threads > 1 ? (long*)malloc((num_threads + 1) * sizeof(long)) : NULL;
+    if (!bounds) {
+        // One chunk: the whole input on the calling thread
+        bounds = single;
+        num_threads = 1;
+    }
+    bounds[0] = 0;
+    if (num_threads > 1 && split_terminals(grammar, split) > 0 &&
+        guess_stack(grammar, table, input, len, split, &guess)) {
+        // Chunk j starts after a split byte near j * len / N
+        for (int j = 1; j < num_threads; j++) {
+            long target = len / num_threads * j;
+            if (target < bounds[num_chunks - 1]) target = bounds[num_chunks - 1];
+            long start = chunk_start(input, target, len, split, &guess);
+            if (start < 0 || start >= len) break;
+            if (start > bounds[num_chunks - 1]) bounds[num_chunks++] = start;
+        }
+    }
+
+    Chunk first;
+    Chunk* chunks = (Chunk*)calloc(num_chunks, sizeof(Chunk));
+    if (!chunks) {
+        memset(&first, 0, sizeof(first));
+        chunks = &first;
+        num_chunks = 1;
+    }
+    bounds[num_chunks] = len;
+    for (int j = 0; j < num_chunks; j++) {
+        Chunk* chunk = &chunks[j];
+        chunk->grammar = grammar;
+        chunk->table = table;
+        chunk->input = input;
+        chunk->start = bounds[j];
+        chunk->end = bounds[j + 1];
+        chunk->guess = j > 0 ? &guess : NULL;
+        if (j == 0) {
+            chunk->arena = arena;
+            continue;
+        }
+        // A chunk without its arena, counters or thread is parsed in the join
+        chunk->arena = arena ? create_arena(1024 * 1024) : NULL;
+        if (arena && !chunk->arena) continue;
+#ifndef LR_NO_STATS
+        if (lr_stats) {
+            chunk->stats = create_stats(lr_stats->num_states, lr_stats->num_rules);
+            if (!chunk->stats) continue;
+        }
+#endif
+        chunk->started = pthread_create(&chunk->thread, NULL, chunk_main, chunk) == 0;
+    }
+    parse_chunk(&chunks[0]);
+    for (int j = 1; j < num_chunks; j++) {
+        if (chunks[j].started) pthread_join(chunks[j].thread, NULL);
+    }
+
+    // Join the chunks in input order onto the first one's stack
+    ParserStream* ctx = chunks[0].stream;
+    int stitched = 0;
+    int reparsed = 0;
+    for (int j = 1; ctx && j < num_chunks && ctx->status == STREAM_RUNNING; j++) {
+        Chunk* chunk = &chunks[j];
+        int kept = chunk->stream && chunk->stream->status != STREAM_FAILED ? stitch_point(ctx, chunk) : -1;
+        if (kept < 0) {
+            // Wrong guess, the chunk reduced below the guessed entries, or
+            // the chunk did not run
+            reparsed++;
+            feed_range(ctx, input, chunk->start, chunk->end);
+            continue;
+        }
+        stitched++;
+        if (!stitch(ctx, chunk, kept)) {
+            ctx->status = STREAM_FAILED;
+            ctx->failure = -2;
+            break;
+        }
+        if (chunk->stream->status == STREAM_REJECTED) {
+            ctx->status = STREAM_REJECTED;
+            ctx->result.error_pos = chunk->stream->result.error_pos;
+            break;
+        }
+        // Bytes after the chunk's last token (skipped or pending) again
+        ctx->pos = chunk->stream->pos;
+        ctx->fed = chunk->stream->pos;
+        feed_range(ctx, input, chunk->stream->pos, chunk->end);
+    }
+    int status = -2;
+    if (ctx) {
+        status = parser_finish(ctx);
+        if (ctx->status == STREAM_FAILED) status = ctx->failure;
+        *result = ctx->result;
+    }
+    report->chunks = num_chunks;
+    report->stitched = stitched;
+    report->reparsed = reparsed;
+
+    for (int j = 0; j < num_chunks; j++) {
+        Chunk* chunk = &chunks[j];
+        if (chunk->stream) parser_stream_free(chunk->stream);
+        // The tree may hold nodes of any chunk
+        if (j > 0 && chunk->arena) arena_adopt(arena, chunk->arena);
+#ifndef LR_NO_STATS
+        if (chunk->stats) {
+            merge_stats(lr_stats, chunk->stats);
+            free_stats(chunk->stats);
+        }
+#endif
+    }
+    if (chunks != &first) free(chunks);
+    if (bounds != single) free(bounds);
+    return status;
+}
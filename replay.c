@@ -0,0 +1,341 @@
+#include <limits.h>
+#include "structs.h"
+
+// Trace viewer (lr_replay): replays a binary trace written by lr_parser -T
+// as the "Flot | Pile" view of -v, one line per step, filtered by state or
+// rule, or compares two traces and reports where they diverge.
+
+// Function prototypes from other modules
+int load_grammar_table(const char* filename, Grammar* grammar, Table* table);
+void free_grammar(Grammar* grammar);
+void free_table(Table* table);
+void write_symbol(FILE* out, const Grammar* grammar, int symbol, int lhs);
+
+#define FLOT_WIDTH 32   // Input bytes shown after the position
+#define PILE_WIDTH 16   // Top states shown
+
+// Sequential reader of a trace file
+typedef struct {
+    FILE* fp;
+    const char* path;
+    TraceHeader header;
+    long index;         // Step number of the next step
+    long input_len;     // Length of the traced input (-1 = not known)
+    int bad;            // A step could not have been recorded (damaged file)
+} TraceReader;
+
+// Open a trace file and check its header; returns 0 on error
+static int open_trace(TraceReader* reader, const char* path) {
+    reader->fp = fopen(path, "rb");
+    if (!reader->fp) {
+        fprintf(stderr, "Error: Cannot open trace %s\n", path);
+        return 0;
+    }
+    if (fread(&reader->header, sizeof(TraceHeader), 1, reader->fp) != 1 ||
+        memcmp(reader->header.magic, TRACE_MAGIC, sizeof(reader->header.magic)) != 0 ||
+        reader->header.step_size != (int)sizeof(TraceStep)) {
+        fprintf(stderr, "Error: %s is not a trace file of this build\n", path);
+        fclose(reader->fp);
+        return 0;
+    }
+    reader->path = path;
+    reader->index = reader->header.skipped;
+    reader->input_len = -1;
+    reader->bad = 0;
+    return 1;
+}
+
+// Report a step that no engine could have recorded; returns 0
+static int bad_step(TraceReader* reader) {
+    fprintf(stderr, "Error: %s: bad step %ld\n", reader->path, reader->index - 1);
+    reader->bad = 1;
+    return 0;
+}
+
+// Read the next step; returns 0 at the end of the trace, or if the step is
+// out of range (reader->bad set)
+static int next_step(TraceReader* reader, TraceStep* step) {
+    if (reader->bad || fread(step, sizeof(TraceStep), 1, reader->fp) != 1) return 0;
+    reader->index++;
+    if ((step->kind != TRACE_ACTION && step->kind != TRACE_BEGIN) || step->depth < 1 ||
+        step->pos < 0 || (reader->input_len >= 0 && step->pos > reader->input_len) ||
+        step->state < 0 || step->next < 0 || step->action < ACTION_ACCEPT) {
+        return bad_step(reader);
+    }
+    return 1;
+}
+
+// Parser stack rebuilt from the steps; states below a ring's first step
+// are unknown (-1)
+typedef struct {
+    int* states;
+    int len;
+    int capacity;
+} ReplayStack;
+
+// Whether the step's depth can follow the stack: an input starts at depth
+// 1, and an action pushes one state at most (the first step of a ring may
+// start at any depth). Returns 0 (reader->bad set) if not.
+static int step_follows(TraceReader* reader, const ReplayStack* stack, const TraceStep* step) {
+    int ok = step->kind == TRACE_BEGIN ? step->depth == 1 : stack->len == 0 || step->depth <= stack->len + 1;
+    return ok ? 1 : bad_step(reader);
+}
+
+// Apply one step to the stack; returns 0 if out of memory
+static int replay_step(ReplayStack* stack, const TraceStep* step) {
+    if (step->kind == TRACE_BEGIN) {
+        stack->len = 0;
+    } else if (step->action == ACTION_ACCEPT || step->action == ACTION_ERROR) {
+        return 1;
+    }
+    if (step->depth > stack->capacity) {
+        int capacity = stack->capacity ? stack->capacity : 256;
+        while (capacity < step->depth) capacity = capacity <= INT_MAX / 2 ? capacity * 2 : INT_MAX;
+        int* states = (int*)realloc(stack->states, (size_t)capacity * sizeof(int));
+        if (!states) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 0;
+        }
+        stack->states = states;
+        stack->capacity = capacity;
+    }
+    while (stack->len < step->depth - 1) stack->states[stack->len++] = -1;
+    stack->len = step->depth;
+    stack->states[step->depth - 1] = step->kind == TRACE_BEGIN ? 0 : step->next;
+    return 1;
+}
+
+// Print the input from 'pos' (escaped, at most FLOT_WIDTH bytes); next_step
+// keeps 'pos' within the input
+static void print_flot(const char* input, long input_len, long pos) {
+    printf("Flot: ");
+    if (!input) {
+        printf("@%ld", pos);
+        return;
+    }
+    long end = pos + FLOT_WIDTH < input_len ? pos + FLOT_WIDTH : input_len;
+    for (long i = pos; i < end; i++) {
+        unsigned char c = (unsigned char)input[i];
+        if (c == '\n') {
+            printf("\\n");
+        } else if (c == '\t') {
+            printf("\\t");
+        } else if (c < 32 || c >= 127) {
+            printf("\\x%02x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    printf(end < input_len ? "..." : "$");
+}
+
+// Print the top PILE_WIDTH states of the stack before 'step'
+static void print_pile(const ReplayStack* stack, const TraceStep* step) {
+    printf(" | Pile: ");
+    int len = stack->len;
+    if (len == 0) {
+        // First step of a ring: only the top state is known
+        printf("... %d ", step->state);
+        return;
+    }
+    int first = len > PILE_WIDTH ? len - PILE_WIDTH : 0;
+    if (first > 0) printf("... ");
+    for (int i = first; i < len; i++) {
+        if (stack->states[i] < 0) {
+            printf("? ");
+        } else {
+            printf("%d ", stack->states[i]);
+        }
+    }
+}
+
+static void print_rule(Grammar* grammar, int rule_num) {
+    Rule* rule = &grammar->rules[rule_num];
+    printf(": ");
+    write_symbol(stdout, grammar, rule->lhs, 1);
+    printf(" ->");
+    for (int i = 0; i < rule->rhs_len; i++) {
+        putchar(' ');
+        write_symbol(stdout, grammar, rule->rhs[i], 0);
+    }
+}
+
+// Print one step: its number, the view before it and the action taken
+static void print_step(long index, const TraceStep* step, const ReplayStack* stack,
+                       const char* input, long input_len, Grammar* grammar) {
+    if (step->kind == TRACE_BEGIN) {
+        printf("#%ld === Input ===\n", index);
+        return;
+    }
+    printf("#%ld ", index);
+    print_flot(input, input_len, step->pos);
+    print_pile(stack, step);
+    if (step->action == ACTION_ACCEPT) {
+        printf("| ACCEPT\n");
+    } else if (step->action == ACTION_ERROR) {
+        if (step->symbol) {
+            printf("| ERROR on '%c' at %d\n", step->symbol, step->pos);
+        } else {
+            printf("| ERROR at %d\n", step->pos);
+        }
+    } else if (step->action > 0) {
+        printf("| SHIFT %d\n", step->action);
+    } else {
+        int rule_num = -step->action - 1;
+        printf("| REDUCE by rule %d", rule_num + 1);
+        if (grammar && rule_num < grammar->num_rules) print_rule(grammar, rule_num);
+        printf(" | GOTO %d\n", step->next);
+    }
+}
+
+// Steps with the same content (the stack they imply included)
+static int same_step(const TraceStep* a, const TraceStep* b) {
+    return a->kind == b->kind && a->pos == b->pos && a->depth == b->depth &&
+           a->state == b->state && a->action == b->action && a->next == b->next &&
+           a->symbol == b->symbol;
+}
+
+// Compare two traces step by step and print the first steps that differ.
+// Returns 1 if the traces differ, -1 if one of them is damaged or out of
+// memory.
+static int diff_traces(TraceReader* a, TraceReader* b, const char* input, long input_len,
+                       Grammar* grammar) {
+    ReplayStack stack_a = { NULL, 0, 0 };
+    ReplayStack stack_b = { NULL, 0, 0 };
+    TraceStep step_a, step_b;
+    int differ = 0;
+    int ok = 1;
+
+    // A ring trace starts later: skip to the first step both have
+    while (ok && a->index < b->index && next_step(a, &step_a)) {
+        ok = step_follows(a, &stack_a, &step_a) && replay_step(&stack_a, &step_a);
+    }
+    while (ok && b->index < a->index && next_step(b, &step_b)) {
+        ok = step_follows(b, &stack_b, &step_b) && replay_step(&stack_b, &step_b);
+    }
+
+    while (ok) {
+        long index = a->index;
+        int more_a = next_step(a, &step_a);
+        int more_b = next_step(b, &step_b);
+        if (a->bad || b->bad || (more_a && !step_follows(a, &stack_a, &step_a)) ||
+            (more_b && !step_follows(b, &stack_b, &step_b))) {
+            ok = 0;
+        } else if (!more_a || !more_b) {
+            if (more_a || more_b) {
+                printf("Traces differ at step %ld: %s ends first\n", index, more_a ? "b" : "a");
+                differ = 1;
+            }
+            break;
+        } else if (!same_step(&step_a, &step_b)) {
+            printf("Traces differ at step %ld:\n", index);
+            printf("a ");
+            print_step(index, &step_a, &stack_a, input, input_len, grammar);
+            printf("b ");
+            print_step(index, &step_b, &stack_b, input, input_len, grammar);
+            differ = 1;
+            break;
+        } else {
+            ok = replay_step(&stack_a, &step_a) && replay_step(&stack_b, &step_b);
+        }
+    }
+    if (ok && !differ) printf("Traces match: %ld steps\n", a->index);
+    free(stack_a.states);
+    free(stack_b.states);
+    return ok ? differ : -1;
+}
+
+// Read a whole file; NULL if it cannot be read
+static char* read_input(const char* path, long* len) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* data = (char*)malloc(*len > 0 ? *len : 1);
+    if (fread(data, 1, *len, fp) != (size_t)*len) *len = 0;
+    fclose(fp);
+    return data;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace_file> [-i input_file] [-g grammar_file] [-s state] [-r rule]\n", argv[0]);
+        fprintf(stderr, "       %s <trace_file> -d <other_trace_file> [-i input_file] [-g grammar_file]\n", argv[0]);
+        fprintf(stderr, "  -i : Show the input remaining at each step (Flot)\n");
+        fprintf(stderr, "  -g : Show the rule of each reduction\n");
+        fprintf(stderr, "  -s : Only show the steps taken in this state\n");
+        fprintf(stderr, "  -r : Only show the reductions by this rule (numbered from 1)\n");
+        fprintf(stderr, "  -d : Report the first step where the two traces differ\n");
+        return 1;
+    }
+    const char* input_file = NULL;
+    const char* grammar_file = NULL;
+    const char* other_file = NULL;
+    int only_state = -1;
+    int only_rule = -1;
+    for (int i = 2; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0) {
+            input_file = argv[++i];
+        } else if (strcmp(argv[i], "-g") == 0) {
+            grammar_file = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            other_file = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            only_state = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            only_rule = atoi(argv[++i]);
+        }
+    }
+
+    TraceReader reader;
+    if (!open_trace(&reader, argv[1])) return 1;
+    char* input = NULL;
+    long input_len = 0;
+    if (input_file && !(input = read_input(input_file, &input_len))) return 1;
+    if (input) reader.input_len = input_len;
+    Grammar grammar;
+    Table table;
+    int have_grammar = grammar_file && load_grammar_table(grammar_file, &grammar, &table);
+    if (grammar_file && !have_grammar) return 1;
+
+    int status = 0;
+    if (other_file) {
+        TraceReader other;
+        if (!open_trace(&other, other_file)) return 1;
+        if (input) other.input_len = input_len;
+        status = diff_traces(&reader, &other, input, input_len, have_grammar ? &grammar : NULL) != 0;
+        fclose(other.fp);
+    } else {
+        ReplayStack stack = { NULL, 0, 0 };
+        TraceStep step;
+        int ok = 1;
+        while (ok && next_step(&reader, &step) && step_follows(&reader, &stack, &step)) {
+            int shown;
+            if (step.kind == TRACE_BEGIN) {
+                shown = only_state < 0 && only_rule < 0;
+            } else {
+                shown = (only_state < 0 || step.state == only_state) &&
+                        (only_rule < 0 || (step.action < 0 && step.action != ACTION_ACCEPT &&
+                                           -step.action == only_rule));
+            }
+            if (shown) {
+                print_step(reader.index - 1, &step, &stack, input, input_len,
+                           have_grammar ? &grammar : NULL);
+            }
+            ok = replay_step(&stack, &step);
+        }
+        status = !ok || reader.bad;
+        free(stack.states);
+    }
+    fclose(reader.fp);
+    free(input);
+    if (have_grammar) {
+        free_grammar(&grammar);
+        free_table(&table);
+    }
+    return status;
+}
@@ -0,0 +1,464 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "lrparser.h"
+
+// Daemon mode (-d): requests from any number of clients arrive on a Unix
+// domain socket and are served by one thread, multiplexed with epoll.
+// Loaded grammars stay in an LRU cache, so a request costs a parse, not a
+// process start and a grammar load.
+//
+// A request is a header line followed by the input bytes:
+//
+//     <format> <length> <grammar_path>\n<input>
+//
+// <format> is "-" (accept/reject only), "compact" or "json". The path is
+// absolute and runs to the end of the line. Each request is answered by
+// one line, in request order, so clients may pipeline:
+//
+//     ACCEPT[\t<tree>]\n   REJECT\t<pos>\n   ERROR\t<message>\n
+
+// Function prototypes from other modules
+int outbuf_write(OutBuf* out, const char* data, size_t len);
+int write_tree(Node* root, const Grammar* grammar, int format, OutBuf* out, FILE* sink);
+const Grammar* lr_ctx_grammar(const ParserCtx* ctx);
+
+#define MAX_HEADER (PATH_MAX + 64)
+#define OUT_HIGH_WATER (1 << 20)   // Unsent bytes that pause a connection's requests
+#define READ_CHUNK (64 * 1024)
+#define MAX_EVENTS 64
+
+// A loaded grammar and the file it was loaded from
+typedef struct {
+    char* path;             // NULL = free slot
+    dev_t dev;              // Identity of the file when it was loaded
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    LrGrammar* grammar;
+    ParserCtx* ctx;         // Shared by all requests (one thread)
+    unsigned long used;     // Cache clock at the last request (LRU order)
+} CacheEntry;
+
+typedef struct {
+    CacheEntry* entries;
+    int capacity;
+    unsigned long clock;
+    long loads;
+    long evictions;
+} GrammarCache;
+
+typedef struct {
+    int fd;
+    int index;              // Position in Server.conns
+    OutBuf in;              // Received bytes
+    size_t in_pos;          // First byte of the next request
+    OutBuf out;             // Answers
+    size_t out_pos;         // First unsent byte
+    int eof;                // Client sent everything
+    int closing;            // Bad request: close once 'out' is sent
+    unsigned events;        // Registered epoll events
+} Conn;
+
+typedef struct {
+    int listen_fd;
+    int signal_fd;
+    int epoll_fd;
+    GrammarCache cache;
+    Conn** conns;
+    int num_conns;
+    int conn_capacity;
+    long accepted;
+    long requests;
+} Server;
+
+// Release a cache entry's grammar and context
+static void cache_drop(CacheEntry* entry) {
+    if (!entry->path) return;
+    lr_ctx_free(entry->ctx);
+    lr_grammar_free(entry->grammar);
+    free(entry->path);
+    entry->path = NULL;
+}
+
+// Parser context for the grammar file at 'path', loading it if it is not
+// cached or changed on disk since (other size, inode or mtime). The least
+// recently used grammar makes room once the load has succeeded. NULL if
+// the file cannot be loaded.
+static ParserCtx* cache_get(GrammarCache* cache, const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+    cache->clock++;
+
+    CacheEntry* slot = NULL;
+    for (int i = 0; i < cache->capacity; i++) {
+        CacheEntry* entry = &cache->entries[i];
+        if (!entry->path || strcmp(entry->path, path) != 0) continue;
+        if (entry->dev == st.st_dev && entry->ino == st.st_ino && entry->size == st.st_size &&
+            entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+            entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            entry->used = cache->clock;
+            return entry->ctx;
+        }
+        slot = entry;       // Stale: reload in place
+        break;
+    }
+
+    LrGrammar* grammar;
+    ParserCtx* ctx = NULL;
+    if (lr_grammar_load(path, &grammar) != LR_ACCEPT) {
+        grammar = NULL;
+    } else if (lr_ctx_create(grammar, &ctx) != LR_ACCEPT) {
+        lr_grammar_free(grammar);
+        grammar = NULL;
+    }
+    if (!grammar) {
+        // A stale entry no longer matches its file; the others stay cached
+        if (slot) cache_drop(slot);
+        return NULL;
+    }
+
+    if (!slot) {
+        slot = &cache->entries[0];
+        for (int i = 0; i < cache->capacity && slot->path; i++) {
+            CacheEntry* entry = &cache->entries[i];
+            if (!entry->path || entry->used < slot->used) slot = entry;
+        }
+        if (slot->path) cache->evictions++;
+    }
+    cache_drop(slot);
+    slot->path = strdup(path);
+    if (!slot->path) {
+        lr_ctx_free(ctx);
+        lr_grammar_free(grammar);
+        return NULL;
+    }
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->size = st.st_size;
+    slot->mtime = st.st_mtim;
+    slot->grammar = grammar;
+    slot->ctx = ctx;
+    slot->used = cache->clock;
+    cache->loads++;
+    return ctx;
+}
+
+// Append an error answer; returns 0 if out of memory
+static int answer_error(OutBuf* out, const char* message) {
+    return outbuf_write(out, "ERROR\t", 6) && outbuf_write(out, message, strlen(message)) &&
+           outbuf_write(out, "\n", 1);
+}
+
+// Parse one input and append its answer; returns 0 if out of memory (the
+// answer may be cut short)
+static int answer(Server* server, OutBuf* out, const char* path, int format,
+                  const char* input, long length) {
+    ParserCtx* ctx = cache_get(&server->cache, path);
+    if (!ctx) return answer_error(out, "Cannot load grammar");
+    int status = format ? lr_parse(ctx, input, length) : lr_recognize(ctx, input, length);
+    if (status == LR_ACCEPT && format) {
+        return outbuf_write(out, "ACCEPT\t", 7) &&
+               write_tree((Node*)lr_tree(ctx), lr_ctx_grammar(ctx), format, out, NULL);
+    } else if (status == LR_ACCEPT) {
+        return outbuf_write(out, "ACCEPT\n", 7);
+    } else if (status == LR_REJECT) {
+        char line[32];
+        int n = snprintf(line, sizeof(line), "REJECT\t%ld\n", lr_error_pos(ctx));
+        return outbuf_write(out, line, n);
+    }
+    return answer_error(out, lr_strerror(status));
+}
+
+// Answer a malformed request with an error and close the connection once
+// the answers before it are sent
+static void refuse_request(Conn* conn) {
+    size_t answered = conn->out.len;
+    if (!answer_error(&conn->out, "Bad request")) conn->out.len = answered;
+    conn->closing = 1;
+}
+
+// Answer the complete requests buffered on 'conn' until its unsent answers
+// reach OUT_HIGH_WATER; returns the number answered. A malformed header
+// is answered with an error and closes the connection. So does running
+// out of memory, without an answer: the earlier answers are still sent.
+static int serve_requests(Server* server, Conn* conn) {
+    int served = 0;
+    while (!conn->closing && conn->out.len - conn->out_pos < OUT_HIGH_WATER) {
+        const char* head = conn->in.data + conn->in_pos;
+        size_t avail = conn->in.len - conn->in_pos;
+        const char* newline = avail ? memchr(head, '\n', avail) : NULL;
+        if (!newline) {
+            if (avail > MAX_HEADER) refuse_request(conn);
+            break;
+        }
+        size_t header_len = newline - head;
+        char header[MAX_HEADER + 1];
+        char format_name[16];
+        long length;
+        int path_at = -1;
+        int format = TREE_NONE;
+        if (header_len <= MAX_HEADER) {
+            memcpy(header, head, header_len);
+            header[header_len] = '\0';
+            sscanf(header, "%15s %ld %n", format_name, &length, &path_at);
+        }
+        if (path_at < 0 || header[path_at] == '\0' || length < 0 || length > INT_MAX) {
+            format = -1;
+        } else if (strcmp(format_name, "compact") == 0) {
+            format = TREE_COMPACT;
+        } else if (strcmp(format_name, "json") == 0) {
+            format = TREE_JSON;
+        } else if (strcmp(format_name, "-") != 0) {
+            format = -1;
+        }
+        if (format < 0) {
+            refuse_request(conn);
+            break;
+        }
+        if (avail - header_len - 1 < (size_t)length) break;     // Input not complete yet
+
+        size_t answered = conn->out.len;
+        if (!answer(server, &conn->out, header + path_at, format, newline + 1, length)) {
+            conn->out.len = answered;
+            conn->closing = 1;
+            break;
+        }
+        conn->in_pos += header_len + 1 + length;
+        server->requests++;
+        served++;
+    }
+    // Keep only the unanswered bytes
+    if (conn->in_pos > 0) {
+        memmove(conn->in.data, conn->in.data + conn->in_pos, conn->in.len - conn->in_pos);
+        conn->in.len -= conn->in_pos;
+        conn->in_pos = 0;
+    }
+    return served;
+}
+
+// Read what the socket holds; returns 0 on EOF or a socket error, -1 if
+// out of memory
+static int fill_conn(Conn* conn) {
+    for (;;) {
+        if (conn->in.cap - conn->in.len < READ_CHUNK) {
+            size_t cap = conn->in.cap ? conn->in.cap * 2 : READ_CHUNK * 2;
+            while (cap - conn->in.len < READ_CHUNK) cap *= 2;
+            char* data = (char*)realloc(conn->in.data, cap);
+            if (!data) return -1;
+            conn->in.data = data;
+            conn->in.cap = cap;
+        }
+        ssize_t n = read(conn->fd, conn->in.data + conn->in.len, conn->in.cap - conn->in.len);
+        if (n > 0) {
+            conn->in.len += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+}
+
+// Send pending answers; returns -1 on a socket error
+static int flush_conn(Conn* conn) {
+    while (conn->out_pos < conn->out.len) {
+        ssize_t n = write(conn->fd, conn->out.data + conn->out_pos, conn->out.len - conn->out_pos);
+        if (n > 0) {
+            conn->out_pos += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    conn->out.len = 0;
+    conn->out_pos = 0;
+    return 0;
+}
+
+static void close_conn(Server* server, Conn* conn) {
+    close(conn->fd);
+    Conn* last = server->conns[--server->num_conns];
+    server->conns[conn->index] = last;
+    last->index = conn->index;
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+}
+
+// Handle readiness of a client connection
+static void handle_conn(Server* server, Conn* conn, unsigned events) {
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->eof && !conn->closing) {
+        // The requests received before EOF are still answered
+        int filled = fill_conn(conn);
+        if (filled < 0) {
+            close_conn(server, conn);
+            return;
+        }
+        if (!filled) conn->eof = 1;
+    }
+    int served;
+    do {
+        served = serve_requests(server, conn);
+        if (flush_conn(conn) < 0) {
+            close_conn(server, conn);
+            return;
+        }
+    } while (served > 0 && conn->out.len == 0);
+
+    size_t pending = conn->out.len - conn->out_pos;
+    if ((conn->eof || conn->closing) && pending == 0) {
+        close_conn(server, conn);
+        return;
+    }
+    // Level-triggered: stop reading at EOF or while the client does not
+    // take its answers; watch for room while answers wait
+    int reading = !conn->eof && !conn->closing && pending < OUT_HIGH_WATER;
+    unsigned wanted = (reading ? EPOLLIN : 0) | (pending ? EPOLLOUT : 0);
+    if (wanted != conn->events) {
+        struct epoll_event event = { wanted, { .ptr = conn } };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->events = wanted;
+    }
+}
+
+// Accept every pending connection
+static void accept_conns(Server* server) {
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;     // EAGAIN, or out of descriptors until a client leaves
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (server->num_conns == server->conn_capacity) {
+            int capacity = server->conn_capacity ? server->conn_capacity * 2 : 64;
+            Conn** conns = (Conn**)realloc(server->conns, capacity * sizeof(Conn*));
+            if (!conns) {
+                close(fd);
+                continue;
+            }
+            server->conns = conns;
+            server->conn_capacity = capacity;
+        }
+        Conn* conn = (Conn*)calloc(1, sizeof(Conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        struct epoll_event event = { EPOLLIN, { .ptr = conn } };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->index = server->num_conns;
+        server->conns[server->num_conns++] = conn;
+        server->accepted++;
+    }
+}
+
+// Bind and listen on 'path', replacing a stale socket left by an earlier
+// daemon (but no other kind of file); returns the socket or -1
+static int open_listener(const char* path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Error: Cannot listen on %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// Serve parse requests on the Unix socket 'socket_path' until SIGINT or
+// SIGTERM, keeping up to 'cache_size' grammars loaded. Returns 0 after a
+// clean shutdown, 1 if the socket or the cache cannot be set up.
+int run_server(const char* socket_path, int cache_size) {
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.listen_fd = open_listener(socket_path);
+    if (server.listen_fd < 0) return 1;
+
+    // Termination signals are read from a descriptor in the event loop
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    server.signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = { EPOLLIN, { .ptr = &server.listen_fd } };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event);
+    event.data.ptr = &server.signal_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.signal_fd, &event);
+
+    server.cache.capacity = cache_size;
+    server.cache.entries = (CacheEntry*)calloc(cache_size, sizeof(CacheEntry));
+    if (!server.cache.entries) {
+        fprintf(stderr, "Error: %s\n", lr_strerror(LR_ERR_NOMEM));
+        close(server.epoll_fd);
+        close(server.signal_fd);
+        close(server.listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+    fprintf(stderr, "Listening on %s\n", socket_path);
+
+    struct epoll_event events[MAX_EVENTS];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR) break;
+        for (int i = 0; i < n; i++) {
+            void* source = events[i].data.ptr;
+            if (source == &server.listen_fd) {
+                accept_conns(&server);
+            } else if (source == &server.signal_fd) {
+                running = 0;
+            } else {
+                handle_conn(&server, (Conn*)source, events[i].events);
+            }
+        }
+    }
+
+    fprintf(stderr, "Server: %ld connections, %ld requests, %ld grammar loads, %ld evictions\n",
+            server.accepted, server.requests, server.cache.loads, server.cache.evictions);
+    while (server.num_conns > 0) close_conn(&server, server.conns[0]);
+    for (int i = 0; i < cache_size; i++) cache_drop(&server.cache.entries[i]);
+    free(server.cache.entries);
+    free(server.conns);
+    close(server.epoll_fd);
+    close(server.signal_fd);
+    close(server.listen_fd);
+    unlink(socket_path);
+    return 0;
+}
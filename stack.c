@@ -1,30 +1,42 @@
 #include "structs.h"
 
-// Create a new stack
+// Create a new stack (NULL if out of memory)
 Stack* create_stack(int initial_capacity) {
     Stack* stack = (Stack*)malloc(sizeof(Stack));
+    if (!stack) return NULL;
     stack->capacity = initial_capacity;
     stack->elements = (StackElement*)malloc(initial_capacity * sizeof(StackElement));
+    if (!stack->elements) {
+        free(stack);
+        return NULL;
+    }
     stack->top = -1;
     return stack;
 }
 
-// Push (state, node) onto stack
-void push(Stack* stack, int state, Node* node) {
+// Push (state, node) onto stack; returns 0 if it cannot grow (out of
+// memory), leaving the stack as it was
+int push(Stack* stack, int state, Node* node) {
     if (stack->top + 1 >= stack->capacity) {
+        StackElement* elements = (StackElement*)realloc(stack->elements,
+                                                        2 * stack->capacity * sizeof(StackElement));
+        if (!elements) return 0;
+        stack->elements = elements;
         stack->capacity *= 2;
-        stack->elements = (StackElement*)realloc(stack->elements, stack->capacity * sizeof(StackElement));
+        STAT_ADD(stack_reallocs, 1);
     }
     stack->top++;
     stack->elements[stack->top].state = state;
     stack->elements[stack->top].node = node;
+    return 1;
 }
 
-// Pop from stack
+// Pop from stack; an empty stack gives state -1 (callers check the
+// depth first, so this only happens with a malformed table)
 StackElement pop(Stack* stack) {
     if (stack->top < 0) {
-        fprintf(stderr, "Error: Stack underflow\n");
-        exit(1);
+        StackElement empty = { -1, -1, NULL };
+        return empty;
     }
     return stack->elements[stack->top--];
 }
@@ -70,3 +82,74 @@ void free_stack(Stack* stack) {
     free(stack->elements);
     free(stack);
 }
+
+// Create a state-only stack (NULL if out of memory)
+StateStack* create_state_stack(int initial_capacity) {
+    StateStack* stack = (StateStack*)malloc(sizeof(StateStack));
+    if (!stack) return NULL;
+    stack->capacity = initial_capacity;
+    stack->states = (int*)malloc(initial_capacity * sizeof(int));
+    if (!stack->states) {
+        free(stack);
+        return NULL;
+    }
+    stack->top = -1;
+    return stack;
+}
+
+// Double a state-only stack; returns 0 if out of memory (the stack is kept)
+int grow_state_stack(StateStack* stack) {
+    int* states = (int*)realloc(stack->states, 2 * stack->capacity * sizeof(int));
+    if (!states) return 0;
+    stack->states = states;
+    stack->capacity *= 2;
+    STAT_ADD(stack_reallocs, 1);
+    return 1;
+}
+
+// Free a state-only stack
+void free_state_stack(StateStack* stack) {
+    free(stack->states);
+    free(stack);
+}
+
+// Create a state stack with a parallel value stack (NULL if out of memory)
+ValueStack* create_value_stack(int initial_capacity) {
+    ValueStack* stack = (ValueStack*)malloc(sizeof(ValueStack));
+    if (!stack) return NULL;
+    stack->capacity = initial_capacity;
+    stack->states = (int*)malloc(initial_capacity * sizeof(int));
+    stack->values = (SemValue*)malloc(initial_capacity * sizeof(SemValue));
+    if (!stack->states || !stack->values) {
+        free(stack->states);
+        free(stack->values);
+        free(stack);
+        return NULL;
+    }
+    stack->top = -1;
+    return stack;
+}
+
+// Grow a value stack so that index 'top' fits; returns 0 if out of memory
+// (the stack keeps its capacity)
+int grow_value_stack(ValueStack* stack, int top) {
+    int capacity = stack->capacity;
+    while (top >= capacity) {
+        capacity *= 2;
+    }
+    int* states = (int*)realloc(stack->states, capacity * sizeof(int));
+    if (states) stack->states = states;
+    SemValue* values = (SemValue*)realloc(stack->values, capacity * sizeof(SemValue));
+    if (values) stack->values = values;
+    if (!states || !values) return 0;
+    stack->capacity = capacity;
+    STAT_ADD(stack_reallocs, 1);
+    return 1;
+}
+
+// Free a value stack
+void free_value_stack(ValueStack* stack) {
+    free(stack->states);
+    free(stack->values);
+    free(stack);
+}
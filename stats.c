@@ -0,0 +1,114 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "structs.h"
+
+#ifndef LR_NO_STATS
+__thread ParserStats* lr_stats = NULL;
+#endif
+
+// Monotonic clock in nanoseconds (phase timers)
+double stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Create zeroed counters for a table with 'num_states' states and 'num_rules'
+// rules. Returns NULL if out of memory.
+ParserStats* create_stats(int num_states, int num_rules) {
+    ParserStats* stats = (ParserStats*)calloc(1, sizeof(ParserStats));
+    if (!stats) return NULL;
+    stats->num_states = num_states;
+    stats->num_rules = num_rules;
+    stats->shifts = (long*)calloc(num_states > 0 ? num_states : 1, sizeof(long));
+    stats->reduces = (long*)calloc(num_states > 0 ? num_states : 1, sizeof(long));
+    stats->rule_reduces = (long*)calloc(num_rules > 0 ? num_rules : 1, sizeof(long));
+    if (!stats->shifts || !stats->reduces || !stats->rule_reduces) {
+        free(stats->shifts);
+        free(stats->reduces);
+        free(stats->rule_reduces);
+        free(stats);
+        return NULL;
+    }
+    return stats;
+}
+
+// Free counters
+void free_stats(ParserStats* stats) {
+    if (!stats) return;
+    free(stats->shifts);
+    free(stats->reduces);
+    free(stats->rule_reduces);
+    free(stats);
+}
+
+// Add the counters of 'src' (same table) into 'dst'
+void merge_stats(ParserStats* dst, ParserStats* src) {
+    for (int s = 0; s < dst->num_states && s < src->num_states; s++) {
+        dst->shifts[s] += src->shifts[s];
+        dst->reduces[s] += src->reduces[s];
+    }
+    for (int r = 0; r < dst->num_rules && r < src->num_rules; r++) {
+        dst->rule_reduces[r] += src->rule_reduces[r];
+    }
+    dst->inputs += src->inputs;
+    if (src->max_depth > dst->max_depth) dst->max_depth = src->max_depth;
+    dst->stack_reallocs += src->stack_reallocs;
+    dst->child_reallocs += src->child_reallocs;
+    dst->nodes += src->nodes;
+    dst->reused += src->reused;
+    for (int p = 0; p < NUM_PHASES; p++) {
+        dst->phase_ns[p] += src->phase_ns[p];
+    }
+}
+
+// Write the counters as one JSON object. States and rules that were never
+// used are left out; the lists are ordered by state and rule number.
+void write_stats_json(ParserStats* stats, Grammar* grammar, FILE* out) {
+    long shifts = 0;
+    long reduces = 0;
+    for (int s = 0; s < stats->num_states; s++) {
+        shifts += stats->shifts[s];
+        reduces += stats->reduces[s];
+    }
+
+#ifdef LR_NO_STATS
+    fprintf(out, "{\"enabled\":false,");
+#else
+    fprintf(out, "{\"enabled\":true,");
+#endif
+    fprintf(out, "\"inputs\":%ld,\"shifts\":%ld,\"reduces\":%ld,\"max_stack_depth\":%ld,"
+            "\"stack_reallocs\":%ld,\"child_reallocs\":%ld,\"nodes\":%ld,\"reused\":%ld,",
+            stats->inputs, shifts, reduces, stats->max_depth,
+            stats->stack_reallocs, stats->child_reallocs, stats->nodes, stats->reused);
+    fprintf(out, "\"phase_ms\":{\"load\":%.3f,\"parse\":%.3f,\"output\":%.3f},",
+            stats->phase_ns[PHASE_LOAD] / 1e6, stats->phase_ns[PHASE_PARSE] / 1e6,
+            stats->phase_ns[PHASE_OUTPUT] / 1e6);
+
+    fprintf(out, "\"states\":[");
+    int first = 1;
+    for (int s = 0; s < stats->num_states; s++) {
+        if (!stats->shifts[s] && !stats->reduces[s]) continue;
+        fprintf(out, "%s{\"state\":%d,\"shifts\":%ld,\"reduces\":%ld}",
+                first ? "" : ",", s, stats->shifts[s], stats->reduces[s]);
+        first = 0;
+    }
+
+    fprintf(out, "],\"rules\":[");
+    first = 1;
+    for (int r = 0; r < stats->num_rules; r++) {
+        if (!stats->rule_reduces[r]) continue;
+        fprintf(out, "%s{\"rule\":%d,\"lhs\":\"", first ? "" : ",", r + 1);
+        for (const char* c = grammar->names[grammar->rules[r].lhs]; *c; c++) {
+            if ((unsigned char)*c < 0x20) {
+                fprintf(out, "\\u%04x", *c);
+                continue;
+            }
+            if (*c == '"' || *c == '\\') fputc('\\', out);
+            fputc(*c, out);
+        }
+        fprintf(out, "\",\"reductions\":%ld}", stats->rule_reduces[r]);
+        first = 0;
+    }
+    fprintf(out, "]}\n");
+}
@@ -0,0 +1,257 @@
+#include "structs.h"
+
+// Function prototypes from other modules
+int reduce_rule(Grammar* grammar, Table* table, Stack* stack, NodeArena* arena,
+                int rule_num, int trace);
+Node* arena_node(NodeArena* arena, int symbol);
+NodeArena* create_arena(size_t slab_size);
+void free_arena(NodeArena* arena);
+int print_tree_as(Node* root, const Grammar* grammar, int format);
+
+Stack* create_stack(int initial_capacity);
+int push(Stack* stack, int state, Node* node);
+int peek_state(Stack* stack);
+void free_stack(Stack* stack);
+
+int lex_scan(const Lexer* lexer, const char* input, int len, int pos,
+             int* start, int* end, int partial);
+int outbuf_write(OutBuf* out, const char* data, size_t len);
+const char* lr_strerror(int code);
+
+// Start (or restart) a stream at state 0
+void parser_stream_reset(ParserStream* ctx) {
+    ctx->stack->top = -1;
+    push(ctx->stack, 0, NULL);
+    ctx->pos = 0;
+    ctx->pending_len = 0;
+    ctx->fed = 0;
+    ctx->status = STREAM_RUNNING;
+    ctx->failure = 0;
+    ctx->result.accepted = 0;
+    ctx->result.error_pos = -1;
+    ctx->result.tree = NULL;
+    STAT_ADD(inputs, 1);
+}
+
+// Create a push parser; tree nodes go to 'arena' (NULL = recognize only).
+// Returns NULL if out of memory.
+ParserStream* parser_stream_create(Grammar* grammar, Table* table, NodeArena* arena) {
+    ParserStream* ctx = (ParserStream*)malloc(sizeof(ParserStream));
+    if (!ctx) return NULL;
+    ctx->stack = create_stack(100);
+    if (!ctx->stack) {
+        free(ctx);
+        return NULL;
+    }
+    ctx->grammar = grammar;
+    ctx->table = table;
+    ctx->arena = arena;
+    ctx->pending = NULL;
+    ctx->pending_cap = 0;
+    parser_stream_reset(ctx);
+    return ctx;
+}
+
+// Free the parser (the arena belongs to the caller)
+void parser_stream_free(ParserStream* ctx) {
+    free_stack(ctx->stack);
+    free(ctx->pending);
+    free(ctx);
+}
+
+// Run every reduction triggered by lookahead 'symbol' (spanning 'len' bytes
+// at 'start'), then shift or accept it
+static void stream_symbol(ParserStream* ctx, int symbol, long start, int len) {
+    while (1) {
+        int state = peek_state(ctx->stack);
+        int action = ctx->table->default_reduce[state];
+        if (action == ACTION_ERROR) {
+            action = table_action(ctx->table, state, symbol);
+        }
+
+        if (action == ACTION_ERROR) {
+            ctx->status = STREAM_REJECTED;
+            ctx->result.error_pos = start;
+            return;
+        } else if (action == ACTION_ACCEPT) {
+            ctx->status = STREAM_ACCEPTED;
+            ctx->result.accepted = 1;
+            ctx->result.tree = ctx->stack->elements[ctx->stack->top].node;
+            return;
+        } else if (action > 0) {
+            Node* leaf = NULL;
+            if (ctx->arena && (leaf = arena_node(ctx->arena, symbol))) {
+                leaf->offset = start;
+                leaf->length = len;
+            }
+            if ((ctx->arena && !leaf) || !push(ctx->stack, action, leaf)) {
+                // Out of memory
+                ctx->status = STREAM_FAILED;
+                ctx->failure = -2;
+                ctx->result.error_pos = start;
+                return;
+            }
+            STAT_SHIFT(state, ctx->stack->top);
+            ctx->pos = start + len;
+            return;
+        } else {
+            int goto_state = reduce_rule(ctx->grammar, ctx->table, ctx->stack, ctx->arena,
+                                         -action - 1, 0);
+            if (goto_state < 0) {
+                ctx->status = STREAM_FAILED;
+                ctx->failure = goto_state;
+                ctx->result.error_pos = start;
+                return;
+            }
+            STAT_REDUCE(state, -action - 1, ctx->stack->top);
+        }
+    }
+}
+
+// Scan buf[0..len) (input offset 'base') into tokens and feed them. Unless
+// 'final' is set, a token that may continue past 'len' is left unscanned.
+// Returns the number of bytes consumed.
+static size_t stream_tokens(ParserStream* ctx, const char* buf, size_t len, long base, int final) {
+    int pos = 0;
+    while (ctx->status == STREAM_RUNNING) {
+        int start, end;
+        int symbol = lex_scan(ctx->grammar->lexer, buf, (int)len, pos, &start, &end, !final);
+        if (symbol == LEX_MORE) return start;
+        if (symbol == '$') return len;
+        if (symbol == LEX_ERROR) {
+            ctx->status = STREAM_REJECTED;
+            ctx->result.error_pos = base + start;
+            return len;
+        }
+        stream_symbol(ctx, symbol, base + start, end - start);
+        pos = end;
+    }
+    return len;
+}
+
+// Lexer path of parser_feed. Tokens are scanned in place in the chunk; only
+// a token cut by the chunk boundary is kept in 'pending' until it is complete.
+static void stream_lex(ParserStream* ctx, const char* buf, size_t len) {
+    long chunk_base = ctx->fed;
+    size_t off = 0;
+    ctx->fed += len;
+
+    // Complete the token left over from the previous chunk
+    while (ctx->pending_len > 0 && off < len && ctx->status == STREAM_RUNNING) {
+        size_t step = ctx->pending_len > 64 ? ctx->pending_len : 64;
+        if (step > len - off) step = len - off;
+        size_t old = ctx->pending_len;
+        OutBuf pending = { ctx->pending, ctx->pending_len, ctx->pending_cap };
+        int kept = outbuf_write(&pending, buf + off, step);
+        ctx->pending = pending.data;
+        ctx->pending_len = pending.len;
+        ctx->pending_cap = pending.cap;
+        if (!kept) {
+            // Out of memory
+            ctx->status = STREAM_FAILED;
+            ctx->failure = -2;
+            ctx->result.error_pos = ctx->pos;
+            return;
+        }
+        off += step;
+
+        long pending_base = chunk_base + (long)off - (long)ctx->pending_len;
+        size_t used = stream_tokens(ctx, ctx->pending, ctx->pending_len, pending_base, 0);
+        if (used >= old) {
+            // The leftover is done: continue in the chunk itself
+            off -= ctx->pending_len - used;
+            ctx->pending_len = 0;
+        } else {
+            memmove(ctx->pending, ctx->pending + used, ctx->pending_len - used);
+            ctx->pending_len -= used;
+        }
+    }
+
+    if (ctx->pending_len == 0 && off < len && ctx->status == STREAM_RUNNING) {
+        size_t used = off + stream_tokens(ctx, buf + off, len - off, chunk_base + (long)off, 0);
+        OutBuf pending = { ctx->pending, 0, ctx->pending_cap };
+        int kept = outbuf_write(&pending, buf + used, len - used);
+        ctx->pending = pending.data;
+        ctx->pending_len = pending.len;
+        ctx->pending_cap = pending.cap;
+        if (!kept) {
+            // Out of memory
+            ctx->status = STREAM_FAILED;
+            ctx->failure = -2;
+            ctx->result.error_pos = ctx->pos;
+        }
+    }
+}
+
+// Feed the next chunk of input. May be called any number of times;
+// nothing is buffered. Returns 1 while the input can still be accepted.
+int parser_feed(ParserStream* ctx, const char* buf, size_t len) {
+    if (ctx->grammar->lexer) {
+        stream_lex(ctx, buf, len);
+        return ctx->status == STREAM_RUNNING;
+    }
+    for (size_t i = 0; i < len && ctx->status == STREAM_RUNNING; i++) {
+        stream_symbol(ctx, (unsigned char)buf[i], ctx->pos, 1);
+    }
+    return ctx->status == STREAM_RUNNING;
+}
+
+// Signal end of input ($). Returns 1 on accept, 0 otherwise.
+int parser_finish(ParserStream* ctx) {
+    if (ctx->grammar->lexer && ctx->status == STREAM_RUNNING) {
+        // Whatever is pending ends at the end of input
+        stream_tokens(ctx, ctx->pending, ctx->pending_len, ctx->fed - (long)ctx->pending_len, 1);
+        ctx->pending_len = 0;
+        ctx->pos = ctx->fed;
+    }
+    if (ctx->status == STREAM_RUNNING) {
+        stream_symbol(ctx, '$', ctx->pos, 0);
+        if (ctx->status == STREAM_RUNNING) {
+            // '$' was shifted instead of accepted: the table is malformed
+            ctx->status = STREAM_FAILED;
+            ctx->failure = -1;
+            ctx->result.error_pos = ctx->pos;
+        }
+    }
+    return ctx->status == STREAM_ACCEPTED;
+}
+
+// Parse one document from 'in' as it arrives, in 64 KiB chunks.
+// Prints "ACCEPT[\t<tree>]" or "REJECT\t<pos>"; returns 1 on accept.
+int run_stream(Grammar* grammar, Table* table, FILE* in, int tree_format) {
+    NodeArena* arena = tree_format ? create_arena(64 * 1024) : NULL;
+    ParserStream* ctx = tree_format && !arena ? NULL : parser_stream_create(grammar, table, arena);
+    if (!ctx) {
+        fprintf(stderr, "Error: %s\n", lr_strerror(-2));
+        if (arena) free_arena(arena);
+        return 0;
+    }
+    char chunk[64 * 1024];
+    size_t got;
+
+    STAT_TIME_BEGIN(parse_start);
+    while ((got = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        if (!parser_feed(ctx, chunk, got)) break;
+    }
+    int accepted = parser_finish(ctx);
+    STAT_TIME_END(parse_start, PHASE_PARSE);
+
+    STAT_TIME_BEGIN(output_start);
+    if (accepted) {
+        printf("ACCEPT");
+        if (tree_format && ctx->result.tree) {
+            printf("\t");
+            print_tree_as(ctx->result.tree, ctx->grammar, tree_format);
+        } else {
+            printf("\n");
+        }
+    } else {
+        printf("REJECT\t%ld\n", ctx->result.error_pos);
+    }
+    STAT_TIME_END(output_start, PHASE_OUTPUT);
+    if (ctx->status == STREAM_FAILED) fprintf(stderr, "Error: %s\n", lr_strerror(ctx->failure));
+
+    parser_stream_free(ctx);
+    if (arena) free_arena(arena);
+    return accepted;
+}
@@ -4,50 +4,232 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
-// MSB encoding for non-terminals
-#define IS_TERMINAL(c) (((unsigned char)(c)) < 128)
-#define IS_NONTERMINAL(c) (((unsigned char)(c)) >= 128)
-#define MAKE_NONTERMINAL(c) ((char)((c) | 0x80))
-#define GET_CHAR(c) ((c) & 0x7F)
+// Symbol IDs (16 bits). Terminals are 0..255: an input byte, or a token
+// code when the grammar has a lexer. Non-terminals are numbered from
+// NT_BASE: A-Z first, then the <name> non-terminals in order of appearance.
+// The names of all symbols are in the grammar's symbol table.
+typedef uint16_t Symbol;
+#define NT_BASE 256
+#define NT_LETTERS 26       // Non-terminals A-Z (always present)
+#define MAX_SYMBOLS 65535   // The last 16-bit ID is the generator's augmented start symbol
+#define MAX_RHS 65535       // Longest right-hand side (FlatTree.arity is 16 bits)
+#define IS_TERMINAL(s) ((s) < NT_BASE)
+#define IS_NONTERMINAL(s) ((s) >= NT_BASE)
+#define NT_LETTER(c) (NT_BASE + (c) - 'A')
+#define NT_INDEX(s) ((s) - NT_BASE)     // Column of a non-terminal in unit_goto
 
-// Maximum limits
-#define MAX_RULES 100
-#define MAX_PRODUCTION_LEN 100
-#define MAX_STATES 100
-#define TABLE_COLS 256
+// Terminal sets: one bit per terminal (256 bits)
+#define TERMSET_WORDS 4
+#define TERMSET_HAS(set, c) (((set)[(c) >> 6] >> ((c) & 63)) & 1)
+#define TERMSET_ADD(set, c) ((set)[(c) >> 6] |= (uint64_t)1 << ((c) & 63))
+
+static inline int termset_empty(const uint64_t* set) {
+    for (int i = 0; i < TERMSET_WORDS; i++) {
+        if (set[i]) return 0;
+    }
+    return 1;
+}
+
+// Action encoding in table cells (32 bits): shift or GOTO to state n is n,
+// reduce by rule r (0-based) is -(r + 1), accept is below every reduce
+#define ACTION_ERROR 0
+#define ACTION_ACCEPT (-INT32_MAX)
 
 // Grammar rule structure
 typedef struct {
-    char lhs;           // Left-hand side (non-terminal with MSB set)
-    char rhs[MAX_PRODUCTION_LEN];  // Right-hand side (production)
+    Symbol lhs;         // Left-hand side (non-terminal)
     int rhs_len;        // Length of production
+    Symbol* rhs;        // Right-hand side (in Grammar.rhs_pool, or mapped)
 } Rule;
 
+// Lexer results and accept codes
+#define LEX_NONE -1         // DFA state accepts nothing
+#define LEX_SKIP -2         // Accepted input is skipped (%skip)
+#define LEX_ERROR -1        // lex_scan: no pattern matches
+#define LEX_MORE -2         // lex_scan: the token may continue past the buffer
+#define LEX_LOOP_RANGES 4   // Byte ranges per state for the run fast path
+
+// DFA lexer built from the %token / %skip lines of a grammar file
+typedef struct {
+    int num_states;
+    short* trans;       // Next DFA state [states][256], -1 = no match
+    short* accept;      // Terminal accepted in a state, LEX_NONE or LEX_SKIP
+    unsigned char* loop_count;  // Byte ranges that loop back to the state (0 = none)
+    unsigned char* loop_lo;     // [states][LEX_LOOP_RANGES] range bounds
+    unsigned char* loop_hi;
+    char* spec;         // Directive lines as read (written back by -e)
+} Lexer;
+
 // Grammar structure
 typedef struct {
-    char axiom;         // Start symbol (non-terminal with MSB set)
+    Symbol axiom;       // Start symbol (non-terminal)
     Rule* rules;        // Array of rules
     int num_rules;      // Number of rules
+    int num_symbols;    // NT_BASE + number of non-terminals (table columns)
+    char** names;       // Symbol table: name of each symbol [num_symbols]
+    char* name_pool;    // Storage of the <name> names (NULL if mapped)
+    Symbol* rhs_pool;   // Storage of the right-hand sides (NULL if mapped)
+    Lexer* lexer;       // Token lexer (NULL = every byte is a terminal)
+    uint64_t sync[TERMSET_WORDS];  // %sync terminals for error recovery (empty = any)
 } Grammar;
 
+// One more action of a conflict cell
+typedef struct {
+    long cell;          // state * num_cols + symbol
+    int action;
+} ConflictAction;
+
+// Actions that share a table cell with its entry (conflicts kept for GLR).
+// The table cell holds the action the LR engines use; the others are here.
+typedef struct {
+    ConflictAction* items;  // Sorted by cell by prepare_table
+    int count;
+    int capacity;
+    unsigned char* states;  // 1 for states with a conflict cell [states] (prepare_table)
+} Conflicts;
+
 // LR parsing table
+// Dense layout: data[state * num_cols + symbol].
+// Compressed layout (data == NULL): symbols are mapped to equivalence
+// classes, and rows are packed by row displacement into next/check with
+// a per-state default action for the cells that are not stored.
 typedef struct {
-    short* data;        // Linearized 2D array [states][256]
+    int* data;          // Linearized 2D array [states][num_cols], NULL if compressed
     int num_states;     // Number of states
+    int num_cols;       // NT_BASE terminal columns, then one per non-terminal
+
+    int* classes;       // Symbol -> equivalence class [num_cols]
+    int num_classes;    // Number of distinct column classes
+    int* base;          // Row displacement per state
+    int* deflt;         // Default action per state
+    int* next;          // Packed actions [packed_len]
+    int* check;         // Owning state of each packed slot (-1 = free)
+    int packed_len;     // Length of next/check
+
+    void* mapping;      // Binary table file mapped read-only (NULL if heap-owned)
+    size_t mapping_len; // Size of the mapping
+
+    // Precomputed by prepare_table (always heap-owned)
+    int* default_reduce;    // Reduce taken without reading the lookahead (0 = none) [states]
+    int* unit_goto;     // GOTO after collapsing unit-rule chains [states][num_cols - NT_BASE]
+    uint64_t* expected; // Terminals with an action [states][TERMSET_WORDS]
+
+    Conflicts* conflicts;   // Other actions of conflict cells (NULL = deterministic)
 } Table;
 
+// Look up the action for (state, symbol) in either table layout
+static inline int table_action(const Table* table, int state, int symbol) {
+    if (table->data) {
+        return table->data[(size_t)state * table->num_cols + symbol];
+    }
+    int idx = table->base[state] + table->classes[symbol];
+    return table->check[idx] == state ? table->next[idx] : table->deflt[state];
+}
+
+// GOTO on non-terminal 'lhs' from 'state' after its unit chain
+static inline int unit_goto(const Table* table, int state, int lhs) {
+    return table->unit_goto[(size_t)state * (table->num_cols - NT_BASE) + NT_INDEX(lhs)];
+}
+
 // Tree node for parse tree
 typedef struct Node {
-    char symbol;        // Symbol (terminal or non-terminal)
+    Symbol symbol;      // Symbol (terminal or non-terminal)
+    int state;          // Incremental trees: state the node was pushed on
+    int num_children;   // Number of children (add_child grows the array
+                        // when the count reaches a power of two)
+    int length;
     struct Node** children;  // Array of child nodes
-    int num_children;   // Number of children
-    int capacity;       // Allocated capacity for children
+    long offset;        // Leaves: source span [offset, offset + length) in bytes
+                        // (incremental trees: see parse_incremental)
 } Node;
 
+// One replaced byte range of a document, in the coordinates of the old text.
+// Edit lists are sorted by offset and do not overlap.
+typedef struct {
+    long offset;        // First replaced byte
+    long removed;       // Bytes removed at offset
+    long inserted;      // Bytes that replace them
+} TextEdit;
+
+// Slab of arena memory
+typedef struct Slab {
+    struct Slab* next;  // Next slab in the chain
+    size_t size;        // Usable bytes in data
+    size_t used;        // Bytes handed out so far
+    char data[];        // Slab storage
+} Slab;
+
+// Arena that hands out tree nodes and child arrays from large slabs
+typedef struct {
+    Slab* first;        // First slab (kept across resets)
+    Slab* current;      // Slab currently being filled
+    size_t slab_size;   // Default size of new slabs
+} NodeArena;
+
+// Parse tree stored as post-order arrays (20 bytes per node, no pointers).
+// Node i's subtree occupies [i - size[i] + 1, i]; its last child is i - 1
+// and each child's previous sibling is child - size[child].
+typedef struct {
+    Symbol* symbols;    // Symbol per node
+    int* rules;         // Rule index (0-based) of internal nodes, -1 for leaves
+    uint16_t* arity;    // Number of children
+    int* size;          // Subtree size, the node included
+    int* offset;        // Leaves: source span [offset, offset + length), -1 for internal nodes
+    int* length;        // Leaves: span length in bytes, 0 for internal nodes
+    int count;          // Number of nodes; the root is count - 1
+    int capacity;       // Allocated nodes
+} FlatTree;
+
+// Outcome of parsing one input
+typedef struct {
+    int accepted;       // 1 = ACCEPT, 0 = REJECT
+    long error_pos;     // Input position of the error (-1 if accepted)
+    Node* tree;         // Parse tree on accept (owned by the arena)
+} ParseResult;
+
+// Chunks of one parallel parse (-m -j), for the driver's summary line
+typedef struct {
+    int chunks;         // Chunks the input was cut into
+    int stitched;       // Boundaries where a chunk's stack was joined
+    int reparsed;       // Boundaries parsed again sequentially
+} ParallelReport;
+
+// One syntax error found by diagnose()
+typedef struct {
+    int pos;            // Input position of the offending token
+    int length;         // Its length (1 for a byte that no token matches)
+    int found;          // Terminal read, '$' at the end, LEX_ERROR if no token matched
+    uint64_t expected[TERMSET_WORDS];  // Terminals the parse could have gone on with
+} ParseError;
+
+// Errors collected in one pass
+typedef struct {
+    ParseError* items;
+    int count;
+    int capacity;
+} ErrorList;
+
+// Tree output formats (TREE_NONE = no tree)
+#define TREE_NONE 0
+#define TREE_COMPACT 1      // S(a()S()b())
+#define TREE_INDENT 2       // One symbol per line, two spaces per level
+#define TREE_JSON 3         // {"symbol":"S","children":[...]}
+
+#define OUTBUF_FLUSH (1 << 16)  // Output buffers are written out past this size
+
+// Growable output buffer
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
 // Stack element for LR parser
 typedef struct {
     int state;          // State number
+    int index;          // Flat tree: post-order index of the subtree root
     Node* node;         // Parse tree node
 } StackElement;
 
@@ -58,4 +240,204 @@ typedef struct {
     int capacity;
 } Stack;
 
+// State-only stack for recognition (no tree nodes)
+typedef struct {
+    int* states;
+    int top;
+    int capacity;
+} StateStack;
+
+// Semantic value of a grammar symbol, owned by the caller's actions
+typedef union {
+    long num;
+    double real;
+    void* ptr;
+} SemValue;
+
+// yacc-style semantic actions, called while parsing instead of building
+// a tree. A NULL on_shift gives tokens a zero value; a NULL on_reduce
+// keeps the value of the first RHS symbol ($$ = $1).
+typedef struct {
+    SemValue (*on_shift)(int symbol, const char* text, int length, void* user);
+    SemValue (*on_reduce)(int rule, SemValue* values, int count, void* user);
+    void* user;
+} SemanticActions;
+
+// State stack with a parallel stack of semantic values
+typedef struct {
+    int* states;
+    SemValue* values;
+    int top;
+    int capacity;
+} ValueStack;
+
+// Engine counters. Each thread counts into its own ParserStats through
+// lr_stats (NULL = not counting); build with -DLR_NO_STATS to compile the
+// counting out of the engine entirely.
+#define PHASE_LOAD 0
+#define PHASE_PARSE 1
+#define PHASE_OUTPUT 2
+#define NUM_PHASES 3
+
+typedef struct {
+    int num_states;
+    int num_rules;
+    long* shifts;       // Shifts taken in each state [num_states]
+    long* reduces;      // Reduces taken in each state [num_states]
+    long* rule_reduces; // Reductions by each rule, unit chains included [num_rules]
+    long inputs;        // Inputs parsed
+    long max_depth;     // Deepest parser stack
+    long stack_reallocs;    // Parser stack growth (push and the state stacks)
+    long child_reallocs;    // add_child growth
+    long nodes;         // Tree nodes allocated (heap, arena or flat)
+    long reused;        // Subtrees shifted whole by incremental parses
+    double phase_ns[NUM_PHASES];  // Time spent loading, parsing and writing output
+} ParserStats;
+
+double stats_now_ns(void);
+
+#ifndef LR_NO_STATS
+extern __thread ParserStats* lr_stats;
+
+static inline void stats_shift(ParserStats* stats, int state, long depth) {
+    if (state < stats->num_states) stats->shifts[state]++;
+    if (depth > stats->max_depth) stats->max_depth = depth;
+}
+
+static inline void stats_reduce(ParserStats* stats, int state, int rule, long depth) {
+    if (state < stats->num_states) stats->reduces[state]++;
+    if (rule < stats->num_rules) stats->rule_reduces[rule]++;
+    if (depth > stats->max_depth) stats->max_depth = depth;
+}
+
+#define STAT_SHIFT(state, depth) do { if (lr_stats) stats_shift(lr_stats, state, depth); } while (0)
+#define STAT_REDUCE(state, rule, depth) do { if (lr_stats) stats_reduce(lr_stats, state, rule, depth); } while (0)
+#define STAT_RULE(rule) do { if (lr_stats && (rule) < lr_stats->num_rules) lr_stats->rule_reduces[rule]++; } while (0)
+#define STAT_ADD(field, n) do { if (lr_stats) lr_stats->field += (n); } while (0)
+#define STAT_TIME_BEGIN(var) double var = lr_stats ? stats_now_ns() : 0
+#define STAT_TIME_END(var, phase) do { if (lr_stats) lr_stats->phase_ns[phase] += stats_now_ns() - (var); } while (0)
+#else
+#define STAT_SHIFT(state, depth) ((void)0)
+#define STAT_REDUCE(state, rule, depth) ((void)0)
+#define STAT_RULE(rule) ((void)0)
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_TIME_BEGIN(var) ((void)0)
+#define STAT_TIME_END(var, phase) ((void)0)
+#endif
+
+// Binary trace (-T). The engines append one fixed-size TraceStep per action
+// through lr_trace (NULL = not tracing); build with -DLR_NO_TRACE to compile
+// the recording out. lr_replay turns a trace file back into the -v view.
+#define TRACE_MAGIC "LRTRACE2"
+#define TRACE_ACTION 0      // An action of the table
+#define TRACE_BEGIN 1       // Start of an input: the stack is reset to state 0
+
+typedef struct {
+    int pos;                // Input position (error: start of the bad token)
+    int depth;              // Stack depth after the step
+    int state;              // Top state the action was taken in
+    int action;             // Shift state, -(rule+1), ACTION_ACCEPT or ACTION_ERROR
+    int next;               // State pushed: the shift target or the GOTO
+    unsigned char symbol;   // Lookahead terminal (0 = not read)
+    unsigned char kind;     // TRACE_ACTION or TRACE_BEGIN
+} TraceStep;
+
+// Trace file header, followed by the steps in order
+typedef struct {
+    char magic[8];          // TRACE_MAGIC
+    int step_size;          // sizeof(TraceStep)
+    int reserved;
+    long skipped;           // Steps dropped by a ring before the first one
+} TraceHeader;
+
+typedef struct {
+    TraceStep* steps;       // Buffer of 'mask' + 1 steps (a power of two)
+    long mask;
+    long count;             // Steps recorded
+    long flushed;           // Steps written to 'out' so far
+    long limit;             // Count at which the buffer is written out
+    int ring;               // Keep only the last 'keep' steps, written at the end
+    long keep;
+    FILE* out;
+} TraceLog;
+
+#ifndef LR_NO_TRACE
+extern __thread TraceLog* lr_trace;
+void trace_flush(TraceLog* log);
+
+static inline void trace_step(TraceLog* log, int kind, int state, int action, int next,
+                              int symbol, int pos, int depth) {
+    TraceStep* step = &log->steps[log->count & log->mask];
+    step->pos = pos;
+    step->depth = depth;
+    step->state = state;
+    step->action = action;
+    step->next = next;
+    step->symbol = symbol > 0 ? (unsigned char)symbol : 0;
+    step->kind = (unsigned char)kind;
+    if (++log->count == log->limit) trace_flush(log);
+}
+
+#define TRACE(kind, state, action, next, symbol, pos, depth) \
+    do { if (lr_trace) trace_step(lr_trace, kind, state, action, next, symbol, pos, depth); } while (0)
+#else
+#define TRACE(kind, state, action, next, symbol, pos, depth) ((void)0)
+#endif
+
+// Shared packed parse forest (GLR). A symbol node stands for every
+// derivation of one symbol over one span of the input; each packed
+// alternative is one way to derive it (a rule and the nodes of its RHS).
+typedef struct ForestNode ForestNode;
+
+typedef struct ForestAlt {
+    int rule;           // Rule index (0-based)
+    int count;          // RHS length
+    ForestNode** children;  // One node per RHS symbol
+    struct ForestAlt* next; // Next alternative of the same node
+} ForestAlt;
+
+struct ForestNode {
+    Symbol symbol;      // Terminal or non-terminal
+    int start;          // First token covered (GSS level)
+    int end;            // One past the last token covered
+    int offset;         // Byte span in the input
+    int length;
+    ForestAlt* alts;    // Derivations (NULL for terminals)
+    int mark;           // Scratch for traversals (0 between calls)
+};
+
+// Outcome of a GLR parse
+typedef struct {
+    int accepted;       // 1 = ACCEPT, 0 = REJECT
+    int error_pos;      // Input position of the error (-1 if accepted)
+    ForestNode* root;   // Every derivation of the input (owned by the arena)
+    int max_tops;       // Most stack tops alive at one input position
+} GlrResult;
+
+// GLR parser workspace (glr.c), reused across inputs
+typedef struct GlrParser GlrParser;
+
+// Push parser state for input that arrives in chunks
+#define STREAM_RUNNING 0
+#define STREAM_ACCEPTED 1
+#define STREAM_REJECTED 2
+#define STREAM_FAILED 3     // Invalid rule or GOTO in the table, or out of memory
+
+typedef struct {
+    Grammar* grammar;
+    Table* table;
+    Stack* stack;       // LR stack, persists between feeds
+    NodeArena* arena;   // Tree nodes (NULL = no tree)
+    long pos;           // Bytes consumed so far
+    int status;         // STREAM_* code
+    int failure;        // STREAM_FAILED cause: -1 = table error, -2 = out of memory
+    ParseResult result;
+
+    // Lexer input not yet turned into tokens (grammars with a lexer)
+    char* pending;
+    size_t pending_len;
+    size_t pending_cap;
+    long fed;           // Bytes fed so far
+} ParserStream;
+
 #endif // STRUCTS_H
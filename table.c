@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200809L
+#include <sys/mman.h>
+#include "structs.h"
+
+// Check whether two dense columns hold the same action in every state
+static int same_column(Table* table, int a, int b) {
+    for (int s = 0; s < table->num_states; s++) {
+        if (table->data[(size_t)s * table->num_cols + a] != table->data[(size_t)s * table->num_cols + b]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Hash of a dense column, so that only columns with equal hashes are compared
+static unsigned column_hash(Table* table, int c) {
+    unsigned h = 2166136261u;
+    for (int s = 0; s < table->num_states; s++) {
+        h = (h ^ (unsigned)table->data[(size_t)s * table->num_cols + c]) * 16777619u;
+    }
+    return h;
+}
+
+// Compress a dense table in place: symbol equivalence classes + row displacement
+int compress_table(Table* table) {
+    if (!table->data) return 1;  // Already compressed
+    if (table->mapping) return 0;  // Mapped tables are read-only
+
+    int num_states = table->num_states;
+    int num_cols = table->num_cols;
+    int* classes = (int*)malloc(num_cols * sizeof(int));
+    int* representative = (int*)malloc(num_cols * sizeof(int));
+    unsigned* hashes = (unsigned*)malloc(num_cols * sizeof(unsigned));
+    int num_classes = 0;
+
+    // Phase 1: group symbols whose columns are identical
+    for (int c = 0; c < num_cols; c++) {
+        hashes[c] = column_hash(table, c);
+        int k;
+        for (k = 0; k < num_classes; k++) {
+            int r = representative[k];
+            if (hashes[r] == hashes[c] && same_column(table, c, r)) break;
+        }
+        if (k == num_classes) {
+            representative[num_classes++] = c;
+        }
+        classes[c] = k;
+    }
+    free(hashes);
+
+    // Phase 2: build class rows and pick the most frequent value as default
+    int* rows = (int*)malloc((size_t)num_states * num_classes * sizeof(int));
+    int* deflt = (int*)malloc(num_states * sizeof(int));
+    int* explicit_count = (int*)calloc(num_states, sizeof(int));
+
+    for (int s = 0; s < num_states; s++) {
+        int* row = &rows[(size_t)s * num_classes];
+        for (int k = 0; k < num_classes; k++) {
+            row[k] = table->data[(size_t)s * num_cols + representative[k]];
+        }
+
+        int best_count = 0;
+        int best = ACTION_ERROR;
+        for (int k = 0; k < num_classes; k++) {
+            int count = 0;
+            for (int j = 0; j < num_classes; j++) {
+                if (row[j] == row[k]) count++;
+            }
+            if (count > best_count) {
+                best_count = count;
+                best = row[k];
+            }
+        }
+        deflt[s] = best;
+        explicit_count[s] = num_classes - best_count;
+    }
+
+    // Phase 3: place the densest rows first (first-fit row displacement)
+    int* order = (int*)malloc(num_states * sizeof(int));
+    for (int s = 0; s < num_states; s++) order[s] = s;
+    for (int i = 1; i < num_states; i++) {
+        int s = order[i];
+        int j = i - 1;
+        while (j >= 0 && explicit_count[order[j]] < explicit_count[s]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = s;
+    }
+
+    int capacity = num_classes * 2 + 16;
+    int* next = (int*)malloc(capacity * sizeof(int));
+    int* check = (int*)malloc(capacity * sizeof(int));
+    for (int i = 0; i < capacity; i++) check[i] = -1;
+    int* base = (int*)malloc(num_states * sizeof(int));
+    int packed_len = 0;
+    int first_free = 0;  // Every cell below it is taken
+
+    for (int i = 0; i < num_states; i++) {
+        int s = order[i];
+        int* row = &rows[(size_t)s * num_classes];
+        int first = 0;
+        while (first < num_classes && row[first] == deflt[s]) first++;
+        // The first explicit cell cannot land below first_free
+        int b = first < num_classes && first_free > first ? first_free - first : 0;
+
+        // Find the first displacement where all explicit cells are free
+        for (;; b++) {
+            if (b + num_classes > capacity) {
+                int old = capacity;
+                capacity = (b + num_classes) * 2;
+                next = (int*)realloc(next, capacity * sizeof(int));
+                check = (int*)realloc(check, capacity * sizeof(int));
+                for (int j = old; j < capacity; j++) check[j] = -1;
+            }
+            int fits = 1;
+            for (int k = 0; k < num_classes && fits; k++) {
+                if (row[k] != deflt[s] && check[b + k] != -1) fits = 0;
+            }
+            if (fits) break;
+        }
+
+        base[s] = b;
+        for (int k = 0; k < num_classes; k++) {
+            if (row[k] != deflt[s]) {
+                next[b + k] = row[k];
+                check[b + k] = s;
+            }
+        }
+        // Every lookup base[s] + class must stay in bounds
+        if (b + num_classes > packed_len) packed_len = b + num_classes;
+        while (first_free < capacity && check[first_free] != -1) first_free++;
+    }
+
+    for (int i = 0; i < packed_len; i++) {
+        if (check[i] == -1) next[i] = ACTION_ERROR;
+    }
+    next = (int*)realloc(next, packed_len * sizeof(int));
+    check = (int*)realloc(check, packed_len * sizeof(int));
+
+    free(rows);
+    free(representative);
+    free(explicit_count);
+    free(order);
+    free(table->data);
+
+    table->data = NULL;
+    table->classes = classes;
+    table->num_classes = num_classes;
+    table->base = base;
+    table->deflt = deflt;
+    table->next = next;
+    table->check = check;
+    table->packed_len = packed_len;
+    return 1;
+}
+
+// A rule whose reduction pops exactly the state its GOTO pushed
+static int is_unit_rule(Grammar* grammar, int action) {
+    int rule = -action - 1;
+    return action < 0 && action != ACTION_ACCEPT && rule < grammar->num_rules &&
+           grammar->rules[rule].rhs_len == 1;
+}
+
+// Record one more action for cell (state, symbol), besides its table entry
+void add_conflict(Table* table, int state, int symbol, int action) {
+    Conflicts* conflicts = table->conflicts;
+    if (!conflicts) {
+        conflicts = table->conflicts = (Conflicts*)calloc(1, sizeof(Conflicts));
+    }
+    long cell = (long)state * table->num_cols + symbol;
+    for (int i = 0; i < conflicts->count; i++) {
+        if (conflicts->items[i].cell == cell && conflicts->items[i].action == action) return;
+    }
+    if (conflicts->count == conflicts->capacity) {
+        conflicts->capacity = conflicts->capacity ? conflicts->capacity * 2 : 16;
+        conflicts->items = (ConflictAction*)realloc(conflicts->items,
+                                                    conflicts->capacity * sizeof(ConflictAction));
+    }
+    conflicts->items[conflicts->count].cell = cell;
+    conflicts->items[conflicts->count].action = action;
+    conflicts->count++;
+}
+
+// Extra actions of cell (state, symbol): returns how many, the first at
+// table->conflicts->items[*first]
+int conflict_range(const Table* table, int state, int symbol, int* first) {
+    const Conflicts* conflicts = table->conflicts;
+    if (!conflicts || !conflicts->states[state]) return 0;
+    long cell = (long)state * table->num_cols + symbol;
+    int lo = 0;
+    int hi = conflicts->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (conflicts->items[mid].cell < cell) lo = mid + 1;
+        else hi = mid;
+    }
+    int count = 0;
+    while (lo + count < conflicts->count && conflicts->items[lo + count].cell == cell) count++;
+    *first = lo;
+    return count;
+}
+
+void free_conflicts(Conflicts* conflicts) {
+    if (!conflicts) return;
+    free(conflicts->items);
+    free(conflicts->states);
+    free(conflicts);
+}
+
+static int cmp_conflict(const void* a, const void* b) {
+    const ConflictAction* x = (const ConflictAction*)a;
+    const ConflictAction* y = (const ConflictAction*)b;
+    if (x->cell != y->cell) return x->cell < y->cell ? -1 : 1;
+    return (x->action > y->action) - (x->action < y->action);
+}
+
+// Sort the conflict actions and flag the states that have some
+static void prepare_conflicts(Table* table) {
+    Conflicts* conflicts = table->conflicts;
+    if (!conflicts) return;
+    qsort(conflicts->items, conflicts->count, sizeof(ConflictAction), cmp_conflict);
+    free(conflicts->states);
+    conflicts->states = (unsigned char*)calloc(table->num_states > 0 ? table->num_states : 1, 1);
+    for (int i = 0; i < conflicts->count; i++) {
+        int state = (int)(conflicts->items[i].cell / table->num_cols);
+        if (state < table->num_states) conflicts->states[state] = 1;
+    }
+}
+
+// Precompute the lookahead-free parts of the table:
+// - default_reduce[s]: the reduction of a state whose terminal cells are all
+//   that same reduction (or errors), so the engine skips the cell lookup.
+//   An error lookahead is then caught after the reduction, before any shift.
+// - unit_goto[p][A]: the state reached from GOTO(p, A) after running the
+//   chain of unit reductions (B -> A, C -> B, ...) that follow it by default.
+// - expected[s]: the terminals with an action in state s, for error reports.
+void prepare_table(Grammar* grammar, Table* table) {
+    int num_states = table->num_states;
+    int num_nonterminals = table->num_cols - NT_BASE;
+    free(table->default_reduce);
+    free(table->unit_goto);
+    free(table->expected);
+    int* default_reduce = (int*)calloc(num_states > 0 ? num_states : 1, sizeof(int));
+    int* unit_goto = (int*)calloc((size_t)(num_states > 0 ? num_states : 1) *
+                                  (num_nonterminals > 0 ? num_nonterminals : 1), sizeof(int));
+    uint64_t* expected = (uint64_t*)calloc((size_t)(num_states > 0 ? num_states : 1) * TERMSET_WORDS,
+                                           sizeof(uint64_t));
+
+    for (int s = 0; s < num_states; s++) {
+        int only = ACTION_ERROR;
+        int uniform = 1;
+        for (int c = 0; c < NT_BASE; c++) {
+            int action = table_action(table, s, c);
+            if (action == ACTION_ERROR) continue;
+            TERMSET_ADD(&expected[s * TERMSET_WORDS], c);
+            if (!uniform) continue;
+            if (action > 0 || action == ACTION_ACCEPT || (only && action != only)) {
+                uniform = 0;
+            }
+            only = action;
+        }
+        if (uniform && only != ACTION_ERROR && -only - 1 < grammar->num_rules) {
+            default_reduce[s] = only;
+        }
+    }
+
+    for (int p = 0; p < num_states; p++) {
+        for (int a = 0; a < num_nonterminals; a++) {
+            int target = table_action(table, p, NT_BASE + a);
+            // Follow the chain; the bound stops cyclic unit rules
+            for (int steps = 0; target > 0 && target < num_states && steps < grammar->num_rules; steps++) {
+                int action = default_reduce[target];
+                if (!is_unit_rule(grammar, action)) break;
+                int next = table_action(table, p, grammar->rules[-action - 1].lhs);
+                if (next <= 0) break;
+                target = next;
+            }
+            unit_goto[(size_t)p * num_nonterminals + a] = target;
+        }
+    }
+
+    table->default_reduce = default_reduce;
+    table->unit_goto = unit_goto;
+    table->expected = expected;
+    prepare_conflicts(table);
+}
+
+// Size in bytes of the action/goto data in its current layout
+size_t table_memory(Table* table) {
+    if (table->data) {
+        return (size_t)table->num_states * table->num_cols * sizeof(int);
+    }
+    return (size_t)table->num_cols * sizeof(int)
+         + (size_t)table->num_states * 2 * sizeof(int)
+         + (size_t)table->packed_len * 2 * sizeof(int);
+}
+
+// Free table memory in either layout; mapped tables are unmapped instead
+void free_table(Table* table) {
+    if (table->mapping) {
+        munmap(table->mapping, table->mapping_len);
+        table->mapping = NULL;
+        table->mapping_len = 0;
+    } else {
+        free(table->data);
+        free(table->classes);
+        free(table->base);
+        free(table->deflt);
+        free(table->next);
+        free(table->check);
+    }
+    free(table->default_reduce);
+    free(table->unit_goto);
+    free(table->expected);
+    free_conflicts(table->conflicts);
+    table->conflicts = NULL;
+    table->data = NULL;
+    table->classes = NULL;
+    table->base = NULL;
+    table->deflt = NULL;
+    table->next = NULL;
+    table->check = NULL;
+    table->default_reduce = NULL;
+    table->unit_goto = NULL;
+    table->expected = NULL;
+}
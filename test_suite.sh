@@ -20,10 +20,11 @@ run_test() {
     local grammar=$1
     local input=$2
     local expected=$3  # "accept" or "reject"
+    local flags=$4     # extra command-line flags (optional)
     
-    echo -n "Testing $grammar with '$input': "
+    echo -n "Testing $grammar with '$input' $flags: "
     
-    output=$(./lr_parser "$grammar" "$input" 2>&1)
+    output=$(./lr_parser "$grammar" "$input" $flags 2>&1)
     
     if echo "$output" | grep -q "Result: ACCEPT"; then
         result="accept"
@@ -40,6 +41,26 @@ run_test() {
     fi
 }
 
+# Function to check a command's output: the second tab-separated field of
+# each line (the whole line if it has no tab), joined by spaces
+run_output_test() {
+    local name=$1
+    local expected=$2
+    shift 2
+    
+    echo -n "Testing $name: "
+    
+    output=$("$@" 2>/dev/null | cut -f2 | tr '\n' ' ')
+    
+    if [ "$output" = "$expected" ]; then
+        echo -e "${GREEN}PASS${NC}"
+        ((passed++))
+    else
+        echo -e "${RED}FAIL${NC} (expected '$expected', got '$output')"
+        ((failed++))
+    fi
+}
+
 # Test grammar: S -> aSb | ε
 echo "--- Test 1: Balanced a's and b's ---"
 run_test "test" "" "accept"
@@ -84,6 +105,509 @@ run_test "test4" "abc" "reject"
 run_test "test4" "cabc" "reject"
 echo ""
 
+# Same grammars with the compressed table layout
+echo "--- Test 5: Compressed tables ---"
+run_test "test" "aabb" "accept" "-c"
+run_test "test" "abb" "reject" "-c"
+run_test "test2" "(())()" "accept" "-c"
+run_test "test2" ")(" "reject" "-c"
+run_test "test3" "(a+a)*a" "accept" "-c"
+run_test "test3" "a+" "reject" "-c"
+run_test "test4" "cacbc" "accept" "-c"
+run_test "test4" "cabc" "reject" "-c"
+echo ""
+
+# Recognize-only mode (no parse tree)
+echo "--- Test 6: Recognize only ---"
+run_test "test" "aaabbb" "accept" "-r"
+run_test "test" "aa" "reject" "-r"
+run_test "test3" "(a+a)*a" "accept" "-r -c"
+run_test "test3" "a+" "reject" "-r -c"
+run_test "test4" "cbcbc" "accept" "-r"
+run_test "test4" "abc" "reject" "-r"
+echo ""
+
+# Batch mode: one result record per input line
+run_batch_test() {
+    local name=$1
+    shift
+    run_output_test "batch $name" "$@"
+}
+
+echo "--- Test 7: Batch mode ---"
+run_batch_test "newline" "ACCEPT ACCEPT REJECT ACCEPT " \
+    sh -c "printf 'ab\naabb\nabb\n\n' | ./lr_parser test -b"
+run_batch_test "NUL-delimited" "ACCEPT REJECT ACCEPT " \
+    sh -c "printf 'a+a\0(a\0a*a' | ./lr_parser test3 -b -0"
+run_batch_test "trees" "ACCEPT " \
+    sh -c "printf 'cbc\n' | ./lr_parser test4 -b -t | grep -F 'A(B(B(c())b()c()))'"
+run_batch_test "flat trees" "S(a()S(a()Sb())b()) S " \
+    sh -c "printf 'aabb\n\n' | ./lr_parser test -b -t | cut -f2 --complement"
+run_batch_test "parallel order" "ACCEPT REJECT ACCEPT REJECT ACCEPT " \
+    sh -c "printf 'a\n+\n(a)\na+\na*a\n' | ./lr_parser test3 -b -j 4"
+# Several blocks of 65536 records: workers finishing a block race the next one
+seq 1000000 | sed 's/.*/a/' > many.tmp
+run_batch_test "parallel blocks" "1000000 1000000 1000000 1000000 1000000 " \
+    sh -c "for i in 1 2 3 4 5; do timeout 20 ./lr_parser test3 -b -j 64 many.tmp | grep -c ACCEPT; done"
+rm -f many.tmp
+echo ""
+
+# Streaming mode: the document is fed in chunks
+echo "--- Test 8: Streaming ---"
+run_output_test "stream accept" "E(E(a())+()E(E(a())*()E((()E(a()))()))) " \
+    sh -c "printf 'a+a*(a)' | ./lr_parser test3 -s -t"
+run_output_test "stream reject" "6 " \
+    sh -c "printf 'a+a*(a' | ./lr_parser test3 -s"
+run_output_test "stream large" "ACCEPT " \
+    sh -c "head -c 400000 /dev/zero | tr '\\0' '(' > stream.tmp; head -c 400000 /dev/zero | tr '\\0' ')' >> stream.tmp; ./lr_parser test2 -s stream.tmp; rm -f stream.tmp"
+echo ""
+
+# Precompiled binary tables, mapped in place
+echo "--- Test 9: Binary tables ---"
+./lr_parser test2 -o test2.lrb > /dev/null
+./lr_parser test3 -o test3.lrb -c > /dev/null
+run_test "test2.lrb" "(())()" "accept"
+run_test "test2.lrb" "(()" "reject"
+run_test "test3.lrb" "(a+a)*a" "accept"
+run_test "test3.lrb" "a+" "reject"
+cp test3.lrb corrupt.lrb
+printf 'x' | dd of=corrupt.lrb bs=1 seek=200 conv=notrunc 2> /dev/null
+run_test "corrupt.lrb" "a" "reject" "-V"
+# Row displacement of state 0 far outside next/check (header field base_off)
+cp test3.lrb corrupt.lrb
+printf '\177\177\177\177' | dd of=corrupt.lrb bs=1 seek="$(od -An -t u8 -j 120 -N 8 corrupt.lrb | tr -d ' ')" \
+    conv=notrunc 2> /dev/null
+run_output_test "corrupt table entry" "Error: corrupt.lrb: bad table entry " \
+    sh -c "./lr_parser corrupt.lrb a 2>&1 | grep '^Error'"
+rm -f corrupt.lrb test2.lrb test3.lrb
+echo ""
+
+# LALR(1) tables generated from the rules
+echo "--- Test 10: Generated tables ---"
+run_test "test" "aabb" "accept" "-g"
+run_test "test" "abb" "reject" "-g"
+run_test "test3" "(a+a)*a" "accept" "-g"
+run_test "test3" "a+" "reject" "-g"
+run_test "test4" "cacbc" "accept" "-g -c"
+run_test "test4" "cabc" "reject" "-g -c"
+run_test "test5" "a+a*(a+a)" "accept"
+run_test "test5" "a+*a" "reject"
+./lr_parser test5 -e > generated.tmp 2> /dev/null
+run_test "generated.tmp" "(a)*a+a" "accept"
+run_test "generated.tmp" "(a" "reject"
+rm -f generated.tmp
+run_output_test "conflicts" "2 " \
+    sh -c "./lr_parser test3 -g -e 2>&1 > /dev/null | grep -c 'Conflict (shift/reduce) in state 7'"
+echo ""
+
+# Lexer directives: tokens instead of bytes
+echo "--- Test 11: Lexer ---"
+run_test "test6" "foo + 42 * (bar_1 + x)" "accept"
+run_test "test6" "  a*b  " "accept"
+run_test "test6" "foo bar" "reject"
+run_test "test6" "12 + 34" "accept" "-r"
+run_output_test "lexer error position" "6 " \
+    sh -c "./lr_parser test6 'a + b # c' -r | sed -n 's/REJECT at position //p'"
+run_output_test "lexer batch" "ACCEPT REJECT " \
+    sh -c "printf 'x * (y + 1)\nx y\n' | ./lr_parser test6 -b -t"
+run_output_test "lexer stream" "ACCEPT " \
+    sh -c "for i in \$(seq 20000); do printf 'alpha_%d * (beta + 123) + ' \$i; done > lexer.tmp; printf 'omega' >> lexer.tmp; ./lr_parser test6 -s lexer.tmp; rm -f lexer.tmp"
+echo ""
+
+# Error recovery: all errors of an input in one pass
+echo "--- Test 12: Error recovery ---"
+run_test "test7" "x = 1; y = 2 * (a + b);" "accept" "-a"
+run_test "test7" "x = 1; y = = 2;" "reject" "-a"
+run_output_test "sync positions" "11 25 43 " \
+    sh -c "./lr_parser test7 'x = 1; y = = 2; z = (3 + ; w = 4 * b; v = 5' -a | sed -n 's/^Error at position \([0-9]*\):.*/\1/p'"
+run_output_test "expected set" "unexpected '=', expected: ( i n " \
+    sh -c "./lr_parser test7 'x = = 1;' -a | sed -n 's/^Error at position 4: //p'"
+run_output_test "expected after reductions" "unexpected 'a', expected: \$ * + " \
+    sh -c "./lr_parser test5 'aa' -a | sed -n 's/^Error at position 1: //p'"
+run_output_test "escaped errors" "unexpected '\\t', expected: \$ * + 1:\$*+ " \
+    sh -c "./lr_parser test5 \"\$(printf 'a\\tb')\" -a | sed -n 's/^Error at position 1: //p'; printf 'a\\tb\\n' | ./lr_parser test5 -b -a | cut -f4"
+run_output_test "no sync tokens" "2 6 " \
+    sh -c "./lr_parser test2 '())(()' -a | sed -n 's/^Error at position \([0-9]*\):.*/\1/p'"
+run_output_test "batch errors" "2:(a 4:\$+ 0:(a 1:(a 2:(a " \
+    sh -c "printf 'a+*a)\na\n++\n' | ./lr_parser test5 -b -a -j 2 | cut -f4 | grep ."
+run_output_test "emit keeps %sync" "1 " \
+    sh -c "./lr_parser test7 -e | grep -c '^%sync ;'"
+echo ""
+
+# Semantic actions: values computed during the parse, no tree
+echo "--- Test 13: Semantic actions ---"
+run_test "test6" "2 + 3 * (4 + 10)" "accept" "-x"
+run_test "test6" "2 + + 3" "reject" "-x"
+run_output_test "evaluate" "44 " \
+    sh -c "./lr_parser test6 '2 + 3 * (4 + 10)' -x | sed -n 's/^Value: //p'"
+run_output_test "evaluate compressed" "86 " \
+    sh -c "./lr_parser test6 '2+3*(4+10)*2' -x -c | sed -n 's/^Value: //p'"
+run_output_test "evaluate deep" "1999000 " \
+    sh -c "./lr_parser test6 \"\$(seq -s + 0 1999)\" -x | sed -n 's/^Value: //p'"
+echo ""
+
+# Tree output: iterative, buffered, several formats
+echo "--- Test 14: Tree output ---"
+run_test "test" "aabb" "accept" "-f indent"
+run_output_test "indent" "S;  a;  S;    a;    S;    b;  b; " \
+    sh -c "./lr_parser test aabb -f indent | sed -n '/^Parse Tree:/,/^\$/p' | sed '1d;\$d' | tr '\n' ';'"
+run_output_test "json" '{"symbol":"S","children":[{"symbol":"a","offset":0,"length":1},{"symbol":"S","children":[]},{"symbol":"b","offset":1,"length":1}]} ' \
+    sh -c "printf 'ab\n' | ./lr_parser test -b -f json | cut -f3"
+run_output_test "json spans" '"offset":0,"length":2 "offset":3,"length":1 "offset":5,"length":3 ' \
+    sh -c "printf 'ab + 100' | ./lr_parser test6 -s -f json | grep -o '\"offset\":[0-9]*,\"length\":[0-9]*'"
+run_output_test "batch json spans" '"offset":0,"length":2 "offset":3,"length":1 "offset":5,"length":3 ' \
+    sh -c "printf 'ab + 100\\n' | ./lr_parser test6 -b -f json | grep -o '\"offset\":[0-9]*,\"length\":[0-9]*'"
+run_output_test "deep tree" "3000009 " \
+    sh -c "head -c 300000 /dev/zero | tr '\\0' '(' > deep.tmp; head -c 300000 /dev/zero | tr '\\0' ')' >> deep.tmp; ./lr_parser test2 -s -t deep.tmp | wc -c; rm -f deep.tmp"
+echo ""
+
+# Engine counters exported as JSON
+echo "--- Test 15: Stats ---"
+run_test "test3" "a+a*(a)" "accept" "-S stats.tmp"
+run_output_test "counts" '"inputs":1,"shifts":7,"reduces":6,"max_stack_depth":7 ' \
+    sh -c "./lr_parser test3 'a+a*(a)' -S - 2>&1 > /dev/null | grep -o '\"inputs.*max_stack_depth\":[0-9]*'"
+run_output_test "rules" '{"rule":4,"lhs":"E","reductions":3} ' \
+    sh -c "./lr_parser test3 'a+a*(a)' -r -S - 2>&1 > /dev/null | grep -o '{\"rule\":4[^}]*}'"
+run_output_test "unit chain rules" '{"rule":4,"lhs":"T","reductions":3} {"rule":4,"lhs":"T","reductions":3} {"rule":4,"lhs":"T","reductions":3} ' \
+    sh -c "for m in -r -a -t; do ./lr_parser test5 'a+a*(a)' \$m -S - 2>&1 > /dev/null | grep -o '{\"rule\":4[^}]*}'; done"
+run_output_test "parallel merge" '"inputs":3000,"shifts":21000,"reduces":18000 ' \
+    sh -c "for i in \$(seq 3000); do echo 'a+a*(a)'; done | ./lr_parser test3 -b -j 3 -S stats.tmp > /dev/null 2>&1; grep -o '\"inputs\":[0-9]*,\"shifts\":[0-9]*,\"reduces\":[0-9]*' stats.tmp"
+run_output_test "stream nodes" '"nodes":13 ' \
+    sh -c "printf 'a+a*(a)' | ./lr_parser test3 -s -t -S - 2>&1 > /dev/null | grep -o '\"nodes\":[0-9]*'"
+rm -f stats.tmp
+echo ""
+
+# Direct-coded parsers generated from the tables
+echo "--- Test 16: Generated parsers ---"
+make -s test3_gen_main test6_gen_main test7_gen_main > /dev/null
+gen_compare() {
+    local grammar=$1
+    local input=$2
+    run_output_test "generated $grammar '$input'" "$(printf '%s' "$input" | ./lr_parser $grammar -s -t | cut -f2 | tr '\n' ' ')" \
+        ./${grammar}_gen_main $grammar "$input"
+}
+gen_compare test3 "(a+a)*a+a"
+gen_compare test3 "a+*a"
+gen_compare test6 "foo + 42 * (bar_1 + x)"
+gen_compare test6 "a + b # c"
+gen_compare test7 "x = 1; y = 2 * (a + b);"
+cat > oom.tmp.c << 'EOF_C'
+#include <stddef.h>
+// Stack growth past 100000 bytes fails, as if memory ran out (glibc)
+void* __libc_realloc(void* ptr, size_t size);
+void* realloc(void* ptr, size_t size) {
+    return size > 100000 ? NULL : __libc_realloc(ptr, size);
+}
+EOF_C
+deep="$(printf '%30000s' | tr ' ' '(')a$(printf '%30000s' | tr ' ' ')')"
+run_output_test "generated out of memory" "Error: out of memory " \
+    sh -c "gcc -shared -fPIC -o oom.tmp.so oom.tmp.c && LD_PRELOAD=./oom.tmp.so ./test3_gen_main test3 '$deep' 2>&1"
+rm -f oom.tmp.c oom.tmp.so
+run_output_test "generated from binary table" "ACCEPT " \
+    sh -c "./lr_parser test3 -o gen_bin.lrb -c && ./lr_parser gen_bin.lrb -C bin_gen.c && make -s bin_gen_main > /dev/null && ./bin_gen_main test3 'a*(a)' | cut -f1; rm -f gen_bin.lrb bin_gen.c bin_gen_main"
+echo ""
+
+# GLR: every action of conflict cells, shared packed forest
+echo "--- Test 17: GLR ---"
+run_test "test3" "a+a*a" "accept" "-G -g"
+run_test "test3" "a+a*" "reject" "-G -g"
+run_test "test6" "foo + 42 * (bar_1 + x)" "accept" "-G"
+run_output_test "ambiguous derivations" "2 5 14 " \
+    sh -c "for n in a+a*a a+a+a+a a+a*a+a*a; do ./lr_parser test3 \$n -G -g 2>/dev/null | sed -n 's/^Derivations: //p'; done"
+run_output_test "deterministic derivations" "1 " \
+    sh -c "./lr_parser test3 'a+a*a' -G | sed -n 's/^Derivations: //p'"
+run_output_test "packed node" "n11 E 0:5 = r1(n2 '+' n9) | r2(n10 '*' n8) " \
+    sh -c "./lr_parser test3 'a+a*a' -G -g 2>/dev/null | grep '^n11'"
+run_output_test "conflict cells round-trip" "d5/r1 d4/r1 d5/r2 d4/r2 5 " \
+    sh -c "./lr_parser test3 -g -e 2>/dev/null > glr.tmp; ./lr_parser glr.tmp -e | grep -o 'd[0-9]/r[0-9]'; ./lr_parser glr.tmp a+a+a+a -G | sed -n 's/^Derivations: //p'; rm -f glr.tmp"
+run_output_test "epsilon rules" "2 " \
+    sh -c "printf 'S:\$A\$B\\nA:a\\nA:\\nB:a\\nB:\\n' > glr.tmp; ./lr_parser glr.tmp a -G 2>/dev/null | sed -n 's/^Derivations: //p'; rm -f glr.tmp"
+echo ""
+
+# Embedding library: reusable contexts, errors as return codes
+echo "--- Test 18: Library ---"
+make -s lib > /dev/null
+cat > embed.tmp.c << 'EOF_C'
+#include "lrparser.h"
+int main(int argc, char* argv[]) {
+    LrGrammar* grammar;
+    ParserCtx* ctx;
+    printf("%d ", lr_grammar_load("no_such_grammar", &grammar));
+    if (lr_grammar_load(argv[1], &grammar) != LR_ACCEPT) return 1;
+    if (lr_ctx_create(grammar, &ctx) != LR_ACCEPT) return 1;
+    if (argc > 2) {
+        printf("%d\n", lr_parse(ctx, argv[2], strlen(argv[2])));
+        lr_ctx_free(ctx);
+        lr_grammar_free(grammar);
+        return 0;
+    }
+    int accepted = 0;
+    for (int i = 0; i < 1000; i++) {
+        const char* input = (i % 2) ? "a+*a" : "(a+a)*a";
+        if (lr_parse(ctx, input, strlen(input)) == LR_ACCEPT) accepted++;
+    }
+    printf("%d %d ", accepted, lr_error_pos(ctx));
+    printf("%d ", lr_recognize(ctx, "a*(a)", 5));
+    lr_parse(ctx, "a*(a)", 5);
+    lr_write_tree(ctx, TREE_COMPACT, stdout);
+    lr_ctx_reset(ctx);
+    printf("%s\n", lr_tree(ctx) ? "tree" : "reset");
+    lr_ctx_free(ctx);
+    lr_grammar_free(grammar);
+    return 0;
+}
+EOF_C
+embed_expected="-3 500 2 1 E(E(a())*()E((()E(a()))())) reset "
+run_output_test "static library" "$embed_expected" \
+    sh -c "gcc -std=c99 -pthread -I. -o embed.tmp embed.tmp.c liblrparser.a 2>/dev/null && ./embed.tmp test3 2>/dev/null"
+run_output_test "shared library" "$embed_expected" \
+    sh -c "gcc -std=c99 -pthread -I. -o embed.tmp embed.tmp.c -L. -llrparser 2>/dev/null && LD_LIBRARY_PATH=. ./embed.tmp test3 2>/dev/null"
+cat > clash.tmp.c << 'EOF_C'
+#include "lrparser.h"
+// Names also used inside the engine must stay the embedder's own
+int push(int x) { return x + 1; }
+int parse(int x) { return x * 2; }
+int main(int argc, char* argv[]) {
+    LrGrammar* grammar;
+    ParserCtx* ctx;
+    if (argc < 2 || lr_grammar_load(argv[1], &grammar) != LR_ACCEPT) return 1;
+    if (lr_ctx_create(grammar, &ctx) != LR_ACCEPT) return 1;
+    printf("%d %d %d\n", lr_parse(ctx, "a+a", 3), push(1), parse(3));
+    lr_ctx_free(ctx);
+    lr_grammar_free(grammar);
+    return 0;
+}
+EOF_C
+run_output_test "library symbol clash" "1 2 6 1 2 6 " \
+    sh -c "gcc -std=c99 -pthread -I. -o clash.tmp clash.tmp.c liblrparser.a && ./clash.tmp test3 && gcc -std=c99 -pthread -I. -o clash.tmp clash.tmp.c -L. -llrparser && LD_LIBRARY_PATH=. ./clash.tmp test3"
+run_output_test "library exports" "lr_ctx_create lr_ctx_free lr_ctx_reset lr_error_pos lr_grammar_free lr_grammar_load lr_parse lr_recognize lr_reparse lr_strerror lr_tree lr_write_tree " \
+    sh -c "nm -D --defined-only liblrparser.so | awk '\$2 == \"T\" { print \$3 }' | sort"
+rm -f clash.tmp clash.tmp.c
+printf 'S:a\n\ta\t$\tS\n0\tr1\t\t\n' > bad.tmp
+run_output_test "malformed table" "-3 -1 " \
+    sh -c "LD_LIBRARY_PATH=. ./embed.tmp bad.tmp a 2>&1 | grep -v '^Error: Cannot open file'"
+run_output_test "malformed table message" "Error: malformed parsing table 0 " \
+    sh -c "echo a | ./lr_parser bad.tmp -s 2>&1"
+cat > embed.tmp.c << 'EOF_C'
+#include "lrparser.h"
+// Stack or buffer growth past 100000 bytes fails, as if memory ran out (glibc)
+void* __libc_realloc(void* ptr, size_t size);
+void* realloc(void* ptr, size_t size) {
+    return size > 100000 ? NULL : __libc_realloc(ptr, size);
+}
+int main(int argc, char* argv[]) {
+    LrGrammar* grammar;
+    ParserCtx* ctx;
+    if (argc < 3 || lr_grammar_load(argv[1], &grammar) != LR_ACCEPT) return 1;
+    if (lr_ctx_create(grammar, &ctx) != LR_ACCEPT) return 1;
+    size_t len = strlen(argv[2]);
+    printf("%d ", lr_parse(ctx, argv[2], len));
+    printf("%d ", lr_recognize(ctx, argv[2], len));
+    printf("%d ", lr_reparse(ctx, argv[2], len, NULL, 0));
+    printf("%d ", lr_parse(ctx, "a", 1));
+    // A shallow tree whose output outgrows the buffer
+    static char wide[40001];
+    for (size_t i = 0; i < sizeof(wide); i++) wide[i] = i % 2 ? '+' : 'a';
+    printf("%d ", lr_parse(ctx, wide, sizeof(wide)));
+    FILE* sink = fopen("/dev/null", "w");
+    printf("%d\n", lr_write_tree(ctx, TREE_JSON, sink));
+    fclose(sink);
+    lr_ctx_free(ctx);
+    lr_grammar_free(grammar);
+    return 0;
+}
+EOF_C
+deep="$(printf '%30000s' | tr ' ' '(')a$(printf '%30000s' | tr ' ' ')')"
+run_output_test "library out of memory" "-2 -2 -2 1 1 -2 " \
+    sh -c "gcc -std=c99 -pthread -I. -o embed.tmp embed.tmp.c liblrparser.a 2>/dev/null && ./embed.tmp test3 '$deep'"
+rm -f embed.tmp embed.tmp.c bad.tmp
+echo ""
+
+# Large-document mode: the input file is mapped and parsed in place
+echo "--- Test 19: Mapped input ---"
+printf 'a+a*(a)' > mapped.tmp
+run_output_test "mapped tree" "$(./lr_parser test3 -s -t < mapped.tmp | cut -f2 | tr '\n' ' ')" \
+    ./lr_parser test3 -m mapped.tmp -t
+run_output_test "mapped reject" "6 " \
+    sh -c "printf 'a+a*(a' > mapped.tmp; ./lr_parser test3 -m mapped.tmp"
+run_output_test "mapped offsets" '"offset":0,"length":3 "offset":6,"length":2 ' \
+    sh -c "printf 'foo + 42' > mapped.tmp; ./lr_parser test6 -m mapped.tmp -f json | grep -o '\"offset\":[0-9]*,\"length\":[0-9]*' | sed -n '1p;3p'"
+run_output_test "mapped empty file" "ACCEPT " \
+    sh -c ": > mapped.tmp; ./lr_parser test -m mapped.tmp"
+run_output_test "mapped missing file" "1 " \
+    sh -c "./lr_parser test -m no_such_file.tmp; echo \$?"
+rm -f mapped.tmp
+echo ""
+
+echo "--- Test 20: Parallel chunks ---"
+for i in $(seq 3000); do printf 'x%d = a*(b+%d);\n' $i $i; done > par7.tmp
+for i in $(seq 3000); do printf '(()())'; done > par2.tmp
+for i in $(seq 1500); do printf '(()((()))(()))'; done >> par2.tmp
+run_output_test "parallel %sync tree" "$(./lr_parser test7 -m par7.tmp -t | cksum) " \
+    sh -c "./lr_parser test7 -m par7.tmp -j 4 -t | cksum"
+run_output_test "parallel %sync stitched" "Parallel: 4 chunks, 3 stitched, 0 reparsed " \
+    sh -c "./lr_parser test7 -m par7.tmp -j 4 2>&1 >/dev/null"
+run_output_test "parallel recursion tree" "$(./lr_parser test2 -m par2.tmp -t | cksum) " \
+    sh -c "./lr_parser test2 -m par2.tmp -j 3 -t | cksum"
+run_output_test "parallel fallback" "Parallel: 3 chunks, 1 stitched, 1 reparsed " \
+    sh -c "./lr_parser test2 -m par2.tmp -j 3 2>&1 >/dev/null"
+run_output_test "parallel reject" "$(printf 'y = 1 +;\n' >> par7.tmp; ./lr_parser test7 -m par7.tmp | cut -f2) " \
+    ./lr_parser test7 -m par7.tmp -j 4
+rm -f par7.tmp par2.tmp
+echo ""
+
+# Incremental mode: the old file's tree is reused for the edited new file
+echo "--- Test 21: Incremental reparse ---"
+for i in $(seq 200); do printf 'x%d = a*(b+%d);\n' $i $i; done > old.tmp
+sed 's/x150 = a\*(b+150)/x150 = (a+c)*b/' old.tmp > new.tmp
+run_output_test "reparse tree" "$(./lr_parser test7 -m new.tmp -f json | cksum) " \
+    sh -c "./lr_parser test7 -m new.tmp -u old.tmp -f json | cksum"
+run_output_test "reparse reused subtrees" '"reused":51 ' \
+    sh -c "./lr_parser test7 -m new.tmp -u old.tmp -S - 2>&1 >/dev/null | grep -o '\"reused\":[0-9]*'"
+printf 'foo + 42 * bar' > old.tmp
+run_output_test "reparse merged token" "$(printf 'foo + 42 * ba' > new.tmp; ./lr_parser test6 -m new.tmp -f json | cut -f2) " \
+    ./lr_parser test6 -m new.tmp -u old.tmp -f json
+run_output_test "reparse reject" "8 " \
+    sh -c "printf 'foo + 42bar' > new.tmp; ./lr_parser test6 -m new.tmp -u old.tmp"
+cat > embed.tmp.c << 'EOF_C'
+#include "lrparser.h"
+int main(int argc, char* argv[]) {
+    LrGrammar* grammar;
+    ParserCtx* ctx;
+    if (argc < 2 || lr_grammar_load(argv[1], &grammar) != LR_ACCEPT) return 1;
+    if (lr_ctx_create(grammar, &ctx) != LR_ACCEPT) return 1;
+    LrEdit append = { 3, 0, 2 };
+    LrEdit bad = { 6, 0, 2 };
+    printf("%d ", lr_reparse(ctx, "a+a", 3, NULL, 0));
+    printf("%d ", lr_reparse(ctx, "a+a*a", 5, &append, 1));
+    lr_write_tree(ctx, TREE_COMPACT, stdout);
+    printf("%d ", lr_reparse(ctx, "a+a*a*a", 7, &bad, 1));
+    LrEdit tail = { 5, 0, 1 };
+    printf("%d ", lr_reparse(ctx, "a+a*a*", 6, &tail, 1));
+    LrEdit parens[] = { { 4, 0, 1 }, { 5, 0, 1 } };
+    printf("%d ", lr_reparse(ctx, "a+a*(a)", 7, parens, 2));
+    lr_write_tree(ctx, TREE_COMPACT, stdout);
+    lr_ctx_free(ctx);
+    lr_grammar_free(grammar);
+    return 0;
+}
+EOF_C
+run_output_test "library reparse" "1 1 E(E(a())+()E(E(a())*()E(a()))) -4 0 1 E(E(a())+()E(E(a())*()E((()E(a()))()))) " \
+    sh -c "gcc -std=c99 -pthread -I. -o embed.tmp embed.tmp.c liblrparser.a 2>/dev/null && ./embed.tmp test3"
+rm -f old.tmp new.tmp embed.tmp embed.tmp.c
+echo ""
+
+# Daemon mode: requests over a Unix socket, grammars cached between them
+echo "--- Test 22: Parse daemon ---"
+./lr_parser -d daemon.sock.tmp -n 2 2> daemon.log.tmp &
+daemon_pid=$!
+for i in $(seq 50); do grep -q Listening daemon.log.tmp 2>/dev/null && break; sleep 0.1; done
+printf 'a+a\na*(a)\na+*a\n\n' > inputs.tmp
+run_output_test "daemon trees" "$(./lr_parser test3 -b -t inputs.tmp 2>/dev/null | cksum) " \
+    sh -c "./lr_client daemon.sock.tmp test3 -t inputs.tmp 2>/dev/null | cksum"
+run_output_test "daemon json" "$(printf 'foo + 42' > one.tmp; ./lr_parser test6 -m one.tmp -f json | cut -f2) " \
+    sh -c "echo 'foo + 42' | ./lr_client daemon.sock.tmp test6 -f json | cut -f3"
+cp test3 grammar.tmp
+run_output_test "daemon cached grammar" "E(E(a())+()E(a())) " \
+    sh -c "echo a+a | ./lr_client daemon.sock.tmp grammar.tmp -t | cut -f3"
+cp test6 grammar.tmp
+run_output_test "daemon reloads changed grammar" "E(E(T(F(i())))+()T(F(i()))) " \
+    sh -c "echo a+a | ./lr_client daemon.sock.tmp grammar.tmp -t | cut -f3"
+: > grammar.tmp
+run_output_test "daemon bad grammar" "ERROR " \
+    sh -c "echo a | ./lr_client daemon.sock.tmp grammar.tmp"
+echo a | ./lr_client daemon.sock.tmp test3 > /dev/null 2>&1
+run_output_test "daemon bad grammar keeps cache" "ERROR ACCEPT " \
+    sh -c "echo a | ./lr_client daemon.sock.tmp grammar.tmp; echo a | ./lr_client daemon.sock.tmp test6"
+kill $daemon_pid
+wait $daemon_pid
+run_output_test "daemon cache summary" "Server: 8 connections, 11 requests, 5 grammar loads, 1 evictions " \
+    sh -c "grep Server: daemon.log.tmp"
+run_output_test "daemon socket removed" "gone " \
+    sh -c "test -e daemon.sock.tmp || echo gone"
+rm -f daemon.sock.tmp daemon.log.tmp inputs.tmp one.tmp grammar.tmp
+cat > oom.tmp.c << 'EOF_C'
+#include <stddef.h>
+// Buffer growth past 1000000 bytes fails, as if memory ran out (glibc)
+void* __libc_realloc(void* ptr, size_t size);
+void* realloc(void* ptr, size_t size) {
+    return size > 1000000 ? NULL : __libc_realloc(ptr, size);
+}
+EOF_C
+gcc -shared -fPIC -o oom.tmp.so oom.tmp.c
+LD_PRELOAD=./oom.tmp.so ./lr_parser -d daemon.sock.tmp 2> daemon.log.tmp &
+daemon_pid=$!
+for i in $(seq 50); do grep -q Listening daemon.log.tmp 2>/dev/null && break; sleep 0.1; done
+head -c 2000000 /dev/zero | tr '\0' a > big.tmp
+echo >> big.tmp
+run_output_test "daemon out of memory" "ACCEPT ACCEPT " \
+    sh -c "echo a | ./lr_client daemon.sock.tmp test3; ./lr_client daemon.sock.tmp test3 big.tmp; echo a | ./lr_client daemon.sock.tmp test3"
+kill $daemon_pid
+wait $daemon_pid
+rm -f daemon.sock.tmp daemon.log.tmp oom.tmp.c oom.tmp.so big.tmp
+echo ""
+
+# Binary trace: -T records the engine steps, lr_replay shows them again
+echo "--- Test 23: Binary trace ---"
+run_output_test "replay matches -v" "$(./lr_parser test3 'a+a*(a)' -v -T trace1.tmp | grep -o 'Pile: [0-9 ]*' | cksum) " \
+    sh -c "./lr_replay trace1.tmp | grep -o 'Pile: [0-9 ]*' | cksum"
+run_output_test "replay view" "#2 Flot: +a*(a)\$ | Pile: 0 3 | REDUCE by rule 4: E -> a | GOTO 1 " \
+    sh -c "printf 'a+a*(a)' > input.tmp; ./lr_replay trace1.tmp -i input.tmp -g test3 | sed -n 3p"
+run_output_test "replay rule filter" "#2 #5 #9 " \
+    sh -c "./lr_replay trace1.tmp -r 4 | cut -d' ' -f1"
+run_output_test "replay state filter" "#6 Flot: @3 | Pile: 0 1 4 7 | SHIFT 5 #13 Flot: @7 | Pile: 0 1 4 7 | REDUCE by rule 1 | GOTO 1 " \
+    ./lr_replay trace1.tmp -s 7
+run_output_test "replay batch inputs" "3 " \
+    sh -c "printf 'a\na+a\n+\n' | ./lr_parser test3 -b -t -T trace2.tmp > /dev/null 2>&1; ./lr_replay trace2.tmp | grep -c '=== Input'"
+run_output_test "trace diff" "Traces differ at step 7: " \
+    sh -c "./lr_parser test3 'a+a*a' -T trace2.tmp > /dev/null; ./lr_replay trace1.tmp -d trace2.tmp | head -1"
+run_output_test "trace match" "Traces match: 15 steps " \
+    ./lr_replay trace1.tmp -d trace1.tmp
+for i in $(seq 2000); do printf 'x%d = a*(b+%d);\n' $i $i; done > input.tmp
+printf 'y = 1 +;\n' >> input.tmp
+run_output_test "trace ring on reject" "#40006 Flot: ;\n\$ | Pile: ? ? ? ? 6 13 | ERROR on ';' at 37793 " \
+    sh -c "./lr_parser test7 -m input.tmp -T trace1.tmp -L 4 > /dev/null; ./lr_replay trace1.tmp -i input.tmp | tail -1"
+run_output_test "trace ring size" "4 " \
+    sh -c "./lr_replay trace1.tmp | wc -l"
+run_output_test "replay rejects other files" "1 " \
+    sh -c "./lr_replay input.tmp 2>/dev/null; echo \$?"
+./lr_parser test3 'a+a*(a)' -T trace2.tmp > /dev/null
+printf '\177\177\177\177' | dd of=trace2.tmp bs=1 seek=76 conv=notrunc 2>/dev/null
+run_output_test "replay rejects bad steps" "Error: trace2.tmp: bad step 2 1 " \
+    sh -c "./lr_replay trace2.tmp 2>&1 >/dev/null; echo \$?"
+run_output_test "trace write failure" "1 " \
+    sh -c "./lr_parser test3 a -T /dev/full > /dev/null 2>&1; echo \$?"
+rm -f trace1.tmp trace2.tmp input.tmp
+echo ""
+
+# Named non-terminals: more symbols, rules and states than 8-bit codes hold
+echo "--- Test 24: Large grammars ---"
+{
+    echo '<doc>:$<doc>$<word>'
+    echo '<doc>:$<word>'
+    for i in $(seq 0 199); do
+        echo "<word>:\$<w$i>"
+        echo "<w$i>:$(printf "\\$(printf %o $((97 + i / 26)))\\$(printf %o $((97 + i % 26)))");"
+    done
+    printf '<word>:\xe9;\n'
+} > large.tmp
+run_output_test "large grammar size" "LALR(1): 614 states, 614 after merging equivalent states, 0 conflicts " \
+    sh -c "./lr_parser large.tmp ab\; -g 2>&1 | head -1"
+run_output_test "large grammar tree" "doc(doc(word(w1(a()b();())))word(w185(h()d();()))) " \
+    sh -c "printf 'ab;hd;\n' | ./lr_parser large.tmp -g -b -t | cut -f3"
+run_output_test "large grammar byte 0xe9" "ACCEPT REJECT " \
+    sh -c "printf 'hr;\\351;\nhs;\n' | ./lr_parser large.tmp -g -b"
+run_output_test "large grammar byte 0xe9 GLR" "1 " \
+    sh -c "printf 'S:\$A\\351\\nA:a\\n' > large2.tmp; ./lr_parser large2.tmp \"\$(printf 'a\\351')\" -G | sed -n 's/^Derivations: //p'"
+run_output_test "large grammar text round trip" "ACCEPT REJECT " \
+    sh -c "./lr_parser large.tmp -g -e > large2.tmp; printf 'hr;\\351;aa;\n\\351\n' | ./lr_parser large2.tmp -b -c"
+run_output_test "large grammar binary" "doc(doc(word(w0(a()a();())))word(w199(h()r();()))) " \
+    sh -c "./lr_parser large.tmp -g -o large.bin.tmp > /dev/null; printf 'aa;hr;\n' | ./lr_parser large.bin.tmp -b -t | cut -f3"
+run_output_test "large grammar bad name" "Error: Bad rule: <a b>:x " \
+    sh -c "printf '<a b>:x\n' > large2.tmp; ./lr_parser large2.tmp x -g 2>&1 | grep Error"
+rm -f large.tmp large2.tmp large.bin.tmp
+echo ""
+
 echo "========================================="
 echo "Results: ${GREEN}$passed passed${NC}, ${RED}$failed failed${NC}"
 echo "========================================="
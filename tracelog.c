@@ -0,0 +1,77 @@
+#include "structs.h"
+
+// Binary trace recording (-T). Steps go to a power-of-two buffer. A
+// streamed trace writes the buffer to the file each time it fills; a ring
+// (-L N) overwrites it and writes the last N steps when the run ends.
+
+#ifndef LR_NO_TRACE
+__thread TraceLog* lr_trace = NULL;
+#endif
+
+#define TRACE_BUFFER (1L << 16)    // Steps buffered by a streamed trace
+
+// Write the header; 'skipped' steps came before the first one in the file
+static int write_trace_header(FILE* out, long skipped) {
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.step_size = sizeof(TraceStep);
+    header.skipped = skipped;
+    return fwrite(&header, sizeof(header), 1, out) == 1;
+}
+
+// Open a trace file; 'keep' > 0 keeps only the last 'keep' steps.
+// Returns NULL if the file cannot be written.
+TraceLog* create_trace(const char* path, long keep) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write trace to %s\n", path);
+        return NULL;
+    }
+    long size = TRACE_BUFFER;
+    if (keep > 0) {
+        size = 16;
+        while (size < keep) size *= 2;
+    }
+    TraceLog* log = (TraceLog*)calloc(1, sizeof(TraceLog));
+    log->steps = (TraceStep*)malloc(size * sizeof(TraceStep));
+    log->mask = size - 1;
+    log->ring = keep > 0;
+    log->keep = keep;
+    log->limit = log->ring ? -1 : size;
+    log->out = out;
+    if (!log->ring) write_trace_header(out, 0);
+    return log;
+}
+
+// Write the buffered steps of a streamed trace
+void trace_flush(TraceLog* log) {
+    fwrite(log->steps, sizeof(TraceStep), log->count - log->flushed, log->out);
+    log->flushed = log->count;
+    log->limit = log->count + log->mask + 1;
+}
+
+// Write what is left and close the file; returns 0 if writing failed
+int finish_trace(TraceLog* log) {
+    if (!log) return 1;
+#ifndef LR_NO_TRACE
+    if (lr_trace == log) lr_trace = NULL;
+#endif
+    if (log->ring) {
+        long kept = log->count < log->keep ? log->count : log->keep;
+        write_trace_header(log->out, log->count - kept);
+        // The kept steps wrap around the end of the buffer at most once
+        long first = (log->count - kept) & log->mask;
+        long head = kept < log->mask + 1 - first ? kept : log->mask + 1 - first;
+        fwrite(log->steps + first, sizeof(TraceStep), head, log->out);
+        fwrite(log->steps, sizeof(TraceStep), kept - head, log->out);
+    } else {
+        trace_flush(log);
+    }
+    int ok = !ferror(log->out);
+    ok = fclose(log->out) == 0 && ok;
+    if (!ok) fprintf(stderr, "Error: Cannot write the trace file\n");
+    free(log->steps);
+    free(log);
+    return ok;
+}
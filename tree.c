@@ -1,70 +1,505 @@
 #include "structs.h"
 
 // Create a new tree node
-Node* create_node(char symbol) {
+Node* create_node(int symbol) {
     Node* node = (Node*)malloc(sizeof(Node));
-    node->symbol = symbol;
+    STAT_ADD(nodes, 1);
+    node->symbol = (Symbol)symbol;
+    node->state = 0;
     node->children = NULL;
     node->num_children = 0;
-    node->capacity = 0;
+    node->offset = 0;
+    node->length = 0;
     return node;
 }
 
-// Add a child to a node
+// Add a child to a node. The array holds 4 children, then doubles: it is
+// full when the count is 4 or more and a power of two.
 void add_child(Node* parent, Node* child) {
-    if (parent->num_children >= parent->capacity) {
-        parent->capacity = (parent->capacity == 0) ? 4 : parent->capacity * 2;
-        parent->children = (Node**)realloc(parent->children, parent->capacity * sizeof(Node*));
+    int count = parent->num_children;
+    if (count == 0 || (count >= 4 && (count & (count - 1)) == 0)) {
+        int capacity = count == 0 ? 4 : count * 2;
+        parent->children = (Node**)realloc(parent->children, capacity * sizeof(Node*));
+        STAT_ADD(child_reallocs, 1);
     }
     parent->children[parent->num_children++] = child;
 }
 
-// Print tree in the format S(a()...) recursively
-void print_tree_recursive(Node* node) {
+// Free a heap tree (create_node/add_child) without recursion: a node's
+// children are moved onto an explicit stack before the node is freed
+void free_tree(Node* node) {
     if (!node) return;
     
-    // Print the symbol
-    if (IS_NONTERMINAL(node->symbol)) {
-        printf("%c", GET_CHAR(node->symbol));
-    } else {
-        printf("%c", node->symbol);
+    int capacity = 64;
+    int top = 0;
+    Node** todo = (Node**)malloc(capacity * sizeof(Node*));
+    todo[top++] = node;
+    
+    while (top > 0) {
+        Node* current = todo[--top];
+        if (top + current->num_children > capacity) {
+            while (top + current->num_children > capacity) capacity *= 2;
+            todo = (Node**)realloc(todo, capacity * sizeof(Node*));
+        }
+        for (int i = 0; i < current->num_children; i++) {
+            todo[top++] = current->children[i];
+        }
+        free(current->children);
+        free(current);
+    }
+    free(todo);
+}
+
+// Allocate a new slab with at least 'size' usable bytes
+static Slab* new_slab(size_t size) {
+    Slab* slab = (Slab*)malloc(sizeof(Slab) + size);
+    if (!slab) return NULL;
+    slab->next = NULL;
+    slab->size = size;
+    slab->used = 0;
+    return slab;
+}
+
+// Create a node arena with the given slab size (NULL if out of memory)
+NodeArena* create_arena(size_t slab_size) {
+    NodeArena* arena = (NodeArena*)malloc(sizeof(NodeArena));
+    if (!arena) return NULL;
+    arena->slab_size = slab_size;
+    arena->first = new_slab(slab_size);
+    if (!arena->first) {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    return arena;
+}
+
+// Hand out 'size' bytes (8-byte aligned) from the arena; NULL if a new
+// slab cannot be allocated
+void* arena_alloc(NodeArena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    Slab* slab = arena->current;
+
+    while (slab->used + size > slab->size) {
+        if (!slab->next || slab->next->size < size) {
+            // Insert a fresh slab after the current one (kept on reset)
+            Slab* fresh = new_slab(size > arena->slab_size ? size : arena->slab_size);
+            if (!fresh) return NULL;
+            fresh->next = slab->next;
+            slab->next = fresh;
+        }
+        slab = slab->next;
+        slab->used = 0;
+        arena->current = slab;
     }
+
+    void* ptr = slab->data + slab->used;
+    slab->used += size;
+    return ptr;
+}
+
+// Create a tree node in the arena (NULL if out of memory)
+Node* arena_node(NodeArena* arena, int symbol) {
+    Node* node = (Node*)arena_alloc(arena, sizeof(Node));
+    if (!node) return NULL;
+    STAT_ADD(nodes, 1);
+    node->symbol = (Symbol)symbol;
+    node->state = 0;
+    node->children = NULL;
+    node->num_children = 0;
+    node->offset = 0;
+    node->length = 0;
+    return node;
+}
+
+// Allocate a fixed-size child array in the arena (NULL if out of memory)
+Node** arena_children(NodeArena* arena, int count) {
+    return (Node**)arena_alloc(arena, count * sizeof(Node*));
+}
+
+// Release every node in O(1); slabs are kept for the next parse
+void reset_arena(NodeArena* arena) {
+    arena->current = arena->first;
+    arena->first->used = 0;
+}
+
+// Bytes handed out since the last reset
+size_t arena_bytes(const NodeArena* arena) {
+    size_t used = 0;
+    for (const Slab* slab = arena->first;; slab = slab->next) {
+        used += slab->used;
+        if (slab == arena->current) break;
+    }
+    return used;
+}
+
+// Append the slabs of 'other' to 'arena' and free 'other', so that nodes
+// built in 'other' live as long as 'arena'. Call it once 'arena' is done
+// allocating: later allocations may reuse the adopted slabs after a reset.
+void arena_adopt(NodeArena* arena, NodeArena* other) {
+    Slab* last = arena->first;
+    while (last->next) last = last->next;
+    last->next = other->first;
+    free(other);
+}
+
+// Free the arena and all of its slabs
+void free_arena(NodeArena* arena) {
+    Slab* slab = arena->first;
+    while (slab) {
+        Slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(arena);
+}
+
+// Make room for 'len' more bytes; returns the write position, or NULL if
+// out of memory (the buffer is left as it was)
+static inline char* outbuf_reserve(OutBuf* out, size_t len) {
+    if (out->len + len > out->cap) {
+        size_t cap = out->cap ? out->cap : 256;
+        while (cap < out->len + len) cap *= 2;
+        char* data = (char*)realloc(out->data, cap);
+        if (!data) return NULL;
+        out->data = data;
+        out->cap = cap;
+    }
+    return out->data + out->len;
+}
+
+// Append raw bytes to an output buffer; returns 0 if out of memory
+int outbuf_write(OutBuf* out, const char* data, size_t len) {
+    if (len == 0) return 1;
+    char* p = outbuf_reserve(out, len);
+    if (!p) return 0;
+    memcpy(p, data, len);
+    out->len += len;
+    return 1;
+}
+
+// Create an empty flat tree with room for 'capacity' nodes
+FlatTree* create_flat_tree(int capacity) {
+    FlatTree* tree = (FlatTree*)malloc(sizeof(FlatTree));
+    if (capacity < 16) capacity = 16;
+    tree->symbols = (Symbol*)malloc(capacity * sizeof(Symbol));
+    tree->rules = (int*)malloc(capacity * sizeof(int));
+    tree->arity = (uint16_t*)malloc(capacity * sizeof(uint16_t));
+    tree->size = (int*)malloc(capacity * sizeof(int));
+    tree->offset = (int*)malloc(capacity * sizeof(int));
+    tree->length = (int*)malloc(capacity * sizeof(int));
+    tree->count = 0;
+    tree->capacity = capacity;
+    return tree;
+}
+
+// Free a flat tree
+void free_flat_tree(FlatTree* tree) {
+    free(tree->symbols);
+    free(tree->rules);
+    free(tree->arity);
+    free(tree->size);
+    free(tree->offset);
+    free(tree->length);
+    free(tree);
+}
+
+// Append a node after its children; leaves pass their source span, internal
+// nodes offset -1. Returns its index, or -1 if out of memory (the tree is
+// left as it was).
+int flat_append(FlatTree* tree, int symbol, int rule, int arity, int size,
+                int offset, int length) {
+    if (tree->count == tree->capacity) {
+        // Each array is kept as soon as it has grown; capacity follows once all have
+        int capacity = tree->capacity * 2;
+        Symbol* symbols = (Symbol*)realloc(tree->symbols, capacity * sizeof(Symbol));
+        if (!symbols) return -1;
+        tree->symbols = symbols;
+        int* rules = (int*)realloc(tree->rules, capacity * sizeof(int));
+        if (!rules) return -1;
+        tree->rules = rules;
+        uint16_t* arities = (uint16_t*)realloc(tree->arity, capacity * sizeof(uint16_t));
+        if (!arities) return -1;
+        tree->arity = arities;
+        int* sizes = (int*)realloc(tree->size, capacity * sizeof(int));
+        if (!sizes) return -1;
+        tree->size = sizes;
+        int* offsets = (int*)realloc(tree->offset, capacity * sizeof(int));
+        if (!offsets) return -1;
+        tree->offset = offsets;
+        int* lengths = (int*)realloc(tree->length, capacity * sizeof(int));
+        if (!lengths) return -1;
+        tree->length = lengths;
+        tree->capacity = capacity;
+    }
+    int i = tree->count++;
+    STAT_ADD(nodes, 1);
+    tree->symbols[i] = (Symbol)symbol;
+    tree->rules[i] = rule;
+    tree->arity[i] = (uint16_t)arity;
+    tree->size[i] = size;
+    tree->offset[i] = offset;
+    tree->length[i] = length;
+    return i;
+}
+
+// Index of the root (-1 if the tree is empty)
+int flat_root(FlatTree* tree) {
+    return tree->count - 1;
+}
+
+// Index of the first node of a subtree (its leftmost leaf)
+int flat_first(FlatTree* tree, int node) {
+    return node - tree->size[node] + 1;
+}
+
+// Index of child 'k' (0-based, left to right), or -1 if out of range
+int flat_child(FlatTree* tree, int node, int k) {
+    int arity = tree->arity[node];
+    if (k < 0 || k >= arity) return -1;
+    int child = node - 1;
+    for (int i = arity - 1; i > k; i--) {
+        child -= tree->size[child];
+    }
+    return child;
+}
+
+// Store the children of 'node' left to right in 'out'; returns their count
+int flat_children(FlatTree* tree, int node, int* out) {
+    int arity = tree->arity[node];
+    int child = node - 1;
+    for (int i = arity - 1; i >= 0; i--) {
+        out[i] = child;
+        child -= tree->size[child];
+    }
+    return arity;
+}
+
+#define INDENT_LEVELS 64   // Deeper lines of the indented format give their depth instead
+
+// Hand the buffer to 'sink' once it is large (NULL sink = keep everything)
+static inline void outbuf_drain(OutBuf* out, FILE* sink) {
+    if (sink && out->len >= OUTBUF_FLUSH) {
+        fwrite(out->data, 1, out->len, sink);
+        out->len = 0;
+    }
+}
+
+// Write the start of a node: its symbol's name and, in the compact form,
+// "(" or "()"; JSON opens an object (and its children array). 'first' is 0
+// for a node that follows a sibling, 'depth' is the nesting level. Leaves
+// with a negative offset have no known span. Returns 0 if out of memory.
+static int open_node(OutBuf* out, const Grammar* grammar, int format, int symbol,
+                      int num_children, int first, int depth, long offset, int length) {
+    const char* name = grammar->names[symbol];
+    size_t name_len = name[1] ? strlen(name) : 1;   // Terminal 0 is one NUL byte
+    char* p;
     
-    // If this node has children, print them in parentheses
-    if (node->num_children > 0) {
-        printf("(");
-        for (int i = 0; i < node->num_children; i++) {
-            print_tree_recursive(node->children[i]);
+    if (format == TREE_INDENT) {
+        int levels = depth < INDENT_LEVELS ? depth : INDENT_LEVELS;
+        p = outbuf_reserve(out, 2 * INDENT_LEVELS + 16 + name_len);
+        if (!p) return 0;
+        memset(p, ' ', 2 * levels);
+        p += 2 * levels;
+        if (depth > INDENT_LEVELS) p += sprintf(p, "[%d] ", depth);
+        memcpy(p, name, name_len);
+        p += name_len;
+        *p++ = '\n';
+    } else if (format == TREE_JSON) {
+        p = outbuf_reserve(out, 64 + 6 * name_len);
+        if (!p) return 0;
+        if (!first) *p++ = ',';
+        memcpy(p, "{\"symbol\":\"", 11);
+        p += 11;
+        for (size_t i = 0; i < name_len; i++) {
+            unsigned char c = (unsigned char)name[i];
+            if (c == '"' || c == '\\') *p++ = '\\';
+            if (c < 0x20) {
+                p += sprintf(p, "\\u%04x", c);
+            } else {
+                *p++ = (char)c;
+            }
+        }
+        if (num_children > 0 || IS_NONTERMINAL(symbol)) {
+            memcpy(p, "\",\"children\":[", 14);
+            p += 14;
+            if (num_children == 0) {
+                memcpy(p, "]}", 2);
+                p += 2;
+            }
+        } else if (offset >= 0) {
+            p += sprintf(p, "\",\"offset\":%ld,\"length\":%d}", offset, length);
+        } else {
+            memcpy(p, "\"}", 2);
+            p += 2;
         }
-        printf(")");
     } else {
-        // Leaf node - print empty parentheses for terminals
-        if (IS_TERMINAL(node->symbol)) {
-            printf("()");
+        p = outbuf_reserve(out, 2 + name_len);
+        if (!p) return 0;
+        memcpy(p, name, name_len);
+        p += name_len;
+        if (num_children > 0) {
+            *p++ = '(';
+        } else if (IS_TERMINAL(symbol)) {
+            *p++ = '(';
+            *p++ = ')';
         }
     }
+    out->len = p - out->data;
+    return 1;
 }
 
-// Print the entire tree
-void print_tree(Node* root) {
-    if (!root) {
-        printf("Empty tree\n");
-        return;
+// Write the end of a node that has children; returns 0 if out of memory
+static inline int close_node(OutBuf* out, int format) {
+    if (format == TREE_JSON) {
+        return outbuf_write(out, "]}", 2);
+    } else if (format == TREE_COMPACT) {
+        return outbuf_write(out, ")", 1);
     }
-    print_tree_recursive(root);
-    printf("\n");
+    return 1;
 }
 
-// Free tree memory recursively
-void free_tree(Node* node) {
-    if (!node) return;
+// Write the tree in 'format' (TREE_COMPACT, TREE_INDENT or TREE_JSON)
+// followed by a newline. Iterative: an explicit stack of (node, next
+// child) frames replaces recursion, so any depth works. The buffer is
+// handed to 'sink' in large blocks as it fills (NULL = keep it all).
+// With 'padded' set, leaf offsets count from the end of the previous leaf.
+// Returns 0 if out of memory (the output stops there).
+static int write_tree_spans(Node* root, const Grammar* grammar, int format, OutBuf* out,
+                            FILE* sink, int padded) {
+    if (!root) return 1;
     
-    for (int i = 0; i < node->num_children; i++) {
-        free_tree(node->children[i]);
+    typedef struct {
+        Node* node;
+        int next;       // Next child to visit
+    } Frame;
+    int capacity = 64;
+    int top = 0;
+    Frame* frames = (Frame*)malloc(capacity * sizeof(Frame));
+    long end = 0;       // End of the last leaf (padded offsets)
+    if (!frames || !open_node(out, grammar, format, root->symbol, root->num_children, 1, 0,
+                              root->offset, root->length)) {
+        free(frames);
+        return 0;
+    }
+    if (root->num_children > 0) {
+        frames[top].node = root;
+        frames[top].next = 0;
+        top++;
+    }
+    
+    int ok = 1;
+    while (top > 0 && ok) {
+        Frame* frame = &frames[top - 1];
+        if (frame->next == frame->node->num_children) {
+            ok = close_node(out, format);
+            top--;
+            continue;
+        }
+        Node* child = frame->node->children[frame->next++];
+        long offset = child->offset;
+        if (padded && child->num_children == 0 && IS_TERMINAL(child->symbol)) {
+            offset += end;
+            end = offset + child->length;
+        }
+        if (!open_node(out, grammar, format, child->symbol, child->num_children,
+                       frame->next == 1, top, offset, child->length)) {
+            ok = 0;
+            break;
+        }
+        if (child->num_children > 0) {
+            if (top == capacity) {
+                Frame* grown = (Frame*)realloc(frames, 2 * capacity * sizeof(Frame));
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                frames = grown;
+                capacity *= 2;
+            }
+            frames[top].node = child;
+            frames[top].next = 0;
+            top++;
+        }
+        outbuf_drain(out, sink);
     }
+    free(frames);
     
-    if (node->children) {
-        free(node->children);
+    if (ok && format != TREE_INDENT) ok = outbuf_write(out, "\n", 1);
+    if (sink) {
+        fwrite(out->data, 1, out->len, sink);
+        out->len = 0;
+    }
+    return ok;
+}
+
+int write_tree(Node* root, const Grammar* grammar, int format, OutBuf* out, FILE* sink) {
+    return write_tree_spans(root, grammar, format, out, sink, 0);
+}
+
+// write_tree for the trees of parse_incremental, whose leaf offsets are
+// paddings
+int write_padded_tree(Node* root, const Grammar* grammar, int format, OutBuf* out, FILE* sink) {
+    return write_tree_spans(root, grammar, format, out, sink, 1);
+}
+
+// Print the tree in 'format' on stdout through a reused buffer; returns 0
+// if out of memory
+int print_tree_as(Node* root, const Grammar* grammar, int format) {
+    static OutBuf buf = { NULL, 0, 0 };
+    if (!root) {
+        printf("Empty tree\n");
+        return 1;
     }
-    free(node);
+    return write_tree(root, grammar, format, &buf, stdout);
+}
+
+// Print the tree in the format S(a()...) on stdout
+void print_tree(Node* root, const Grammar* grammar) {
+    print_tree_as(root, grammar, TREE_COMPACT);
+}
+
+// Write a flat tree like write_tree (without the final newline), into
+// 'out' only. The explicit stack holds nodes to visit, each tagged with
+// whether it is a first child, and -1 for the end of a node's children.
+// Returns 0 if out of memory (the output stops there).
+int flat_tree_write(FlatTree* tree, const Grammar* grammar, int format, OutBuf* out) {
+    if (tree->count == 0) return 1;
+    int* todo = (int*)malloc((2 * (size_t)tree->count + 1) * sizeof(int));
+    if (!todo) return 0;
+    int top = 0;
+    int depth = 0;
+    int ok = 1;
+    todo[top++] = 2 * flat_root(tree) + 1;
+
+    while (top > 0 && ok) {
+        int entry = todo[--top];
+        if (entry < 0) {
+            ok = close_node(out, format);
+            depth--;
+            continue;
+        }
+        int node = entry >> 1;
+        int arity = tree->arity[node];
+        ok = open_node(out, grammar, format, tree->symbols[node], arity, entry & 1, depth,
+                       tree->offset[node], tree->length[node]);
+
+        if (arity > 0) {
+            todo[top++] = -1;
+            depth++;
+            // Push the children right to left so the leftmost is visited first
+            int child = node - 1;
+            for (int i = arity - 1; i >= 0; i--) {
+                todo[top++] = 2 * child + (i == 0);
+                child -= tree->size[child];
+            }
+        }
+    }
+    free(todo);
+    return ok;
+}
+
+// Append the tree in the format S(a()...) to an output buffer
+int flat_tree_to_buf(FlatTree* tree, const Grammar* grammar, OutBuf* out) {
+    return flat_tree_write(tree, grammar, TREE_COMPACT, out);
 }